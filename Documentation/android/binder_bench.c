@@ -0,0 +1,508 @@
+/*
+ * Binder transaction throughput test
+ *
+ * Forks N client/server process pairs. Each client makes synchronous
+ * empty transactions to its own server for a fixed time and the total
+ * rate is printed for each N next to the number of online cpus. With
+ * per process locking in the driver the rate keeps growing with N
+ * until N reaches the cpu count.
+ *
+ * Clients find their server through a forked registry process that
+ * becomes the context manager, so servicemanager must not be running.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * Build with: gcc -O2 -Idrivers/staging/android \
+ *	-o binder_bench Documentation/android/binder_bench.c
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <signal.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "binder.h"
+
+#define MAP_SIZE	(128 * 1024)
+#define MAX_PAIRS	64
+#define MAX_SERVERS	1024	/* server indexes over all runs */
+
+enum {
+	REG_ADD = 1,	/* struct reg_add: register a server */
+	REG_GET,	/* uint32_t index: reply with its handle, if known */
+	BENCH_PING,
+};
+
+struct reg_add {
+	uint32_t index;
+	struct flat_binder_object obj;
+};
+
+struct result {
+	uint64_t count;
+	uint64_t usecs;
+};
+
+/* commands queued for the next BINDER_WRITE_READ */
+struct wbuf {
+	char data[256];
+	size_t len;
+};
+
+typedef void (*txn_handler)(struct wbuf *w, struct binder_transaction_data *txn);
+
+static void pabort(const char *s)
+{
+	perror(s);
+	abort();
+}
+
+static uint64_t now_us(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static void put(struct wbuf *w, const void *data, size_t len)
+{
+	if (w->len + len > sizeof(w->data)) {
+		fprintf(stderr, "command buffer overflow\n");
+		exit(1);
+	}
+	memcpy(w->data + w->len, data, len);
+	w->len += len;
+}
+
+static void put32(struct wbuf *w, uint32_t v)
+{
+	put(w, &v, sizeof(v));
+}
+
+static void putptr(struct wbuf *w, const void *p)
+{
+	put(w, &p, sizeof(p));
+}
+
+static void put_txn(struct wbuf *w, uint32_t cmd, uint32_t handle,
+		    uint32_t code, const void *data, size_t size,
+		    const void *offsets, size_t offsets_size)
+{
+	struct binder_transaction_data txn;
+
+	memset(&txn, 0, sizeof(txn));
+	txn.target.handle = handle;
+	txn.code = code;
+	txn.data_size = size;
+	txn.offsets_size = offsets_size;
+	txn.data.ptr.buffer = data;
+	txn.data.ptr.offsets = offsets;
+	put32(w, cmd);
+	put(w, &txn, sizeof(txn));
+}
+
+static int binder_dev_open(void)
+{
+	struct binder_version vers;
+	int fd;
+
+	fd = open("/dev/binder", O_RDWR);
+	if (fd < 0)
+		pabort("open /dev/binder");
+	if (ioctl(fd, BINDER_VERSION, &vers) < 0)
+		pabort("BINDER_VERSION");
+	if (vers.protocol_version != BINDER_CURRENT_PROTOCOL_VERSION) {
+		fprintf(stderr, "binder protocol %ld, expected %d\n",
+			vers.protocol_version, BINDER_CURRENT_PROTOCOL_VERSION);
+		exit(1);
+	}
+	if (mmap(NULL, MAP_SIZE, PROT_READ, MAP_PRIVATE, fd, 0) == MAP_FAILED)
+		pabort("mmap /dev/binder");
+	return fd;
+}
+
+/*
+ * One BINDER_WRITE_READ: send what is queued in w, then process the
+ * returns. Handlers queue their answers in w for the next call.
+ * Returns 1 if a reply was received and copied to *reply.
+ */
+static int binder_io(int fd, struct wbuf *w,
+		     struct binder_transaction_data *reply,
+		     txn_handler handler)
+{
+	uint32_t rbuf[64];
+	struct binder_write_read bwr;
+	char *ptr, *end;
+	int got_reply = 0;
+
+	memset(&bwr, 0, sizeof(bwr));
+	bwr.write_size = w->len;
+	bwr.write_buffer = (unsigned long)w->data;
+	bwr.read_size = sizeof(rbuf);
+	bwr.read_buffer = (unsigned long)rbuf;
+	while (ioctl(fd, BINDER_WRITE_READ, &bwr) < 0) {
+		if (errno != EINTR)
+			pabort("BINDER_WRITE_READ");
+	}
+	w->len = 0;
+
+	ptr = (char *)rbuf;
+	end = ptr + bwr.read_consumed;
+	while (ptr < end) {
+		uint32_t cmd;
+
+		memcpy(&cmd, ptr, sizeof(cmd));
+		ptr += sizeof(cmd);
+		switch (cmd) {
+		case BR_NOOP:
+		case BR_TRANSACTION_COMPLETE:
+		case BR_SPAWN_LOOPER:
+			break;
+		case BR_INCREFS:
+		case BR_ACQUIRE:
+		case BR_RELEASE:
+		case BR_DECREFS: {
+			struct binder_ptr_cookie pc;
+
+			memcpy(&pc, ptr, sizeof(pc));
+			ptr += sizeof(pc);
+			if (cmd == BR_INCREFS || cmd == BR_ACQUIRE) {
+				put32(w, cmd == BR_INCREFS ?
+				      BC_INCREFS_DONE : BC_ACQUIRE_DONE);
+				put(w, &pc, sizeof(pc));
+			}
+			break;
+		}
+		case BR_TRANSACTION: {
+			struct binder_transaction_data txn;
+
+			memcpy(&txn, ptr, sizeof(txn));
+			ptr += sizeof(txn);
+			if (handler == NULL) {
+				fprintf(stderr, "%d: unexpected transaction\n",
+					getpid());
+				exit(1);
+			}
+			handler(w, &txn);
+			break;
+		}
+		case BR_REPLY:
+			memcpy(reply, ptr, sizeof(*reply));
+			ptr += sizeof(*reply);
+			got_reply = 1;
+			break;
+		case BR_DEAD_BINDER:
+			ptr += sizeof(void *);
+			break;
+		case BR_DEAD_REPLY:
+		case BR_FAILED_REPLY:
+			fprintf(stderr, "%d: transaction failed, %s\n", getpid(),
+				cmd == BR_DEAD_REPLY ? "dead reply" :
+				"failed reply");
+			exit(1);
+		default:
+			fprintf(stderr, "%d: unexpected return %x\n", getpid(),
+				cmd);
+			exit(1);
+		}
+	}
+	/* a failed write shows up as an error return, nothing is lost */
+	return got_reply;
+}
+
+/* synchronous transaction, the reply buffer must be freed by the caller */
+static void binder_call(int fd, struct wbuf *w, uint32_t handle,
+			uint32_t code, const void *data, size_t size,
+			const void *offsets, size_t offsets_size,
+			struct binder_transaction_data *reply)
+{
+	put_txn(w, BC_TRANSACTION, handle, code, data, size,
+		offsets, offsets_size);
+	while (!binder_io(fd, w, reply, NULL))
+		;
+}
+
+static uint32_t reg_handles[MAX_SERVERS];
+
+static void registry_txn(struct wbuf *w, struct binder_transaction_data *txn)
+{
+	static struct flat_binder_object obj;
+	static size_t obj_offset;
+	const void *data = txn->data.ptr.buffer;
+	uint32_t index;
+
+	if (txn->code == REG_ADD && txn->data_size >= sizeof(struct reg_add)) {
+		const struct reg_add *add = data;
+
+		if (add->index < MAX_SERVERS &&
+		    add->obj.type == BINDER_TYPE_HANDLE) {
+			reg_handles[add->index] = add->obj.handle;
+			/* keep the ref once the buffer is freed */
+			put32(w, BC_ACQUIRE);
+			put32(w, add->obj.handle);
+		}
+		put32(w, BC_FREE_BUFFER);
+		putptr(w, data);
+		put_txn(w, BC_REPLY, 0, 0, NULL, 0, NULL, 0);
+		return;
+	}
+	if (txn->code == REG_GET && txn->data_size >= sizeof(index)) {
+		memcpy(&index, data, sizeof(index));
+		put32(w, BC_FREE_BUFFER);
+		putptr(w, data);
+		if (index < MAX_SERVERS && reg_handles[index]) {
+			memset(&obj, 0, sizeof(obj));
+			obj.type = BINDER_TYPE_HANDLE;
+			obj.handle = reg_handles[index];
+			obj_offset = 0;
+			put_txn(w, BC_REPLY, 0, 0, &obj, sizeof(obj),
+				&obj_offset, sizeof(obj_offset));
+		} else
+			put_txn(w, BC_REPLY, 0, 0, NULL, 0, NULL, 0);
+		return;
+	}
+	put32(w, BC_FREE_BUFFER);
+	putptr(w, data);
+	put_txn(w, BC_REPLY, 0, 0, NULL, 0, NULL, 0);
+}
+
+static void run_registry(int ready_fd)
+{
+	struct wbuf w = { .len = 0 };
+	int fd = binder_dev_open();
+
+	if (ioctl(fd, BINDER_SET_CONTEXT_MGR, 0) < 0) {
+		perror("BINDER_SET_CONTEXT_MGR (is servicemanager running?)");
+		exit(1);
+	}
+	if (write(ready_fd, "r", 1) != 1)
+		pabort("write");
+	close(ready_fd);
+	put32(&w, BC_ENTER_LOOPER);
+	for (;;)
+		binder_io(fd, &w, NULL, registry_txn);
+}
+
+static void server_txn(struct wbuf *w, struct binder_transaction_data *txn)
+{
+	put32(w, BC_FREE_BUFFER);
+	putptr(w, txn->data.ptr.buffer);
+	put_txn(w, BC_REPLY, 0, 0, NULL, 0, NULL, 0);
+}
+
+static void run_server(uint32_t index)
+{
+	struct wbuf w = { .len = 0 };
+	struct binder_transaction_data reply;
+	struct reg_add add;
+	size_t offset = offsetof(struct reg_add, obj);
+	int fd = binder_dev_open();
+
+	memset(&add, 0, sizeof(add));
+	add.index = index;
+	add.obj.type = BINDER_TYPE_BINDER;
+	add.obj.binder = (void *)(uintptr_t)(index + 1);
+	add.obj.cookie = add.obj.binder;
+	put32(&w, BC_ENTER_LOOPER);
+	binder_call(fd, &w, 0, REG_ADD, &add, sizeof(add),
+		    &offset, sizeof(offset), &reply);
+	put32(&w, BC_FREE_BUFFER);
+	putptr(&w, reply.data.ptr.buffer);
+	for (;;)
+		binder_io(fd, &w, NULL, server_txn);
+}
+
+static void run_client(uint32_t index, int ready_fd, int go_fd,
+		       int result_fd, unsigned int seconds)
+{
+	struct wbuf w = { .len = 0 };
+	struct binder_transaction_data reply;
+	struct result res;
+	uint32_t handle = 0;
+	uint64_t start, end;
+	char c;
+	int fd = binder_dev_open();
+
+	while (!handle) {
+		binder_call(fd, &w, 0, REG_GET, &index, sizeof(index),
+			    NULL, 0, &reply);
+		if (reply.data_size >= sizeof(struct flat_binder_object) &&
+		    reply.offsets_size) {
+			const struct flat_binder_object *obj =
+				reply.data.ptr.buffer;
+
+			handle = obj->handle;
+			put32(&w, BC_ACQUIRE);
+			put32(&w, handle);
+		}
+		put32(&w, BC_FREE_BUFFER);
+		putptr(&w, reply.data.ptr.buffer);
+		if (!handle)
+			usleep(1000);
+	}
+	if (write(ready_fd, "c", 1) != 1 || read(go_fd, &c, 1) != 1)
+		pabort("start");
+
+	res.count = 0;
+	start = now_us();
+	end = start + (uint64_t)seconds * 1000000;
+	do {
+		binder_call(fd, &w, handle, BENCH_PING, NULL, 0, NULL, 0,
+			    &reply);
+		put32(&w, BC_FREE_BUFFER);
+		putptr(&w, reply.data.ptr.buffer);
+		res.count++;
+	} while (now_us() < end);
+	res.usecs = now_us() - start;
+	if (write(result_fd, &res, sizeof(res)) != sizeof(res))
+		pabort("write result");
+	exit(0);
+}
+
+static double run(unsigned int pairs, uint32_t base, unsigned int seconds)
+{
+	pid_t servers[MAX_PAIRS], clients[MAX_PAIRS];
+	int ready[2], go[2], result[2];
+	double rate = 0;
+	unsigned int i;
+	char c;
+
+	if (pipe(ready) || pipe(go) || pipe(result))
+		pabort("pipe");
+	for (i = 0; i < pairs; i++) {
+		servers[i] = fork();
+		if (servers[i] < 0)
+			pabort("fork");
+		if (servers[i] == 0)
+			run_server(base + i);
+		clients[i] = fork();
+		if (clients[i] < 0)
+			pabort("fork");
+		if (clients[i] == 0)
+			run_client(base + i, ready[1], go[0], result[1],
+				   seconds);
+	}
+	for (i = 0; i < pairs; i++) {
+		if (read(ready[0], &c, 1) != 1)
+			pabort("wait for clients");
+	}
+	for (i = 0; i < pairs; i++) {
+		if (write(go[1], "g", 1) != 1)
+			pabort("start clients");
+	}
+	for (i = 0; i < pairs; i++) {
+		struct result res;
+
+		if (read(result[0], &res, sizeof(res)) != sizeof(res))
+			pabort("read result");
+		if (res.usecs)
+			rate += res.count * 1000000.0 / res.usecs;
+		waitpid(clients[i], NULL, 0);
+	}
+	for (i = 0; i < pairs; i++) {
+		kill(servers[i], SIGKILL);
+		waitpid(servers[i], NULL, 0);
+	}
+	close(ready[0]);
+	close(ready[1]);
+	close(go[0]);
+	close(go[1]);
+	close(result[0]);
+	close(result[1]);
+	return rate;
+}
+
+static void print_usage(const char *prog)
+{
+	printf("Usage: %s [-nt]\n", prog);
+	puts("  -n --pairs    client/server pairs (default 1, 2, 4, .. 2 * cpus)\n"
+	     "  -t --time     seconds per run (default 2)\n");
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	static const struct option lopts[] = {
+		{ "pairs", 1, 0, 'n' },
+		{ "time",  1, 0, 't' },
+		{ NULL, 0, 0, 0 },
+	};
+	unsigned int pairs = 0, seconds = 2, max_pairs, n;
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	uint32_t base = 0;
+	int reg_ready[2];
+	pid_t registry;
+	char c;
+
+	for (;;) {
+		int opt = getopt_long(argc, argv, "n:t:", lopts, NULL);
+
+		if (opt == -1)
+			break;
+		switch (opt) {
+		case 'n':
+			pairs = atoi(optarg);
+			break;
+		case 't':
+			seconds = atoi(optarg);
+			break;
+		default:
+			print_usage(argv[0]);
+		}
+	}
+	if (pairs > MAX_PAIRS || seconds == 0)
+		print_usage(argv[0]);
+	if (cpus < 1)
+		cpus = 1;
+
+	if (pipe(reg_ready))
+		pabort("pipe");
+	registry = fork();
+	if (registry < 0)
+		pabort("fork");
+	if (registry == 0) {
+		close(reg_ready[0]);
+		run_registry(reg_ready[1]);
+	}
+	close(reg_ready[1]);
+	if (read(reg_ready[0], &c, 1) != 1) {
+		fprintf(stderr, "registry failed to start\n");
+		return 1;
+	}
+
+	printf("cpus online: %ld\n", cpus);
+	printf("pairs  transactions/s  per pair\n");
+	max_pairs = pairs ? pairs : cpus * 2;
+	if (max_pairs > MAX_PAIRS)
+		max_pairs = MAX_PAIRS;
+	for (n = pairs ? pairs : 1; n <= max_pairs; n *= 2) {
+		double rate;
+
+		if (base + n > MAX_SERVERS)
+			break;
+		rate = run(n, base, seconds);
+		base += n;
+		printf("%5u  %14.0f  %8.0f\n", n, rate, rate / n);
+		fflush(stdout);
+		if (pairs)
+			break;
+	}
+
+	kill(registry, SIGKILL);
+	waitpid(registry, NULL, 0);
+	return 0;
+}
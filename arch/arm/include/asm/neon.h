@@ -0,0 +1,43 @@
+/*
+ *  arch/arm/include/asm/neon.h
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#ifndef __ASM_ARM_NEON_H
+#define __ASM_ARM_NEON_H
+
+/*
+ * memcpy, memset and __memzero hand requests at least this long to the
+ * NEON string code, which decides whether NEON can be used. Each NEON
+ * call may save the current VFP context, and the owner then traps to
+ * reload it, so this is kept at a page for the copy to pay for that.
+ */
+#define ARM_NEON_STRING_MIN	4096
+/* the NEON loops move this many bytes per iteration */
+#define ARM_NEON_STRING_BLOCK	64
+
+#ifndef __ASSEMBLY__
+#include <linux/types.h>
+
+void kernel_neon_begin(void);
+void kernel_neon_end(void);
+
+#ifdef CONFIG_ARM_NEON_STRING
+/* the plain ARM entry points, without the NEON dispatch */
+void *__memcpy_arm(void *dest, const void *src, size_t n);
+void *__memset_arm(void *s, int c, size_t n);
+
+/* n must be a non-zero multiple of ARM_NEON_STRING_BLOCK */
+void __memcpy_neon(void *dest, const void *src, size_t n);
+void __memset_neon(void *s, int c, size_t n);
+
+/* called by the ARM string functions for requests of ARM_NEON_STRING_MIN */
+void *memcpy_large(void *dest, const void *src, size_t n);
+void *memset_large(void *s, int c, size_t n);
+int copy_page_neon(void *to, const void *from);
+#endif
+#endif
+
+#endif
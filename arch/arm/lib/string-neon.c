@@ -0,0 +1,138 @@
+/*
+ *  linux/arch/arm/lib/string-neon.c
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ *  memcpy, memset, __memzero and copy_page pass large requests here.
+ *  They are done with NEON if a measurement at boot found it faster than
+ *  the ARM loops on this CPU, and the caller's context allows it.
+ */
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/sched.h>
+#include <linux/hardirq.h>
+#include <linux/gfp.h>
+#include <linux/math64.h>
+
+#include <asm/hwcap.h>
+#include <asm/neon.h>
+#include <asm/page.h>
+
+static int neon_string __read_mostly;
+
+/* kernel mode NEON can't be used from interrupts or with them off */
+static inline int neon_string_usable(void)
+{
+	return neon_string && !in_interrupt() && !irqs_disabled();
+}
+
+static void *memcpy_neon(void *dest, const void *src, size_t n)
+{
+	size_t bulk = n & ~(ARM_NEON_STRING_BLOCK - 1);
+
+	kernel_neon_begin();
+	__memcpy_neon(dest, src, bulk);
+	kernel_neon_end();
+	if (n != bulk)
+		__memcpy_arm(dest + bulk, src + bulk, n - bulk);
+	return dest;
+}
+
+void *memcpy_large(void *dest, const void *src, size_t n)
+{
+	if (!neon_string_usable())
+		return __memcpy_arm(dest, src, n);
+	return memcpy_neon(dest, src, n);
+}
+
+void *memset_large(void *s, int c, size_t n)
+{
+	size_t bulk = n & ~(ARM_NEON_STRING_BLOCK - 1);
+
+	if (!neon_string_usable())
+		return __memset_arm(s, c, n);
+
+	kernel_neon_begin();
+	__memset_neon(s, c, bulk);
+	kernel_neon_end();
+	if (n != bulk)
+		__memset_arm(s + bulk, c, n - bulk);
+	return s;
+}
+
+int copy_page_neon(void *to, const void *from)
+{
+	if (!neon_string_usable())
+		return 0;
+
+	kernel_neon_begin();
+	__memcpy_neon(to, from, PAGE_SIZE);
+	kernel_neon_end();
+	return 1;
+}
+
+#define BENCH_ORDER	5
+#define BENCH_BYTES	(4 << 20)
+
+/* returns MB/s */
+static unsigned long __init bench_copy(void *(*copy)(void *, const void *,
+	size_t), void *dst, const void *src, size_t size)
+{
+	int i, loops = BENCH_BYTES / size;
+	u64 start, ns;
+
+	start = sched_clock();
+	for (i = 0; i < loops; i++)
+		copy(dst, src, size);
+	ns = sched_clock() - start;
+
+	return ns ? div64_u64((u64)loops * size * 1000, ns) : 0;
+}
+
+/*
+ * Time the ARM and NEON copies over a few sizes and source alignments,
+ * log the throughput and switch to NEON if it wins at page size. Nothing
+ * owns the VFP here, so the NEON figures leave out the context save and
+ * reload a user of the VFP would cause; ARM_NEON_STRING_MIN allows for it.
+ */
+static int __init neon_string_init(void)
+{
+	static const size_t sizes[] = { PAGE_SIZE, 32768 };
+	unsigned long arm, neon, arm_page = 0, neon_page = 0;
+	char *buf;
+	int i, off;
+
+	if (!(elf_hwcap & HWCAP_NEON))
+		return 0;
+
+	buf = (char *)__get_free_pages(GFP_KERNEL, BENCH_ORDER);
+	if (!buf)
+		return 0;
+
+	for (i = 0; i < ARRAY_SIZE(sizes); i++)
+		for (off = 0; off < 4; off += 3) {
+			char *src = buf + off;
+			char *dst = buf + (PAGE_SIZE << (BENCH_ORDER - 1));
+
+			arm = bench_copy(__memcpy_arm, dst, src, sizes[i]);
+			neon = bench_copy(memcpy_neon, dst, src, sizes[i]);
+			pr_info("neon string: copy %zu bytes, src offset %d: "
+				"arm %lu MB/s, neon %lu MB/s\n",
+				sizes[i], off, arm, neon);
+			if (sizes[i] == PAGE_SIZE && !off) {
+				arm_page = arm;
+				neon_page = neon;
+			}
+		}
+
+	free_pages((unsigned long)buf, BENCH_ORDER);
+
+	neon_string = neon_page > arm_page;
+	pr_info("neon string: using %s for large copies and fills\n",
+		neon_string ? "NEON" : "ARM");
+	return 0;
+}
+/* after vfp_init() has set HWCAP_NEON */
+late_initcall(neon_string_init);
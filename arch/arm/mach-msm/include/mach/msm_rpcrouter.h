@@ -163,6 +163,41 @@ int msm_rpc_call(struct msm_rpc_endpoint *ept, uint32_t proc,
 		 void *request, int request_size,
 		 long timeout);
 
+/* asynchronous rpc call
+ *
+ * The request is filled out and sent as for msm_rpc_call, but the
+ * caller does not wait for the reply.  When the reply with the
+ * matching xid arrives, cb is called from the router's workqueue with
+ * the reply and its length, or with a NULL reply and a negative error
+ * (-EPERM, -EINVAL as for msm_rpc_call_reply; -ENETRESET if the
+ * modem restarts; -ECANCELED if the endpoint is closed first).  The
+ * reply is freed when cb returns.  Any number of calls may be in
+ * flight on one endpoint.  No callback is made if the call returns
+ * an error.
+ */
+typedef void (*msm_rpc_async_cb)(struct msm_rpc_endpoint *ept,
+				 void *reply, int len, void *data);
+
+int msm_rpc_call_async(struct msm_rpc_endpoint *ept, uint32_t proc,
+		       void *request, int request_size,
+		       msm_rpc_async_cb cb, void *data);
+
+struct msm_rpc_async_req {
+	uint32_t proc;
+	void *request;
+	int request_size;
+	msm_rpc_async_cb cb;
+	void *data;
+};
+
+/* Submit num asynchronous calls, packing the small ones into as few
+ * transport writes as flow control allows.  Returns the number of
+ * calls submitted, which is less than num only if a submission
+ * failed, or a negative error if none were.
+ */
+int msm_rpc_call_async_batch(struct msm_rpc_endpoint *ept,
+			     struct msm_rpc_async_req *reqs, int num);
+
 struct msm_rpc_xdr {
 	void *in_buf;
 	uint32_t in_size;
@@ -18,6 +18,8 @@
 #ifndef __ASM_ARCH_MSM_SMD_H
 #define __ASM_ARCH_MSM_SMD_H
 
+#include <linux/uio.h>
+
 typedef struct smd_channel smd_channel_t;
 
 /* warning: notify() may be called before open returns */
@@ -44,6 +46,26 @@ int smd_write(smd_channel_t *ch, const void *data, int len);
 int smd_write_avail(smd_channel_t *ch);
 int smd_read_avail(smd_channel_t *ch);
 
+/* Zero-copy access to the shared memory fifos.
+** The fifo may wrap, so data is described by two kvecs, the second
+** of which may be empty.  Peek or reserve, access the fifo in place,
+** then consume or commit.  Passing SMD_XFER_MORE to consume/commit
+** holds back the interrupt to the other side so a batch of packets
+** costs a single interrupt; the last call of a batch must not pass it.
+** Inside the notify callback use smd_read_consume_from_cb().
+*/
+#define SMD_XFER_MORE 0x1
+
+int smd_read_peek(smd_channel_t *ch, struct kvec *iov);
+int smd_read_consume(smd_channel_t *ch, int len, unsigned flags);
+int smd_read_consume_from_cb(smd_channel_t *ch, int len, unsigned flags);
+int smd_write_reserve(smd_channel_t *ch, int len, struct kvec *iov);
+int smd_write_commit(smd_channel_t *ch, int len, unsigned flags);
+
+/* scatter/gather versions of smd_read() and smd_write() */
+int smd_readv(smd_channel_t *ch, const struct kvec *iov, int niov);
+int smd_writev(smd_channel_t *ch, const struct kvec *iov, int niov);
+
 /* Returns the total size of the current packet being read.
 ** Returns 0 if no packets available or a stream channel.
 */
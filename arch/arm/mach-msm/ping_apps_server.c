@@ -27,6 +27,9 @@
 #include <linux/err.h>
 #include <linux/kthread.h>
 #include <linux/workqueue.h>
+#include <linux/debugfs.h>
+#include <linux/uaccess.h>
+#include <linux/ktime.h>
 #include <mach/msm_rpcrouter.h>
 
 /* ping server definitions */
@@ -580,7 +583,7 @@ static int handle_rpc_call(struct msm_rpc_server *server,
 {
 	switch (req->procedure) {
 	case PING_APPS_NULL:
-		pr_info("%s: null procedure request received\n", __func__);
+		pr_debug("%s: null procedure request received\n", __func__);
 		return 0;
 	case PING_APPS_DATA:
 		return handle_ping_apps_data_register(server, req, xdr);
@@ -597,10 +600,100 @@ static int handle_rpc_call(struct msm_rpc_server *server,
 	}
 }
 
+#if defined(CONFIG_MSM_RPC_LOOPBACK_XPRT)
+/*
+ * Loopback benchmark: an apps client times NULL calls to this server
+ * over the local loopback transport.  Write the number of calls to
+ * run, read back the call rate and per-call latency.
+ */
+static char bench_res[160];
+static DEFINE_MUTEX(bench_lock);
+
+static int ping_apps_bench(unsigned num)
+{
+	struct msm_rpc_endpoint *ept;
+	struct rpc_request_hdr req;
+	ktime_t start;
+	u64 ns, total_ns = 0, min_ns = ULLONG_MAX, max_ns = 0;
+	unsigned i;
+	int rc = 0;
+
+	ept = msm_rpc_connect_compatible(PING_APPS_PROG, PING_APPS_VERS, 0);
+	if (IS_ERR(ept))
+		return PTR_ERR(ept);
+
+	for (i = 0; i < num; i++) {
+		start = ktime_get();
+		rc = msm_rpc_call(ept, PING_APPS_NULL, &req, sizeof(req),
+				  5 * HZ);
+		if (rc < 0)
+			break;
+		ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+		total_ns += ns;
+		min_ns = min(min_ns, ns);
+		max_ns = max(max_ns, ns);
+	}
+	msm_rpc_close(ept);
+
+	if (rc < 0) {
+		pr_err("%s: call %u failed: %d\n", __func__, i, rc);
+		return rc;
+	}
+
+	snprintf(bench_res, sizeof(bench_res),
+		 "calls %u\ncalls_per_sec %llu\n"
+		 "lat_avg_us %llu\nlat_min_us %llu\nlat_max_us %llu\n",
+		 num, div64_u64((u64)num * NSEC_PER_SEC, total_ns ?: 1),
+		 div64_u64(total_ns, (u64)num * NSEC_PER_USEC),
+		 div64_u64(min_ns, NSEC_PER_USEC),
+		 div64_u64(max_ns, NSEC_PER_USEC));
+	return 0;
+}
+
+static ssize_t ping_apps_bench_read(struct file *fp, char __user *buf,
+				    size_t count, loff_t *pos)
+{
+	return simple_read_from_buffer(buf, count, pos, bench_res,
+				       strlen(bench_res));
+}
+
+static ssize_t ping_apps_bench_write(struct file *fp, const char __user *buf,
+				     size_t count, loff_t *pos)
+{
+	char cmd[16];
+	unsigned long num;
+	int len, rc;
+
+	len = count > sizeof(cmd) - 1 ? sizeof(cmd) - 1 : count;
+	if (copy_from_user(cmd, buf, len))
+		return -EFAULT;
+	cmd[len] = 0;
+
+	if (strict_strtoul(strstrip(cmd), 0, &num) || !num)
+		return -EINVAL;
+
+	mutex_lock(&bench_lock);
+	rc = ping_apps_bench(num);
+	mutex_unlock(&bench_lock);
+
+	return rc < 0 ? rc : count;
+}
+
+static const struct file_operations ping_apps_bench_ops = {
+	.owner = THIS_MODULE,
+	.read = ping_apps_bench_read,
+	.write = ping_apps_bench_write,
+};
+#endif
+
 static int __init ping_apps_server_init(void)
 {
 	INIT_LIST_HEAD(&cb_entry_list);
 	server_thread = ERR_PTR(-1);
+#if defined(CONFIG_MSM_RPC_LOOPBACK_XPRT)
+	debugfs_create_file("ping_apps_bench", 0644, NULL, NULL,
+			    &ping_apps_bench_ops);
+#endif
 	return msm_rpc_create_server2(&rpc_server);
 }
 
@@ -246,6 +246,26 @@ static int rpcrouter_sdio_remote_write(void *data, uint32_t len,
 		spin_unlock_irqrestore(&write_list_lock, flags);
 		queue_work(sdio_xprt_read_workqueue, &work_write_data);
 		return len;
+	case PACKETS:
+		SDIO_XPRT_DBG("sdio_xprt WRITE PACKETS %s\n", __func__);
+		/* called with the router's xprt lock held */
+		sdio_write_pkt = kmalloc(sizeof(struct sdio_write_data_struct),
+					 GFP_ATOMIC);
+		if (!sdio_write_pkt)
+			return -ENOMEM;
+		sdio_write_pkt->write_len = len;
+		sdio_write_pkt->write_data = kmalloc(len, GFP_ATOMIC);
+		if (!sdio_write_pkt->write_data) {
+			kfree(sdio_write_pkt);
+			return -ENOMEM;
+		}
+		memcpy(sdio_write_pkt->write_data, data, len);
+
+		spin_lock_irqsave(&write_list_lock, flags);
+		list_add_tail(&sdio_write_pkt->list, &write_list);
+		spin_unlock_irqrestore(&write_list_lock, flags);
+		queue_work(sdio_xprt_read_workqueue, &work_write_data);
+		return len;
 	default:
 		return -EINVAL;
 	}
@@ -29,6 +29,7 @@
 #include <linux/io.h>
 #include <linux/termios.h>
 #include <linux/ctype.h>
+#include <linux/hrtimer.h>
 #include <mach/msm_smd.h>
 #include <mach/msm_iomap.h>
 #include <mach/system.h>
@@ -271,6 +272,11 @@ struct smd_channel {
 	char name[20];
 	struct platform_device pdev;
 	unsigned type;
+	int is_pkt_ch;
+
+	/* events handled from the interrupt and from edge polling */
+	unsigned intr_count;
+	unsigned poll_count;
 };
 
 static LIST_HEAD(smd_ch_closed_list);
@@ -529,15 +535,58 @@ static void smd_state_change(struct smd_channel *ch,
 	}
 }
 
-static void handle_smd_irq(struct list_head *list, void (*notify)(void))
+/*
+ * Count the packets waiting in a channel, stopping at limit: the one
+ * being read plus those queued behind it. A stream has no packet
+ * boundaries and counts as one packet while it has data.
+ */
+static int smd_packets_pending(struct smd_channel *ch, int limit)
+{
+	unsigned avail = smd_stream_read_avail(ch);
+	unsigned pos, len, size, i;
+	int n;
+
+	if (!ch->is_pkt_ch)
+		return avail ? 1 : 0;
+	if (!ch->current_packet)
+		return 0;
+
+	n = 1;
+	len = min(ch->current_packet, avail);
+	pos = (ch->recv->tail + len) & ch->fifo_mask;
+	avail -= len;
+	while (n < limit && avail >= SMD_HEADER_SIZE) {
+		/* the header's length word may be unaligned or wrap */
+		for (i = 0; i < sizeof(size); i++)
+			((unsigned char *)&size)[i] =
+				ch->recv_data[(pos + i) & ch->fifo_mask];
+		n++;
+		if (size >= avail - SMD_HEADER_SIZE)
+			break;
+		len = SMD_HEADER_SIZE + size;
+		pos = (pos + len) & ch->fifo_mask;
+		avail -= len;
+	}
+	return n;
+}
+
+/*
+ * Service the channels of an edge. Channels are handled until budget
+ * packets have been delivered to their clients, a channel with only a
+ * state or tx space event counting as one; if the budget runs out the
+ * list is rotated so that the next call starts with the channels that
+ * were skipped. A budget of -1 means no limit. Returns the number of
+ * packets handled.
+ */
+static int handle_smd_edge(struct list_head *list, void (*notify)(void),
+			   int budget, int polled)
 {
-	unsigned long flags;
 	struct smd_channel *ch;
 	int do_notify = 0;
 	unsigned ch_flags;
 	unsigned tmp;
+	int work = 0;
 
-	spin_lock_irqsave(&smd_lock, flags);
 	list_for_each_entry(ch, list, ch_list) {
 		ch_flags = 0;
 		if (ch_is_open(ch)) {
@@ -561,26 +610,239 @@ static void handle_smd_irq(struct list_head *list, void (*notify)(void))
 		if (tmp != ch->last_state)
 			smd_state_change(ch, ch->last_state, tmp);
 		if (ch_flags) {
+			if (polled)
+				ch->poll_count++;
+			else
+				ch->intr_count++;
 			ch->update_state(ch);
+			/* counted before the client drains them */
+			work += max(smd_packets_pending(ch, budget > 0 ?
+						budget - work : INT_MAX), 1);
 			ch->notify(ch->priv, SMD_EVENT_DATA);
+
+			if (budget > 0 && work >= budget) {
+				/* start after this channel next time */
+				list_move(list, &ch->ch_list);
+				break;
+			}
 		}
 	}
 	if (do_notify)
 		notify();
+
+	return work;
+}
+
+static void handle_smd_irq(struct list_head *list, void (*notify)(void))
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&smd_lock, flags);
+	handle_smd_edge(list, notify, -1, 0);
 	spin_unlock_irqrestore(&smd_lock, flags);
 	do_smd_probe();
 }
 
+/*
+ * Interrupt coalescing. An edge that takes more than smd_coalesce_irqs
+ * interrupts within one jiffy is switched to polled mode: its
+ * interrupt is masked and a timer services its channels every
+ * smd_poll_interval_us, handling about smd_poll_budget packets per
+ * cycle. After SMD_POLL_IDLE_CYCLES cycles with nothing to do the
+ * interrupt is unmasked again. smd_coalesce_irqs = 0 disables this.
+ */
+static int smd_coalesce_irqs = 8;
+module_param_named(coalesce_irqs, smd_coalesce_irqs,
+		   int, S_IRUGO | S_IWUSR | S_IWGRP);
+static int smd_poll_budget = 16;
+module_param_named(poll_budget, smd_poll_budget,
+		   int, S_IRUGO | S_IWUSR | S_IWGRP);
+static int smd_poll_interval_us = 1000;
+module_param_named(poll_interval_us, smd_poll_interval_us,
+		   int, S_IRUGO | S_IWUSR | S_IWGRP);
+
+#define SMD_POLL_IDLE_CYCLES 4
+
+static ktime_t smd_poll_interval(void)
+{
+	/* the parameter is writable at run time, so clamp it here */
+	int us = max(smd_poll_interval_us, 1);
+
+	return ns_to_ktime((u64)us * NSEC_PER_USEC);
+}
+
+struct smd_edge {
+	const char *name;
+	struct list_head *list;
+	void (*notify)(void);
+	unsigned irq;		/* 0 if the edge can't be polled */
+
+	int polling;
+	unsigned idle_cycles;
+	unsigned long window;
+	unsigned window_irqs;
+	struct hrtimer poll_timer;
+
+	/* stats */
+	unsigned irqs;
+	unsigned polls;
+	unsigned poll_entries;
+};
+
+enum {
+	SMD_EDGE_MODEM,
+	SMD_EDGE_DSP,
+	SMD_EDGE_DSPS,
+};
+
+static struct smd_edge smd_edges[] = {
+	[SMD_EDGE_MODEM] = {
+		.name = "modem",
+		.list = &smd_ch_list_modem,
+		.notify = notify_modem_smd,
+		.irq = INT_A9_M2A_0,
+	},
+	[SMD_EDGE_DSP] = {
+		.name = "dsp",
+		.list = &smd_ch_list_dsp,
+		.notify = notify_dsp_smd,
+#if defined(CONFIG_QDSP6) && (INT_ADSP_A11 != INT_ADSP_A11_SMSM)
+		/* masking a line shared with smsm would stall smsm */
+		.irq = INT_ADSP_A11,
+#endif
+	},
+	[SMD_EDGE_DSPS] = {
+		.name = "dsps",
+		.list = &smd_ch_list_dsps,
+		.notify = notify_dsps_smd,
+#if defined(CONFIG_DSPS)
+		.irq = INT_DSPS_A11,
+#endif
+	},
+};
+
+static int smd_edge_need_int(struct smd_edge *edge);
+
+static enum hrtimer_restart smd_edge_poll(struct hrtimer *timer)
+{
+	struct smd_edge *edge = container_of(timer, struct smd_edge,
+					     poll_timer);
+	unsigned long flags;
+	int work;
+
+	spin_lock_irqsave(&smd_lock, flags);
+	edge->polls++;
+	work = handle_smd_edge(edge->list, edge->notify,
+			       smd_poll_budget > 0 ? smd_poll_budget : -1, 1);
+
+	if (work)
+		edge->idle_cycles = 0;
+	else if (++edge->idle_cycles >= SMD_POLL_IDLE_CYCLES) {
+		edge->polling = 0;
+		enable_irq(edge->irq);
+		/* anything that raced with the unmask is handled now */
+		if (smd_edge_need_int(edge))
+			handle_smd_edge(edge->list, edge->notify, -1, 0);
+		spin_unlock_irqrestore(&smd_lock, flags);
+		return HRTIMER_NORESTART;
+	}
+	spin_unlock_irqrestore(&smd_lock, flags);
+	do_smd_probe();
+
+	hrtimer_forward_now(timer, smd_poll_interval());
+	return HRTIMER_RESTART;
+}
+
+static void smd_edge_irq(struct smd_edge *edge)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&smd_lock, flags);
+	edge->irqs++;
+
+	if (edge->window != jiffies) {
+		edge->window = jiffies;
+		edge->window_irqs = 0;
+	}
+
+	if (edge->irq && smd_coalesce_irqs > 0 && !edge->polling &&
+	    ++edge->window_irqs > smd_coalesce_irqs) {
+		edge->polling = 1;
+		edge->idle_cycles = 0;
+		edge->poll_entries++;
+		disable_irq_nosync(edge->irq);
+		hrtimer_start(&edge->poll_timer, smd_poll_interval(),
+			      HRTIMER_MODE_REL);
+	}
+	spin_unlock_irqrestore(&smd_lock, flags);
+
+	handle_smd_irq(edge->list, edge->notify);
+}
+
+static void smd_edges_init(void)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(smd_edges); i++) {
+		hrtimer_init(&smd_edges[i].poll_timer, CLOCK_MONOTONIC,
+			     HRTIMER_MODE_REL);
+		smd_edges[i].poll_timer.function = smd_edge_poll;
+	}
+}
+
+int smd_get_edge_stats(struct smd_edge_stats *stats, int max)
+{
+	unsigned long flags;
+	int i;
+
+	spin_lock_irqsave(&smd_lock, flags);
+	for (i = 0; i < ARRAY_SIZE(smd_edges) && i < max; i++) {
+		stats[i].name = smd_edges[i].name;
+		stats[i].polling = smd_edges[i].polling;
+		stats[i].irqs = smd_edges[i].irqs;
+		stats[i].polls = smd_edges[i].polls;
+		stats[i].poll_entries = smd_edges[i].poll_entries;
+	}
+	spin_unlock_irqrestore(&smd_lock, flags);
+
+	return i;
+}
+
+int smd_get_ch_stats(struct smd_ch_stats *stats, int max)
+{
+	struct smd_channel *ch;
+	unsigned long flags;
+	int i, n = 0;
+
+	spin_lock_irqsave(&smd_lock, flags);
+	for (i = 0; i < ARRAY_SIZE(smd_edges); i++) {
+		list_for_each_entry(ch, smd_edges[i].list, ch_list) {
+			if (n == max)
+				goto out;
+			memcpy(stats[n].name, ch->name, sizeof(ch->name));
+			stats[n].n = ch->n;
+			stats[n].edge = smd_edges[i].name;
+			stats[n].intr_count = ch->intr_count;
+			stats[n].poll_count = ch->poll_count;
+			n++;
+		}
+	}
+out:
+	spin_unlock_irqrestore(&smd_lock, flags);
+
+	return n;
+}
+
 static irqreturn_t smd_modem_irq_handler(int irq, void *data)
 {
-	handle_smd_irq(&smd_ch_list_modem, notify_modem_smd);
+	smd_edge_irq(&smd_edges[SMD_EDGE_MODEM]);
 	return IRQ_HANDLED;
 }
 
 #if defined(CONFIG_QDSP6)
 static irqreturn_t smd_dsp_irq_handler(int irq, void *data)
 {
-	handle_smd_irq(&smd_ch_list_dsp, notify_dsp_smd);
+	smd_edge_irq(&smd_edges[SMD_EDGE_DSP]);
 	return IRQ_HANDLED;
 }
 #endif
@@ -588,7 +850,7 @@ static irqreturn_t smd_dsp_irq_handler(int irq, void *data)
 #if defined(CONFIG_DSPS)
 static irqreturn_t smd_dsps_irq_handler(int irq, void *data)
 {
-	handle_smd_irq(&smd_ch_list_dsps, notify_dsps_smd);
+	smd_edge_irq(&smd_edges[SMD_EDGE_DSPS]);
 	return IRQ_HANDLED;
 }
 #endif
@@ -613,6 +875,17 @@ static inline int smd_need_int(struct smd_channel *ch)
 	return 0;
 }
 
+static int smd_edge_need_int(struct smd_edge *edge)
+{
+	struct smd_channel *ch;
+
+	list_for_each_entry(ch, edge->list, ch_list) {
+		if (smd_need_int(ch))
+			return 1;
+	}
+	return 0;
+}
+
 void smd_sleep_exit(void)
 {
 	unsigned long flags;
@@ -696,40 +969,56 @@ static int smd_stream_write(smd_channel_t *ch, const void *_data, int len)
 	return orig_len - len;
 }
 
-static int smd_packet_write(smd_channel_t *ch, const void *_data, int len)
+/* describe len bytes of a fifo starting at offset start, in up to 2 pieces */
+static void ch_fifo_iov(unsigned char *fifo, unsigned size, unsigned start,
+			unsigned len, struct kvec *iov)
 {
-	int ret;
-	unsigned hdr[5];
-
-	SMD_DBG("smd_packet_write() %d -> ch%d\n", len, ch->n);
-	if (len < 0)
-		return -EINVAL;
-	else if (len == 0)
-		return 0;
+	unsigned first = min(len, size - start);
 
-	if (smd_stream_write_avail(ch) < (len + SMD_HEADER_SIZE))
-		return -ENOMEM;
+	iov[0].iov_base = fifo + start;
+	iov[0].iov_len = first;
+	iov[1].iov_base = fifo;
+	iov[1].iov_len = len - first;
+}
 
-	hdr[0] = len;
-	hdr[1] = hdr[2] = hdr[3] = hdr[4] = 0;
+/* copy len bytes between two iovecs, each must hold at least len bytes */
+static void smd_iov_copy(const struct kvec *dst, const struct kvec *src,
+			 unsigned len)
+{
+	size_t doff = 0, soff = 0, n;
 
+	while (len > 0) {
+		if (doff == dst->iov_len) {
+			dst++;
+			doff = 0;
+			continue;
+		}
+		if (soff == src->iov_len) {
+			src++;
+			soff = 0;
+			continue;
+		}
 
-	ret = smd_stream_write(ch, hdr, sizeof(hdr));
-	if (ret < 0 || ret != sizeof(hdr)) {
-		SMD_DBG("%s failed to write pkt header: "
-			"%d returned\n", __func__, ret);
-		return -1;
+		n = min_t(size_t, len, dst->iov_len - doff);
+		n = min_t(size_t, n, src->iov_len - soff);
+		memcpy(dst->iov_base + doff, src->iov_base + soff, n);
+		doff += n;
+		soff += n;
+		len -= n;
 	}
+}
 
+static int smd_packet_write(smd_channel_t *ch, const void *_data, int len)
+{
+	struct kvec src = { .iov_base = (void *) _data, .iov_len = len };
 
-	ret = smd_stream_write(ch, _data, len);
-	if (ret < 0 || ret != len) {
-		SMD_DBG("%s failed to write pkt data: "
-			"%d returned\n", __func__, ret);
-		return ret;
-	}
+	SMD_DBG("smd_packet_write() %d -> ch%d\n", len, ch->n);
+	if (len < 0)
+		return -EINVAL;
+	else if (len == 0)
+		return 0;
 
-	return len;
+	return smd_writev(ch, &src, 1);
 }
 
 static int smd_stream_read(smd_channel_t *ch, void *data, int len)
@@ -871,6 +1160,7 @@ static int smd_alloc_channel(struct smd_alloc_elm *alloc_elm)
 		ch->write_avail = smd_packet_write_avail;
 		ch->update_state = update_packet_state;
 		ch->read_from_cb = smd_packet_read_from_cb;
+		ch->is_pkt_ch = 1;
 	} else {
 		ch->read = smd_stream_read;
 		ch->write = smd_stream_write;
@@ -1092,6 +1382,226 @@ int smd_write(smd_channel_t *ch, const void *data, int len)
 }
 EXPORT_SYMBOL(smd_write);
 
+/**
+ * smd_read_peek - Look at readable data in place in the receive fifo
+ * @ch: channel to read from
+ * @iov: 2 entries, filled in with the readable data
+ *
+ * For packet channels only the rest of the current packet is returned.
+ * The data stays in the fifo until smd_read_consume() is called.
+ *
+ * Returns the number of readable bytes.
+ */
+int smd_read_peek(smd_channel_t *ch, struct kvec *iov)
+{
+	int len = ch->read_avail(ch);
+
+	if (len < 0)
+		len = 0;
+
+	ch_fifo_iov(ch->recv_data, ch->fifo_size, ch->recv->tail, len, iov);
+	return len;
+}
+EXPORT_SYMBOL(smd_read_peek);
+
+static int __smd_read_consume(smd_channel_t *ch, int len, unsigned flags,
+			      int locked)
+{
+	unsigned long irq_flags = 0;
+
+	if (len < 0 || len > ch->read_avail(ch))
+		return -EINVAL;
+
+	if (len)
+		ch_read_done(ch, len);
+
+	if (!(flags & SMD_XFER_MORE) && !read_intr_blocked(ch))
+		ch->notify_other_cpu();
+
+	if (ch->is_pkt_ch && len) {
+		if (!locked)
+			spin_lock_irqsave(&smd_lock, irq_flags);
+		ch->current_packet -= len;
+		update_packet_state(ch);
+		if (!locked)
+			spin_unlock_irqrestore(&smd_lock, irq_flags);
+	}
+
+	return len;
+}
+
+/**
+ * smd_read_consume - Release data returned by smd_read_peek()
+ * @ch: channel the data was read from
+ * @len: number of bytes to release
+ * @flags: SMD_XFER_MORE to hold back the interrupt to the other side
+ *
+ * A batch of reads can pass SMD_XFER_MORE on all but the last call,
+ * so that the remote processor is interrupted once per batch.
+ * A zero length call just sends the held back interrupt.
+ *
+ * Takes smd_lock on packet channels, so it must not be called from the
+ * channel's notify callback; use smd_read_consume_from_cb() there.
+ *
+ * Returns len, or a negative error if more than was readable is
+ * released.
+ */
+int smd_read_consume(smd_channel_t *ch, int len, unsigned flags)
+{
+	return __smd_read_consume(ch, len, flags, 0);
+}
+EXPORT_SYMBOL(smd_read_consume);
+
+/**
+ * smd_read_consume_from_cb - smd_read_consume() for the notify callback
+ * @ch: channel the data was read from
+ * @len: number of bytes to release
+ * @flags: SMD_XFER_MORE to hold back the interrupt to the other side
+ *
+ * Same as smd_read_consume(), for callers that already hold smd_lock,
+ * as the notify callback does.
+ */
+int smd_read_consume_from_cb(smd_channel_t *ch, int len, unsigned flags)
+{
+	return __smd_read_consume(ch, len, flags, 1);
+}
+EXPORT_SYMBOL(smd_read_consume_from_cb);
+
+/**
+ * smd_readv - Read into a scatter list
+ * @ch: channel to read from
+ * @iov: buffers to fill
+ * @niov: number of entries in @iov
+ *
+ * Like smd_read(), but the data is copied straight from the fifo into
+ * each buffer in turn. Like smd_read_consume(), not for use from the
+ * notify callback.
+ */
+int smd_readv(smd_channel_t *ch, const struct kvec *iov, int niov)
+{
+	struct kvec fifo[2];
+	int i, len = 0, avail;
+
+	for (i = 0; i < niov; i++)
+		len += iov[i].iov_len;
+
+	avail = smd_read_peek(ch, fifo);
+	if (len > avail)
+		len = avail;
+	if (len == 0)
+		return 0;
+
+	smd_iov_copy(iov, fifo, len);
+
+	return smd_read_consume(ch, len, 0);
+}
+EXPORT_SYMBOL(smd_readv);
+
+/**
+ * smd_write_reserve - Reserve space in the send fifo to write in place
+ * @ch: channel to write to
+ * @len: number of bytes wanted
+ * @iov: 2 entries, filled in with the reserved space
+ *
+ * Packet channels reserve all of @len or fail with -ENOMEM, with room
+ * left in front for the packet header. Stream channels may reserve
+ * less than @len. Nothing is visible to the other side until
+ * smd_write_commit(). Writers must be serialized by the caller, as for
+ * smd_write().
+ *
+ * Returns the number of bytes reserved.
+ */
+int smd_write_reserve(smd_channel_t *ch, int len, struct kvec *iov)
+{
+	unsigned hdr = ch->is_pkt_ch ? SMD_HEADER_SIZE : 0;
+	int avail;
+
+	if (len < 0)
+		return -EINVAL;
+
+	if (!ch_is_open(ch))
+		return -ENODEV;
+
+	avail = smd_stream_write_avail(ch) - hdr;
+	if (avail < len) {
+		if (ch->is_pkt_ch)
+			return -ENOMEM;
+		len = avail > 0 ? avail : 0;
+	}
+
+	ch_fifo_iov(ch->send_data, ch->fifo_size,
+		    (ch->send->head + hdr) & ch->fifo_mask, len, iov);
+	return len;
+}
+EXPORT_SYMBOL(smd_write_reserve);
+
+/**
+ * smd_write_commit - Publish data written into smd_write_reserve() space
+ * @ch: channel being written
+ * @len: number of bytes written, at most the amount reserved
+ * @flags: SMD_XFER_MORE to hold back the interrupt to the other side
+ *
+ * On packet channels this writes the header and makes the whole packet
+ * visible with a single update of the fifo head. A batch of packets
+ * can pass SMD_XFER_MORE on all but the last one, so that the remote
+ * processor is interrupted once per batch.
+ *
+ * Returns len or a negative error.
+ */
+int smd_write_commit(smd_channel_t *ch, int len, unsigned flags)
+{
+	unsigned hdr = ch->is_pkt_ch ? SMD_HEADER_SIZE : 0;
+
+	if (len < 0 || len + hdr > smd_stream_write_avail(ch))
+		return -EINVAL;
+
+	if (len && hdr) {
+		unsigned pkt_hdr[5] = { len, 0, 0, 0, 0 };
+		struct kvec src = { .iov_base = pkt_hdr, .iov_len = hdr };
+		struct kvec dst[2];
+
+		ch_fifo_iov(ch->send_data, ch->fifo_size, ch->send->head,
+			    hdr, dst);
+		smd_iov_copy(dst, &src, hdr);
+	}
+
+	if (len)
+		ch_write_done(ch, len + hdr);
+
+	if (!(flags & SMD_XFER_MORE))
+		ch->notify_other_cpu();
+
+	return len;
+}
+EXPORT_SYMBOL(smd_write_commit);
+
+/**
+ * smd_writev - Write from a gather list
+ * @ch: channel to write to
+ * @iov: buffers to send
+ * @niov: number of entries in @iov
+ *
+ * Like smd_write(), but the buffers are copied straight into the fifo
+ * and on packet channels form a single packet.
+ */
+int smd_writev(smd_channel_t *ch, const struct kvec *iov, int niov)
+{
+	struct kvec fifo[2];
+	int i, len = 0;
+
+	for (i = 0; i < niov; i++)
+		len += iov[i].iov_len;
+
+	len = smd_write_reserve(ch, len, fifo);
+	if (len <= 0)
+		return len;
+
+	smd_iov_copy(fifo, iov, len);
+
+	return smd_write_commit(ch, len, 0);
+}
+EXPORT_SYMBOL(smd_writev);
+
 int smd_read_avail(smd_channel_t *ch)
 {
 	return ch->read_avail(ch);
@@ -1513,6 +2023,8 @@ int smd_core_init(void)
 	unsigned long flags = IRQF_TRIGGER_RISING;
 	SMD_INFO("smd_core_init()\n");
 
+	smd_edges_init();
+
 	r = request_irq(INT_A9_M2A_0, smd_modem_irq_handler,
 			flags, "smd_dev", 0);
 	if (r < 0)
@@ -434,6 +434,32 @@ static int debug_read_intr_mux(char *buf, int max)
 	return i;
 }
 
+static int debug_read_intr_stats(char *buf, int max)
+{
+	static struct smd_ch_stats ch[SMD_CHANNELS];
+	struct smd_edge_stats edge[3];
+	int n, count, i = 0;
+
+	count = smd_get_edge_stats(edge, ARRAY_SIZE(edge));
+	for (n = 0; n < count; n++)
+		i += scnprintf(buf + i, max - i,
+			       "edge %-5s: %s irqs=%u polls=%u "
+			       "poll_entries=%u\n",
+			       edge[n].name,
+			       edge[n].polling ? "POLL" : "IRQ ",
+			       edge[n].irqs, edge[n].polls,
+			       edge[n].poll_entries);
+
+	count = smd_get_ch_stats(ch, ARRAY_SIZE(ch));
+	for (n = 0; n < count; n++)
+		i += scnprintf(buf + i, max - i,
+			       "ch%02d %-20s %-5s: intr=%u poll=%u\n",
+			       ch[n].n, ch[n].name, ch[n].edge,
+			       ch[n].intr_count, ch[n].poll_count);
+
+	return i;
+}
+
 #define DEBUG_BUFMAX 4096
 static char debug_buffer[DEBUG_BUFMAX];
 
@@ -480,6 +506,7 @@ static int __init smd_debugfs_init(void)
 	debug_create("modem_err_f3", 0444, dent, debug_modem_err_f3);
 	debug_create("print_diag", 0444, dent, debug_diag);
 	debug_create("print_f3", 0444, dent, debug_f3);
+	debug_create("intr_stats", 0444, dent, debug_read_intr_stats);
 
 	/* NNV: this is google only stuff */
 	debug_create("build", 0444, dent, debug_read_build_id);
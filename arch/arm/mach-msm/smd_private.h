@@ -163,6 +163,26 @@ void smsm_reset_modem(unsigned mode);
 void smsm_reset_modem_cont(void);
 void smd_sleep_exit(void);
 
+/* interrupt coalescing statistics, for smd_debug */
+struct smd_edge_stats {
+	const char *name;
+	int polling;
+	unsigned irqs;
+	unsigned polls;
+	unsigned poll_entries;
+};
+
+struct smd_ch_stats {
+	char name[20];
+	unsigned n;
+	const char *edge;
+	unsigned intr_count;
+	unsigned poll_count;
+};
+
+int smd_get_edge_stats(struct smd_edge_stats *stats, int max);
+int smd_get_ch_stats(struct smd_ch_stats *stats, int max);
+
 #define SMEM_NUM_SMD_STREAM_CHANNELS        64
 #define SMEM_NUM_SMD_BLOCK_CHANNELS         64
 
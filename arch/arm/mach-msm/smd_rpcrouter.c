@@ -40,6 +40,8 @@
 #include <linux/platform_device.h>
 #include <linux/uaccess.h>
 #include <linux/debugfs.h>
+#include <linux/log2.h>
+#include <linux/hash.h>
 
 #include <asm/byteorder.h>
 
@@ -143,15 +145,53 @@ static DEFINE_SPINLOCK(local_endpoints_lock);
 static DEFINE_SPINLOCK(remote_endpoints_lock);
 static DEFINE_SPINLOCK(server_list_lock);
 
+/*
+ * The lists above are kept for walking every entry; per-packet and
+ * per-call lookups go through these hash tables instead, under the
+ * same locks.  Servers hash on prog alone so that the compatible
+ * version lookup in msm_rpc_get_server stays a single bucket walk.
+ */
+#define RR_HASH_BITS	6
+#define RR_HASH_SIZE	(1 << RR_HASH_BITS)
+
+static struct hlist_head local_endpoints_hash[RR_HASH_SIZE];
+static struct hlist_head remote_endpoints_hash[RR_HASH_SIZE];
+static struct hlist_head server_hash[RR_HASH_SIZE];
+
+#define RR_LOCAL_EPT_HASH(cid)		(&local_endpoints_hash[ \
+						hash_32(cid, RR_HASH_BITS)])
+#define RR_REMOTE_EPT_HASH(pid, cid)	(&remote_endpoints_hash[ \
+						hash_32((pid) ^ (cid), \
+							RR_HASH_BITS)])
+#define RR_SERVER_HASH(prog)		(&server_hash[ \
+						hash_32(prog, RR_HASH_BITS)])
+
+/* protected by the lock of the table they count */
+struct rr_lookup_stats {
+	unsigned long lookups;
+	unsigned long misses;
+	unsigned long probes; /* entries compared */
+};
+
+static struct rr_lookup_stats local_ept_lookup_stats;
+static struct rr_lookup_stats remote_ept_lookup_stats;
+static struct rr_lookup_stats server_lookup_stats;
+
 static LIST_HEAD(rpc_board_dev_list);
 static DEFINE_SPINLOCK(rpc_board_dev_list_lock);
 
 static struct workqueue_struct *rpcrouter_workqueue;
+static struct workqueue_struct *rpcrouter_rx_workqueue;
 
 static atomic_t next_xid = ATOMIC_INIT(1);
 static atomic_t pm_mid = ATOMIC_INIT(1);
 
 static void do_read_data(struct work_struct *work);
+static void do_ept_rx_work(struct work_struct *work);
+static int rr_async_reply(struct msm_rpc_endpoint *ept,
+			  struct rr_packet *pkt);
+static void rr_async_abort(struct msm_rpc_endpoint *ept, int rc);
+static void rr_async_complete(struct msm_rpc_endpoint *ept);
 static void do_create_pdevs(struct work_struct *work);
 static void do_create_rpcrouter_pdev(struct work_struct *work);
 
@@ -210,6 +250,9 @@ struct rpcrouter_xprt_info {
 	uint32_t need_len;
 	struct work_struct read_data;
 	struct workqueue_struct *workqueue;
+
+	/* control messages and payloads for unknown endpoints */
+	uint32_t r2r_buf[RPCROUTER_MSGSIZE_MAX / sizeof(uint32_t)];
 };
 
 static LIST_HEAD(xprt_info_list);
@@ -274,12 +317,17 @@ static int rpcrouter_send_control_msg(struct rpcrouter_xprt_info *xprt_info,
 	return 0;
 }
 
+static void rr_free_packet(struct rr_packet *pkt)
+{
+	kfree(pkt->data);
+	kfree(pkt);
+}
+
 static void modem_reset_start_cleanup(void)
 {
 	struct msm_rpc_endpoint *ept;
 	struct rr_remote_endpoint *r_ept;
 	struct rr_packet *pkt, *tmp_pkt;
-	struct rr_fragment *frag, *next;
 	struct msm_rpc_reply *reply, *reply_tmp;
 	unsigned long flags;
 
@@ -306,13 +354,7 @@ static void modem_reset_start_cleanup(void)
 			list_for_each_entry_safe(pkt, tmp_pkt,
 						 &ept->incomplete, list) {
 				list_del(&pkt->list);
-				frag = pkt->first;
-				while (frag != NULL) {
-					next = frag->next;
-					kfree(frag);
-					frag = next;
-				}
-			kfree(pkt);
+				rr_free_packet(pkt);
 			}
 			spin_unlock(&ept->incomplete_lock);
 			/* remove all completed packets waiting to be read*/
@@ -320,15 +362,12 @@ static void modem_reset_start_cleanup(void)
 			list_for_each_entry_safe(pkt, tmp_pkt, &ept->read_q,
 						 list) {
 				list_del(&pkt->list);
-				frag = pkt->first;
-				while (frag != NULL) {
-					next = frag->next;
-					kfree(frag);
-					frag = next;
-				}
-				kfree(pkt);
+				rr_free_packet(pkt);
 			}
 			spin_unlock(&ept->read_q_lock);
+			/* fail outstanding asynchronous calls */
+			rr_async_abort(ept, -ENETRESET);
+			queue_work(rpcrouter_rx_workqueue, &ept->rx_work);
 			/* Set restart state for local ep */
 			RR("EPT:0x%p, State %d  RESTART_PEND_NTFY_SVR "
 			   "PROG:0x%08x VERS:0x%08x \n",
@@ -379,6 +418,7 @@ static struct rr_server *rpcrouter_create_server(uint32_t pid,
 
 	spin_lock_irqsave(&server_list_lock, flags);
 	list_add_tail(&server->list, &server_list);
+	hlist_add_head(&server->hash, RR_SERVER_HASH(prog));
 	spin_unlock_irqrestore(&server_list_lock, flags);
 
 	rc = msm_rpcrouter_create_server_cdev(server);
@@ -389,6 +429,7 @@ static struct rr_server *rpcrouter_create_server(uint32_t pid,
 out_fail:
 	spin_lock_irqsave(&server_list_lock, flags);
 	list_del(&server->list);
+	hlist_del(&server->hash);
 	spin_unlock_irqrestore(&server_list_lock, flags);
 	kfree(server);
 	return ERR_PTR(rc);
@@ -400,6 +441,7 @@ static void rpcrouter_destroy_server(struct rr_server *server)
 
 	spin_lock_irqsave(&server_list_lock, flags);
 	list_del(&server->list);
+	hlist_del(&server->hash);
 	spin_unlock_irqrestore(&server_list_lock, flags);
 	device_destroy(msm_rpcrouter_class, server->device_number);
 	kfree(server);
@@ -454,16 +496,20 @@ static void rpcrouter_register_board_dev(struct rr_server *server)
 static struct rr_server *rpcrouter_lookup_server(uint32_t prog, uint32_t ver)
 {
 	struct rr_server *server;
+	struct hlist_node *n;
 	unsigned long flags;
 
 	spin_lock_irqsave(&server_list_lock, flags);
-	list_for_each_entry(server, &server_list, list) {
+	server_lookup_stats.lookups++;
+	hlist_for_each_entry(server, n, RR_SERVER_HASH(prog), hash) {
+		server_lookup_stats.probes++;
 		if (server->prog == prog
 		 && server->vers == ver) {
 			spin_unlock_irqrestore(&server_list_lock, flags);
 			return server;
 		}
 	}
+	server_lookup_stats.misses++;
 	spin_unlock_irqrestore(&server_list_lock, flags);
 	return NULL;
 }
@@ -530,18 +576,39 @@ struct msm_rpc_endpoint *msm_rpcrouter_create_local_endpoint(dev_t dev)
 	wake_lock_init(&ept->reply_q_wake_lock, WAKE_LOCK_SUSPEND, "rpc_reply");
 	INIT_LIST_HEAD(&ept->incomplete);
 	spin_lock_init(&ept->incomplete_lock);
+	INIT_WORK(&ept->rx_work, do_ept_rx_work);
+	atomic_set(&ept->rx_confirm, 0);
+	mutex_init(&ept->rx_work_lock);
+	init_waitqueue_head(&ept->rx_users_wait);
+	INIT_LIST_HEAD(&ept->async_pend_q);
+	INIT_LIST_HEAD(&ept->async_done_q);
+	spin_lock_init(&ept->async_lock);
+	wake_lock_init(&ept->async_wake_lock, WAKE_LOCK_SUSPEND, "rpc_async");
 
 	spin_lock_irqsave(&local_endpoints_lock, flags);
 	list_add_tail(&ept->list, &local_endpoints);
+	hlist_add_head(&ept->hash, RR_LOCAL_EPT_HASH(ept->cid));
 	spin_unlock_irqrestore(&local_endpoints_lock, flags);
 	return ept;
 }
 
+static int rpcrouter_local_endpoint_idle(struct msm_rpc_endpoint *ept)
+{
+	unsigned long flags;
+	int idle;
+
+	spin_lock_irqsave(&local_endpoints_lock, flags);
+	idle = !ept->rx_users;
+	spin_unlock_irqrestore(&local_endpoints_lock, flags);
+	return idle;
+}
+
 int msm_rpcrouter_destroy_local_endpoint(struct msm_rpc_endpoint *ept)
 {
 	int rc;
 	union rr_control_msg msg;
 	struct msm_rpc_reply *reply, *reply_tmp;
+	struct rr_packet *pkt, *tmp_pkt;
 	unsigned long flags;
 	struct rpcrouter_xprt_info *xprt_info;
 
@@ -565,6 +632,18 @@ int msm_rpcrouter_destroy_local_endpoint(struct msm_rpc_endpoint *ept)
 		mutex_unlock(&xprt_info_list_lock);
 	}
 
+	/* Once unlinked no new reader can find the endpoint; wait out
+	 * the ones that already hold it, since they may still queue
+	 * packets and rx_work.  The last reader drops rx_users and wakes
+	 * us under local_endpoints_lock, so seeing zero under that lock
+	 * means it is done with ept.
+	 */
+	spin_lock_irqsave(&local_endpoints_lock, flags);
+	list_del(&ept->list);
+	hlist_del(&ept->hash);
+	spin_unlock_irqrestore(&local_endpoints_lock, flags);
+	wait_event(ept->rx_users_wait, rpcrouter_local_endpoint_idle(ept));
+
 	/* Free replies */
 	spin_lock_irqsave(&ept->reply_q_lock, flags);
 	list_for_each_entry_safe(reply, reply_tmp, &ept->reply_pend_q, list) {
@@ -577,11 +656,23 @@ int msm_rpcrouter_destroy_local_endpoint(struct msm_rpc_endpoint *ept)
 	}
 	spin_unlock_irqrestore(&ept->reply_q_lock, flags);
 
+	rr_async_abort(ept, -ECANCELED);
+	cancel_work_sync(&ept->rx_work);
+	rr_async_complete(ept);
+
+	/* Free packets nobody will read */
+	list_for_each_entry_safe(pkt, tmp_pkt, &ept->incomplete, list) {
+		list_del(&pkt->list);
+		rr_free_packet(pkt);
+	}
+	list_for_each_entry_safe(pkt, tmp_pkt, &ept->read_q, list) {
+		list_del(&pkt->list);
+		rr_free_packet(pkt);
+	}
+
 	wake_lock_destroy(&ept->read_q_wake_lock);
 	wake_lock_destroy(&ept->reply_q_wake_lock);
-	spin_lock_irqsave(&local_endpoints_lock, flags);
-	list_del(&ept->list);
-	spin_unlock_irqrestore(&local_endpoints_lock, flags);
+	wake_lock_destroy(&ept->async_wake_lock);
 	kfree(ept);
 	return 0;
 }
@@ -603,40 +694,65 @@ static int rpcrouter_create_remote_endpoint(uint32_t pid, uint32_t cid)
 
 	spin_lock_irqsave(&remote_endpoints_lock, flags);
 	list_add_tail(&new_c->list, &remote_endpoints);
+	hlist_add_head(&new_c->hash, RR_REMOTE_EPT_HASH(pid, cid));
 	new_c->quota_restart_state = RESTART_NORMAL;
 	spin_unlock_irqrestore(&remote_endpoints_lock, flags);
 	return 0;
 }
 
+/*
+ * Look up a local endpoint for the transport reader.  The endpoint is
+ * returned with rx_users raised, so it is not freed while the reader
+ * sleeps in rr_read(); drop it with rpcrouter_put_local_endpoint().
+ */
 static struct msm_rpc_endpoint *rpcrouter_lookup_local_endpoint(uint32_t cid)
 {
 	struct msm_rpc_endpoint *ept;
+	struct hlist_node *n;
 	unsigned long flags;
 
 	spin_lock_irqsave(&local_endpoints_lock, flags);
-	list_for_each_entry(ept, &local_endpoints, list) {
+	local_ept_lookup_stats.lookups++;
+	hlist_for_each_entry(ept, n, RR_LOCAL_EPT_HASH(cid), hash) {
+		local_ept_lookup_stats.probes++;
 		if (ept->cid == cid) {
+			ept->rx_users++;
 			spin_unlock_irqrestore(&local_endpoints_lock, flags);
 			return ept;
 		}
 	}
+	local_ept_lookup_stats.misses++;
 	spin_unlock_irqrestore(&local_endpoints_lock, flags);
 	return NULL;
 }
 
+static void rpcrouter_put_local_endpoint(struct msm_rpc_endpoint *ept)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&local_endpoints_lock, flags);
+	if (--ept->rx_users == 0)
+		wake_up(&ept->rx_users_wait);
+	spin_unlock_irqrestore(&local_endpoints_lock, flags);
+}
+
 static struct rr_remote_endpoint *rpcrouter_lookup_remote_endpoint(uint32_t pid,
 								   uint32_t cid)
 {
 	struct rr_remote_endpoint *ept;
+	struct hlist_node *n;
 	unsigned long flags;
 
 	spin_lock_irqsave(&remote_endpoints_lock, flags);
-	list_for_each_entry(ept, &remote_endpoints, list) {
+	remote_ept_lookup_stats.lookups++;
+	hlist_for_each_entry(ept, n, RR_REMOTE_EPT_HASH(pid, cid), hash) {
+		remote_ept_lookup_stats.probes++;
 		if ((ept->pid == pid) && (ept->cid == cid)) {
 			spin_unlock_irqrestore(&remote_endpoints_lock, flags);
 			return ept;
 		}
 	}
+	remote_ept_lookup_stats.misses++;
 	spin_unlock_irqrestore(&remote_endpoints_lock, flags);
 	return NULL;
 }
@@ -818,6 +934,7 @@ static int process_control_msg(struct rpcrouter_xprt_info *xprt_info,
 		if (r_ept) {
 			spin_lock_irqsave(&remote_endpoints_lock, flags);
 			list_del(&r_ept->list);
+			hlist_del(&r_ept->hash);
 			spin_unlock_irqrestore(&remote_endpoints_lock, flags);
 			kfree(r_ept);
 		}
@@ -933,14 +1050,119 @@ static char *type_to_str(int i)
 }
 #endif
 
-static uint32_t r2r_buf[RPCROUTER_MSGSIZE_MAX];
+static void rpcrouter_send_resume_tx(struct rpcrouter_xprt_info *xprt_info,
+				     uint32_t pid, uint32_t cid,
+				     uint32_t src_cid)
+{
+	union rr_control_msg msg;
+
+	msg.cmd = RPCROUTER_CTRL_CMD_RESUME_TX;
+	msg.cli.pid = pid;
+	msg.cli.cid = cid;
+
+	RR("x RESUME_TX id=%d:%08x\n", msg.cli.pid, msg.cli.cid);
+	rpcrouter_send_control_msg(xprt_info, &msg);
+
+#if defined(CONFIG_MSM_ONCRPCROUTER_DEBUG)
+	if (smd_rpcrouter_debug_mask & SMEM_LOG)
+		smem_log_event(SMEM_LOG_PROC_ID_APPS |
+			       RPC_ROUTER_LOG_EVENT_MSG_CFM_SNT,
+			       RPCROUTER_PID_LOCAL,
+			       cid,
+			       src_cid);
+#endif
+}
+
+/*
+ * Per-endpoint receive work.  Sending RESUME_TX can sleep waiting for
+ * room in the transport, so it is done here rather than in the
+ * transport reader; a client whose confirmations back up then only
+ * holds up itself and not every other endpoint on the transport.
+ * Completion callbacks for asynchronous calls run here too.
+ *
+ * rpcrouter_rx has a thread per CPU and a work item requeued on another
+ * CPU can start there before the first run returns, so rx_work_lock
+ * keeps each endpoint's callbacks in order while different endpoints
+ * still run in parallel.
+ */
+static void do_ept_rx_work(struct work_struct *work)
+{
+	struct msm_rpc_endpoint *ept =
+		container_of(work, struct msm_rpc_endpoint, rx_work);
+
+	mutex_lock(&ept->rx_work_lock);
+
+	/* the remote sends at most one confirm_rx before waiting for
+	 * RESUME_TX, so any number of pending confirms collapse to one
+	 */
+	if (atomic_xchg(&ept->rx_confirm, 0))
+		rpcrouter_send_resume_tx(ept->rx_xprt, ept->pid, ept->cid,
+					 ept->rx_confirm_cid);
+
+	rr_async_complete(ept);
+
+	mutex_unlock(&ept->rx_work_lock);
+}
+
+/*
+ * Find the partial packet for mid and take it off the incomplete
+ * list while the next fragment is read into it.
+ */
+static struct rr_packet *rr_get_incomplete(struct msm_rpc_endpoint *ept,
+					   uint32_t mid)
+{
+	struct rr_packet *pkt;
+	unsigned long flags;
+
+	spin_lock_irqsave(&ept->incomplete_lock, flags);
+	list_for_each_entry(pkt, &ept->incomplete, list) {
+		if (pkt->mid == mid) {
+			list_del(&pkt->list);
+			spin_unlock_irqrestore(&ept->incomplete_lock, flags);
+			return pkt;
+		}
+	}
+	spin_unlock_irqrestore(&ept->incomplete_lock, flags);
+	return NULL;
+}
+
+/*
+ * Make room for len more bytes in pkt.  A packet that fits in one
+ * fragment is allocated to size; a multi-fragment packet starts out
+ * with a page and doubles from there, so most messages are assembled
+ * without ever being reallocated.
+ */
+static void rr_packet_reserve(struct rr_packet *pkt, uint32_t len, int last)
+{
+	uint32_t need = pkt->length + len;
+	void *data;
+
+	if (need <= pkt->size)
+		return;
+
+	if (!pkt->data && last)
+		pkt->size = need;
+	else
+		pkt->size = max_t(uint32_t, PAGE_SIZE,
+				  roundup_pow_of_two(need));
+
+	data = krealloc(pkt->data, pkt->size, GFP_KERNEL);
+	if (!data) {
+		printk(KERN_ERR "rpcrouter: krealloc of %d failed, "
+		       "retrying...\n", pkt->size);
+		do {
+			data = krealloc(pkt->data, pkt->size, GFP_KERNEL);
+		} while (!data);
+	}
+	pkt->data = data;
+}
 
 static void do_read_data(struct work_struct *work)
 {
 	struct rr_header hdr;
 	struct rr_packet *pkt;
-	struct rr_fragment *frag;
 	struct msm_rpc_endpoint *ept;
+	void *data;
 #if defined(CONFIG_MSM_ONCRPCROUTER_DEBUG)
 	struct rpc_request_hdr *rq;
 #endif
@@ -977,9 +1199,10 @@ static void do_read_data(struct work_struct *work)
 		if (xprt_info->remote_pid == -1)
 			xprt_info->remote_pid = hdr.src_pid;
 
-		if (rr_read(xprt_info, r2r_buf, hdr.size))
+		if (rr_read(xprt_info, xprt_info->r2r_buf, hdr.size))
 			goto fail_io;
-		process_control_msg(xprt_info, (void *) r2r_buf, hdr.size);
+		process_control_msg(xprt_info, (void *) xprt_info->r2r_buf,
+				    hdr.size);
 		goto done;
 	}
 
@@ -992,18 +1215,45 @@ static void do_read_data(struct work_struct *work)
 
 	hdr.size -= sizeof(pm);
 
-	frag = rr_malloc(hdr.size + sizeof(*frag));
-	frag->next = NULL;
-	frag->length = hdr.size;
-	if (rr_read(xprt_info, frag->data, hdr.size))
+	ept = rpcrouter_lookup_local_endpoint(hdr.dst_cid);
+	if (!ept) {
+		DIAG("no local ept for cid %08x\n", hdr.dst_cid);
+		/* drop the payload to keep the stream in sync */
+		if (rr_read(xprt_info, xprt_info->r2r_buf, hdr.size))
+			goto fail_io;
+		goto done;
+	}
+
+	/* See if there is already a partial packet that matches our mid
+	 * and if so, read this fragment in after it; otherwise start a
+	 * new packet.  Either way the payload goes straight from the
+	 * transport into the packet buffer.
+	 */
+	mid = PACMARK_MID(pm);
+	pkt = rr_get_incomplete(ept, mid);
+	if (!pkt) {
+		pkt = rr_malloc(sizeof(struct rr_packet));
+		memcpy(&pkt->hdr, &hdr, sizeof(hdr));
+		pkt->mid = mid;
+		pkt->length = 0;
+		pkt->size = 0;
+		pkt->data = NULL;
+	}
+	rr_packet_reserve(pkt, hdr.size, PACMARK_LAST(pm));
+	data = pkt->data + pkt->length;
+	if (rr_read(xprt_info, data, hdr.size)) {
+		rr_free_packet(pkt);
+		rpcrouter_put_local_endpoint(ept);
 		goto fail_io;
+	}
+	pkt->length += hdr.size;
 
 #if defined(CONFIG_MSM_ONCRPCROUTER_DEBUG)
 	if ((smd_rpcrouter_debug_mask & RAW_PMR) &&
 	    ((pm >> 30 & 0x1) || (pm >> 31 & 0x1))) {
 		uint32_t xid = 0;
 		if (pm >> 30 & 0x1) {
-			rq = (struct rpc_request_hdr *) frag->data;
+			rq = (struct rpc_request_hdr *) data;
 			xid = ntohl(rq->xid);
 		}
 		if ((pm >> 31 & 0x1) || (pm >> 30 & 0x1))
@@ -1017,7 +1267,7 @@ static void do_read_data(struct work_struct *work)
 	}
 
 	if (smd_rpcrouter_debug_mask & SMEM_LOG) {
-		rq = (struct rpc_request_hdr *) frag->data;
+		rq = (struct rpc_request_hdr *) data;
 		if (rq->xid == 0)
 			smem_log_event(SMEM_LOG_PROC_ID_APPS |
 				       RPC_ROUTER_LOG_EVENT_MID_READ,
@@ -1033,78 +1283,39 @@ static void do_read_data(struct work_struct *work)
 	}
 #endif
 
-	ept = rpcrouter_lookup_local_endpoint(hdr.dst_cid);
-	if (!ept) {
-		DIAG("no local ept for cid %08x\n", hdr.dst_cid);
-		kfree(frag);
-		goto done;
-	}
-
-	/* See if there is already a partial packet that matches our mid
-	 * and if so, append this fragment to that packet.
-	 */
-	mid = PACMARK_MID(pm);
-	spin_lock_irqsave(&ept->incomplete_lock, flags);
-	list_for_each_entry(pkt, &ept->incomplete, list) {
-		if (pkt->mid == mid) {
-			pkt->last->next = frag;
-			pkt->last = frag;
-			pkt->length += frag->length;
-			if (PACMARK_LAST(pm)) {
-				list_del(&pkt->list);
-				spin_unlock_irqrestore(&ept->incomplete_lock,
-						       flags);
-				goto packet_complete;
-			}
-			spin_unlock_irqrestore(&ept->incomplete_lock, flags);
-			goto done;
-		}
-	}
-	spin_unlock_irqrestore(&ept->incomplete_lock, flags);
-	/* This mid is new -- create a packet for it, and put it on
-	 * the incomplete list if this fragment is not a last fragment,
-	 * otherwise put it on the read queue.
-	 */
-	pkt = rr_malloc(sizeof(struct rr_packet));
-	pkt->first = frag;
-	pkt->last = frag;
-	memcpy(&pkt->hdr, &hdr, sizeof(hdr));
-	pkt->mid = mid;
-	pkt->length = frag->length;
 	if (!PACMARK_LAST(pm)) {
+		spin_lock_irqsave(&ept->incomplete_lock, flags);
 		list_add_tail(&pkt->list, &ept->incomplete);
-		goto done;
+		spin_unlock_irqrestore(&ept->incomplete_lock, flags);
+		goto confirm;
 	}
 
-packet_complete:
+	/* replies to asynchronous calls go to their callbacks */
+	if (rr_async_reply(ept, pkt))
+		goto confirm;
+
 	spin_lock_irqsave(&ept->read_q_lock, flags);
 	D("%s: take read lock on ept %p\n", __func__, ept);
 	wake_lock(&ept->read_q_wake_lock);
 	list_add_tail(&pkt->list, &ept->read_q);
 	wake_up(&ept->wait_q);
 	spin_unlock_irqrestore(&ept->read_q_lock, flags);
-done:
 
+confirm:
 	if (hdr.confirm_rx) {
-		union rr_control_msg msg;
-
-		msg.cmd = RPCROUTER_CTRL_CMD_RESUME_TX;
-		msg.cli.pid = hdr.dst_pid;
-		msg.cli.cid = hdr.dst_cid;
-
-		RR("x RESUME_TX id=%d:%08x\n", msg.cli.pid, msg.cli.cid);
-		rpcrouter_send_control_msg(xprt_info, &msg);
-
-#if defined(CONFIG_MSM_ONCRPCROUTER_DEBUG)
-		if (smd_rpcrouter_debug_mask & SMEM_LOG)
-			smem_log_event(SMEM_LOG_PROC_ID_APPS |
-				       RPC_ROUTER_LOG_EVENT_MSG_CFM_SNT,
-				       RPCROUTER_PID_LOCAL,
-				       hdr.dst_cid,
-				       hdr.src_cid);
-#endif
-
+		ept->rx_xprt = xprt_info;
+		ept->rx_confirm_cid = hdr.src_cid;
+		atomic_set(&ept->rx_confirm, 1);
+		queue_work(rpcrouter_rx_workqueue, &ept->rx_work);
 	}
+	rpcrouter_put_local_endpoint(ept);
+	queue_work(xprt_info->workqueue, &xprt_info->read_data);
+	return;
+
+done:
+	if (hdr.confirm_rx)
+		rpcrouter_send_resume_tx(xprt_info, hdr.dst_pid, hdr.dst_cid,
+					 hdr.src_cid);
 
 	queue_work(xprt_info->workqueue, &xprt_info->read_data);
 	return;
@@ -1151,25 +1362,22 @@ int msm_rpc_close(struct msm_rpc_endpoint *ept)
 }
 EXPORT_SYMBOL(msm_rpc_close);
 
-static int msm_rpc_write_pkt(
-	struct rr_header *hdr,
-	struct msm_rpc_endpoint *ept,
-	struct rr_remote_endpoint *r_ept,
-	void *buffer,
-	int count,
-	int first,
-	int last,
-	uint32_t mid
-	)
+/*
+ * Fill in the routing header for a packet of count bytes and wait
+ * until it may be sent: the endpoint is not restarting and the remote
+ * endpoint has quota left.  Sets hdr->confirm_rx when the packet uses
+ * up the quota.
+ */
+static int rr_write_prepare(struct rr_header *hdr,
+			    struct msm_rpc_endpoint *ept,
+			    struct rr_remote_endpoint *r_ept,
+			    void *buffer, int count)
 {
 #if defined(CONFIG_MSM_ONCRPCROUTER_DEBUG)
 	struct rpc_request_hdr *rq = buffer;
 	uint32_t event_id;
 #endif
-	uint32_t pacmark;
 	unsigned long flags;
-	struct rpcrouter_xprt_info *xprt_info;
-	int needed;
 
 	DEFINE_WAIT(__wait);
 
@@ -1253,37 +1461,73 @@ static int msm_rpc_write_pkt(
 
 		}
 	}
-	pacmark = PACMARK(count, mid, first, last);
 
 	if (r_ept)
 		spin_unlock_irqrestore(&r_ept->quota_lock, flags);
 
-	xprt_info = rpcrouter_get_xprt_info(hdr->dst_pid);
+	return 0;
+}
 
-	spin_lock_irqsave(&xprt_info->lock, flags);
+/*
+ * Take the transport lock and the endpoint's restart lock once there
+ * is room for needed bytes.  Returns with both held, or -ENETRESET
+ * with neither held if the endpoint is restarting.
+ */
+static int rr_xprt_lock_space(struct rpcrouter_xprt_info *xprt_info,
+			      struct msm_rpc_endpoint *ept, int needed,
+			      unsigned long *flags)
+{
+	spin_lock_irqsave(&xprt_info->lock, *flags);
 	spin_lock(&ept->restart_lock);
-	if (ept->restart_state != RESTART_NORMAL) {
-		ept->restart_state &= ~RESTART_PEND_NTFY;
-		spin_unlock(&ept->restart_lock);
-		spin_unlock_irqrestore(&xprt_info->lock, flags);
-		return -ENETRESET;
-	}
-
-	needed = sizeof(*hdr) + hdr->size;
 	while ((ept->restart_state == RESTART_NORMAL) &&
 	       (xprt_info->xprt->write_avail() < needed)) {
 		spin_unlock(&ept->restart_lock);
-		spin_unlock_irqrestore(&xprt_info->lock, flags);
+		spin_unlock_irqrestore(&xprt_info->lock, *flags);
 		msleep(250);
-		spin_lock_irqsave(&xprt_info->lock, flags);
+		spin_lock_irqsave(&xprt_info->lock, *flags);
 		spin_lock(&ept->restart_lock);
 	}
 	if (ept->restart_state != RESTART_NORMAL) {
 		ept->restart_state &= ~RESTART_PEND_NTFY;
 		spin_unlock(&ept->restart_lock);
-		spin_unlock_irqrestore(&xprt_info->lock, flags);
+		spin_unlock_irqrestore(&xprt_info->lock, *flags);
 		return -ENETRESET;
 	}
+	return 0;
+}
+
+static int msm_rpc_write_pkt(
+	struct rr_header *hdr,
+	struct msm_rpc_endpoint *ept,
+	struct rr_remote_endpoint *r_ept,
+	void *buffer,
+	int count,
+	int first,
+	int last,
+	uint32_t mid
+	)
+{
+#if defined(CONFIG_MSM_ONCRPCROUTER_DEBUG)
+	struct rpc_request_hdr *rq = buffer;
+#endif
+	uint32_t pacmark;
+	unsigned long flags;
+	struct rpcrouter_xprt_info *xprt_info;
+	int needed;
+	int rc;
+
+	rc = rr_write_prepare(hdr, ept, r_ept, buffer, count);
+	if (rc < 0)
+		return rc;
+
+	pacmark = PACMARK(count, mid, first, last);
+
+	xprt_info = rpcrouter_get_xprt_info(hdr->dst_pid);
+
+	needed = sizeof(*hdr) + hdr->size;
+	rc = rr_xprt_lock_space(xprt_info, ept, needed, &flags);
+	if (rc < 0)
+		return rc;
 
 	/* TODO: deal with full fifo */
 	xprt_info->xprt->write(hdr, sizeof(*hdr), HEADER);
@@ -1565,37 +1809,10 @@ EXPORT_SYMBOL(msm_rpc_write);
 int msm_rpc_read(struct msm_rpc_endpoint *ept, void **buffer,
 		 unsigned user_len, long timeout)
 {
-	struct rr_fragment *frag, *next;
-	char *buf;
-	int rc;
-
-	rc = __msm_rpc_read(ept, &frag, user_len, timeout);
-	if (rc <= 0)
-		return rc;
-
-	/* single-fragment messages conveniently can be
-	 * returned as-is (the buffer is at the front)
-	 */
-	if (frag->next == 0) {
-		*buffer = (void*) frag;
-		return rc;
-	}
-
-	/* multi-fragment messages, we have to do it the
-	 * hard way, which is rather disgusting right now
+	/* packets are assembled contiguously on receive, so the
+	 * buffer can be handed over as-is
 	 */
-	buf = rr_malloc(rc);
-	*buffer = buf;
-
-	while (frag != NULL) {
-		memcpy(buf, frag->data, frag->length);
-		next = frag->next;
-		buf += frag->length;
-		kfree(frag);
-		frag = next;
-	}
-
-	return rc;
+	return __msm_rpc_read(ept, buffer, user_len, timeout);
 }
 EXPORT_SYMBOL(msm_rpc_read);
 
@@ -1680,6 +1897,350 @@ int msm_rpc_call_reply(struct msm_rpc_endpoint *ept, uint32_t proc,
 }
 EXPORT_SYMBOL(msm_rpc_call_reply);
 
+/*
+ * Asynchronous calls.  The pending call is registered before the
+ * request goes out, so the reply can never beat it; do_read_data
+ * matches replies against async_pend_q by xid and hands them to the
+ * endpoint's rx_work, which runs the callbacks.
+ */
+struct rr_async_call {
+	struct list_head list;
+	uint32_t xid; /* be32 */
+	msm_rpc_async_cb cb;
+	void *data;
+	struct rr_packet *pkt; /* the reply, once it has arrived */
+	int rc;
+	int done;
+};
+
+/* called with ept->async_lock held */
+static void rr_async_done(struct msm_rpc_endpoint *ept,
+			  struct rr_async_call *call,
+			  struct rr_packet *pkt, int rc)
+{
+	call->pkt = pkt;
+	call->rc = rc;
+	call->done = 1;
+	list_move_tail(&call->list, &ept->async_done_q);
+	wake_lock(&ept->async_wake_lock);
+}
+
+/* Claim pkt if it is the reply to one of our asynchronous calls. */
+static int rr_async_reply(struct msm_rpc_endpoint *ept,
+			  struct rr_packet *pkt)
+{
+	struct rpc_reply_hdr *reply = pkt->data;
+	struct rr_async_call *call;
+	unsigned long flags;
+
+	if (pkt->length < (3 * sizeof(uint32_t)) || reply->type == 0)
+		return 0;
+
+	spin_lock_irqsave(&ept->async_lock, flags);
+	list_for_each_entry(call, &ept->async_pend_q, list) {
+		if (call->xid == reply->xid) {
+			rr_async_done(ept, call, pkt, 0);
+			spin_unlock_irqrestore(&ept->async_lock, flags);
+			queue_work(rpcrouter_rx_workqueue, &ept->rx_work);
+			return 1;
+		}
+	}
+	spin_unlock_irqrestore(&ept->async_lock, flags);
+	return 0;
+}
+
+/* Fail every outstanding call; the callbacks run from rx_work. */
+static void rr_async_abort(struct msm_rpc_endpoint *ept, int rc)
+{
+	struct rr_async_call *call, *tmp;
+	unsigned long flags;
+
+	spin_lock_irqsave(&ept->async_lock, flags);
+	list_for_each_entry_safe(call, tmp, &ept->async_pend_q, list)
+		rr_async_done(ept, call, NULL, rc);
+	spin_unlock_irqrestore(&ept->async_lock, flags);
+}
+
+static void rr_async_complete(struct msm_rpc_endpoint *ept)
+{
+	struct rr_async_call *call;
+	struct rpc_reply_hdr *reply;
+	unsigned long flags;
+	int rc;
+
+	spin_lock_irqsave(&ept->async_lock, flags);
+	while (!list_empty(&ept->async_done_q)) {
+		call = list_first_entry(&ept->async_done_q,
+					struct rr_async_call, list);
+		list_del(&call->list);
+		spin_unlock_irqrestore(&ept->async_lock, flags);
+
+		rc = call->rc;
+		reply = NULL;
+		if (call->pkt) {
+			reply = call->pkt->data;
+			if (reply->reply_stat != 0)
+				rc = -EPERM;
+			else if (reply->data.acc_hdr.accept_stat != 0)
+				rc = -EINVAL;
+			else
+				rc = call->pkt->length;
+		}
+		call->cb(ept, rc < 0 ? NULL : reply, rc, call->data);
+
+		if (call->pkt)
+			rr_free_packet(call->pkt);
+		kfree(call);
+		spin_lock_irqsave(&ept->async_lock, flags);
+	}
+	wake_unlock(&ept->async_wake_lock);
+	spin_unlock_irqrestore(&ept->async_lock, flags);
+}
+
+static struct rr_async_call *rr_async_prepare(struct msm_rpc_endpoint *ept,
+					      uint32_t proc,
+					      struct rpc_request_hdr *req,
+					      int request_size,
+					      msm_rpc_async_cb cb, void *data)
+{
+	struct rr_async_call *call;
+	unsigned long flags;
+
+	if (request_size < sizeof(*req))
+		return ERR_PTR(-ETOOSMALL);
+
+	if (ept->dst_pid == 0xffffffff)
+		return ERR_PTR(-ENOTCONN);
+
+	if (!cb)
+		return ERR_PTR(-EINVAL);
+
+	call = kzalloc(sizeof(*call), GFP_KERNEL);
+	if (!call)
+		return ERR_PTR(-ENOMEM);
+
+	memset(req, 0, sizeof(*req));
+	req->xid = cpu_to_be32(atomic_add_return(1, &next_xid));
+	req->rpc_vers = cpu_to_be32(2);
+	req->prog = ept->dst_prog;
+	req->vers = ept->dst_vers;
+	req->procedure = cpu_to_be32(proc);
+
+	call->xid = req->xid;
+	call->cb = cb;
+	call->data = data;
+
+	spin_lock_irqsave(&ept->async_lock, flags);
+	list_add_tail(&call->list, &ept->async_pend_q);
+	spin_unlock_irqrestore(&ept->async_lock, flags);
+
+	return call;
+}
+
+/* Withdraw a call whose request could not be sent. */
+static void rr_async_cancel(struct msm_rpc_endpoint *ept,
+			    struct rr_async_call *call)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&ept->async_lock, flags);
+	list_del(&call->list);
+	spin_unlock_irqrestore(&ept->async_lock, flags);
+
+	if (call->pkt)
+		rr_free_packet(call->pkt);
+	kfree(call);
+}
+
+int msm_rpc_call_async(struct msm_rpc_endpoint *ept, uint32_t proc,
+		       void *_request, int request_size,
+		       msm_rpc_async_cb cb, void *data)
+{
+	struct rr_async_call *call;
+	int rc;
+
+	call = rr_async_prepare(ept, proc, _request, request_size, cb, data);
+	if (IS_ERR(call))
+		return PTR_ERR(call);
+
+	rc = msm_rpc_write(ept, _request, request_size);
+	if (rc < 0) {
+		rr_async_cancel(ept, call);
+		return rc;
+	}
+	return 0;
+}
+EXPORT_SYMBOL(msm_rpc_call_async);
+
+/* staging buffer for msm_rpc_call_async_batch */
+#define RR_BATCH_MAX	(4 * RPCROUTER_MSGSIZE_MAX)
+
+static int rr_batch_flush(struct rpcrouter_xprt_info *xprt_info,
+			  struct msm_rpc_endpoint *ept,
+			  void *buf, int len)
+{
+	unsigned long flags;
+	int rc;
+
+	if (!len)
+		return 0;
+
+	rc = rr_xprt_lock_space(xprt_info, ept, len, &flags);
+	if (rc < 0)
+		return rc;
+	rc = xprt_info->xprt->write(buf, len, PACKETS);
+	spin_unlock(&ept->restart_lock);
+	spin_unlock_irqrestore(&xprt_info->lock, flags);
+
+	return rc == len ? 0 : -EIO;
+}
+
+/*
+ * Give back the quota taken by rr_write_prepare() for n packets that
+ * were never sent.  A packet that reached the quota also carried the
+ * confirm_rx; with the counter back below the quota the next packet
+ * sent asks for it again.
+ */
+static void rr_batch_unquota(struct rr_remote_endpoint *r_ept, int n)
+{
+	unsigned long flags;
+
+	if (!r_ept || !n)
+		return;
+
+	spin_lock_irqsave(&r_ept->quota_lock, flags);
+	/* a restart may have reset the counter meanwhile */
+	r_ept->tx_quota_cntr = max(r_ept->tx_quota_cntr - n, 0);
+	spin_unlock_irqrestore(&r_ept->quota_lock, flags);
+	wake_up(&r_ept->quota_wait);
+}
+
+int msm_rpc_call_async_batch(struct msm_rpc_endpoint *ept,
+			     struct msm_rpc_async_req *reqs, int num)
+{
+	struct rpcrouter_xprt_info *xprt_info;
+	struct rr_remote_endpoint *r_ept;
+	struct rr_async_call **calls;
+	struct rr_async_call *call;
+	struct rr_header hdr;
+	uint32_t pacmark;
+	int max_tx;
+	int sent = 0; /* calls before this one are on their way */
+	int flush_failed = 0;
+	int len = 0;
+	char *buf;
+	int i, rc = 0;
+
+	if (ept->dst_pid == 0xffffffff)
+		return -ENOTCONN;
+
+	r_ept = rpcrouter_lookup_remote_endpoint(ept->dst_pid, ept->dst_cid);
+	if ((!r_ept) && (ept->dst_pid != RPCROUTER_PID_LOCAL))
+		return -EHOSTUNREACH;
+
+	xprt_info = rpcrouter_get_xprt_info(ept->dst_pid);
+	if (!xprt_info)
+		return -EHOSTUNREACH;
+
+	buf = kmalloc(RR_BATCH_MAX, GFP_KERNEL);
+	calls = kcalloc(num, sizeof(*calls), GFP_KERNEL);
+	if (!buf || !calls) {
+		kfree(buf);
+		kfree(calls);
+		return -ENOMEM;
+	}
+
+	/* see msm_rpc_write */
+	max_tx = RPCROUTER_MSGSIZE_MAX - 8 - sizeof(uint32_t);
+
+	for (i = 0; i < num; i++) {
+		struct msm_rpc_async_req *r = &reqs[i];
+		int need = sizeof(hdr) + sizeof(pacmark) + r->request_size;
+
+		if (r->request_size > max_tx || len + need > RR_BATCH_MAX) {
+			rc = rr_batch_flush(xprt_info, ept, buf, len);
+			if (rc < 0) {
+				flush_failed = 1;
+				break;
+			}
+			sent = i;
+			len = 0;
+		}
+
+		/* multi-fragment requests take the normal path */
+		if (r->request_size > max_tx) {
+			rc = msm_rpc_call_async(ept, r->proc, r->request,
+						r->request_size, r->cb,
+						r->data);
+			if (rc < 0)
+				break;
+			sent = i + 1;
+			continue;
+		}
+
+		call = rr_async_prepare(ept, r->proc, r->request,
+					r->request_size, r->cb, r->data);
+		if (IS_ERR(call)) {
+			rc = PTR_ERR(call);
+			break;
+		}
+
+		hdr.dst_pid = ept->dst_pid;
+		hdr.dst_cid = ept->dst_cid;
+		rc = rr_write_prepare(&hdr, ept, r_ept, r->request,
+				      r->request_size);
+		if (rc < 0) {
+			rr_async_cancel(ept, call);
+			break;
+		}
+		calls[i] = call;
+
+		pacmark = PACMARK(r->request_size,
+				  atomic_add_return(1, &pm_mid) & 0xFF, 1, 1);
+		memcpy(buf + len, &hdr, sizeof(hdr));
+		len += sizeof(hdr);
+		memcpy(buf + len, &pacmark, sizeof(pacmark));
+		len += sizeof(pacmark);
+		memcpy(buf + len, r->request, r->request_size);
+		len += r->request_size;
+
+		/* the remote has to see a confirm_rx packet before we can
+		 * wait for its RESUME_TX, so never hold one back
+		 */
+		if (hdr.confirm_rx) {
+			rc = rr_batch_flush(xprt_info, ept, buf, len);
+			if (rc < 0) {
+				flush_failed = 1;
+				i++;
+				break;
+			}
+			sent = i + 1;
+			len = 0;
+		}
+	}
+
+	/* calls [sent, i) are staged in buf */
+	if (len && !flush_failed) {
+		rc = rr_batch_flush(xprt_info, ept, buf, len);
+		if (!rc) {
+			sent = i;
+			len = 0;
+		}
+	}
+	if (len) {
+		int j;
+
+		for (j = sent; j < i; j++)
+			rr_async_cancel(ept, calls[j]);
+		rr_batch_unquota(r_ept, i - sent);
+	}
+
+	kfree(calls);
+	kfree(buf);
+	return sent ? sent : rc;
+}
+EXPORT_SYMBOL(msm_rpc_call_async_batch);
+
 
 static inline int ept_packet_available(struct msm_rpc_endpoint *ept)
 {
@@ -1692,7 +2253,7 @@ static inline int ept_packet_available(struct msm_rpc_endpoint *ept)
 }
 
 int __msm_rpc_read(struct msm_rpc_endpoint *ept,
-		   struct rr_fragment **frag_ret,
+		   void **buffer,
 		   unsigned len, long timeout)
 {
 	struct rr_packet *pkt;
@@ -1770,12 +2331,12 @@ int __msm_rpc_read(struct msm_rpc_endpoint *ept,
 
 	rc = pkt->length;
 
-	*frag_ret = pkt->first;
-	rq = (void*) pkt->first->data;
+	rq = pkt->data;
 	if ((rc >= (sizeof(uint32_t) * 3)) && (rq->type == 0)) {
 		/* RPC CALL */
 		reply = get_avail_reply(ept);
 		if (!reply) {
+			rr_free_packet(pkt);
 			rc = -ENOMEM;
 			goto read_release_lock;
 		}
@@ -1787,6 +2348,7 @@ int __msm_rpc_read(struct msm_rpc_endpoint *ept,
 		set_pend_reply(ept, reply);
 	}
 
+	*buffer = pkt->data;
 	kfree(pkt);
 
 	IO("READ on ept %p (%d bytes)\n", ept, rc);
@@ -1827,6 +2389,7 @@ static struct rr_server *msm_rpc_get_server(uint32_t prog, uint32_t vers,
 					    uint32_t *found_prog)
 {
 	struct rr_server *server;
+	struct hlist_node *n;
 	unsigned long     flags;
 
 	if (found_prog == NULL)
@@ -1834,7 +2397,9 @@ static struct rr_server *msm_rpc_get_server(uint32_t prog, uint32_t vers,
 
 	*found_prog = 0;
 	spin_lock_irqsave(&server_list_lock, flags);
-	list_for_each_entry(server, &server_list, list) {
+	server_lookup_stats.lookups++;
+	hlist_for_each_entry(server, n, RR_SERVER_HASH(prog), hash) {
+		server_lookup_stats.probes++;
 		if (server->prog == prog) {
 			*found_prog = 1;
 			spin_unlock_irqrestore(&server_list_lock, flags);
@@ -1851,6 +2416,7 @@ static struct rr_server *msm_rpc_get_server(uint32_t prog, uint32_t vers,
 				return NULL;
 		}
 	}
+	server_lookup_stats.misses++;
 	spin_unlock_irqrestore(&server_list_lock, flags);
 	return NULL;
 }
@@ -2161,6 +2727,36 @@ static int dump_msm_rpc_endpoint(char *buf, int max)
 	return i;
 }
 
+static int dump_lookup_table(char *buf, int max, const char *name,
+			     struct rr_lookup_stats *stats, spinlock_t *lock)
+{
+	struct rr_lookup_stats s;
+	unsigned long flags;
+
+	spin_lock_irqsave(lock, flags);
+	s = *stats;
+	spin_unlock_irqrestore(lock, flags);
+
+	return scnprintf(buf, max,
+			 "%s: lookups %lu misses %lu probes %lu\n",
+			 name, s.lookups, s.misses, s.probes);
+}
+
+static int dump_lookup_stats(char *buf, int max)
+{
+	int i = 0;
+
+	i += dump_lookup_table(buf + i, max - i, "local_endpoints",
+			       &local_ept_lookup_stats, &local_endpoints_lock);
+	i += dump_lookup_table(buf + i, max - i, "remote_endpoints",
+			       &remote_ept_lookup_stats,
+			       &remote_endpoints_lock);
+	i += dump_lookup_table(buf + i, max - i, "servers",
+			       &server_lookup_stats, &server_list_lock);
+
+	return i;
+}
+
 #define DEBUG_BUFMAX 4096
 static char debug_buffer[DEBUG_BUFMAX];
 
@@ -2204,6 +2800,8 @@ static void debugfs_init(void)
 		     dump_remote_endpoints);
 	debug_create("dump_servers", 0444, dent,
 		     dump_servers);
+	debug_create("dump_lookup_stats", 0444, dent,
+		     dump_lookup_stats);
 
 }
 
@@ -2297,13 +2895,21 @@ static int __init rpcrouter_init(void)
 
 	init_waitqueue_head(&newserver_wait);
 
+	rpcrouter_rx_workqueue = create_workqueue("rpcrouter_rx");
+	if (!rpcrouter_rx_workqueue)
+		return -ENOMEM;
+
 	ret = msm_rpcrouter_init_devices();
-	if (ret < 0)
+	if (ret < 0) {
+		destroy_workqueue(rpcrouter_rx_workqueue);
 		return ret;
+	}
 
 	ret = modem_register_notifier(&msm_rpcrouter_nb);
-	if (ret < 0)
+	if (ret < 0) {
 		msm_rpcrouter_exit_devices();
+		destroy_workqueue(rpcrouter_rx_workqueue);
+	}
 
 	return ret;
 }
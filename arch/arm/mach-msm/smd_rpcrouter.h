@@ -24,6 +24,7 @@
 #include <linux/platform_device.h>
 #include <linux/msm_rpcrouter.h>
 #include <linux/wakelock.h>
+#include <linux/workqueue.h>
 
 #include <mach/msm_smd.h>
 #include <mach/msm_rpcrouter.h>
@@ -88,19 +89,19 @@ struct rr_header {
 
 #define RPCROUTER_MAX_REMOTE_SERVERS		100
 
-struct rr_fragment {
-	unsigned char data[RPCROUTER_MSGSIZE_MAX];
-	uint32_t length;
-	struct rr_fragment *next;
-};
-
+/*
+ * Fragments are read from the transport straight into data at offset
+ * length, so a complete packet is one contiguous buffer that can be
+ * handed to the reader as-is.  data is kmalloc()ed and owned by the
+ * reader once the packet leaves the read queue.
+ */
 struct rr_packet {
 	struct list_head list;
-	struct rr_fragment *first;
-	struct rr_fragment *last;
 	struct rr_header hdr;
 	uint32_t mid;
 	uint32_t length;
+	uint32_t size; /* allocated size of data */
+	void *data;
 };
 
 #define PACMARK_LAST(n) ((n) & 0x80000000)
@@ -118,6 +119,7 @@ static inline uint32_t PACMARK(uint32_t len, uint32_t mid, uint32_t first,
 
 struct rr_server {
 	struct list_head list;
+	struct hlist_node hash;
 
 	uint32_t pid;
 	uint32_t cid;
@@ -141,6 +143,7 @@ struct rr_remote_endpoint {
 	wait_queue_head_t quota_wait;
 
 	struct list_head list;
+	struct hlist_node hash;
 };
 
 struct msm_rpc_reply {
@@ -152,8 +155,11 @@ struct msm_rpc_reply {
 	uint32_t xid; /* be32 */
 };
 
+struct rpcrouter_xprt_info;
+
 struct msm_rpc_endpoint {
 	struct list_head list;
+	struct hlist_node hash;
 
 	/* incomplete packets waiting for assembly */
 	struct list_head incomplete;
@@ -167,6 +173,28 @@ struct msm_rpc_endpoint {
 	unsigned flags;
 	uint32_t forced_wakeup;
 
+	/* receive work deferred off the transport reader */
+	struct work_struct rx_work;
+	struct rpcrouter_xprt_info *rx_xprt;
+	atomic_t rx_confirm;
+	uint32_t rx_confirm_cid;
+
+	struct mutex rx_work_lock; /* one rx_work at a time */
+
+	/* transport readers holding this endpoint, under
+	 * local_endpoints_lock; destroy waits for it to drop to zero
+	 */
+	int rx_users;
+	wait_queue_head_t rx_users_wait;
+
+	/* asynchronous calls awaiting a reply, and those whose
+	 * completion callback is waiting to run in rx_work
+	 */
+	struct list_head async_pend_q;
+	struct list_head async_done_q;
+	spinlock_t async_lock;
+	struct wake_lock async_wake_lock;
+
 	/* restart handling */
 	int restart_state;
 	spinlock_t restart_lock;
@@ -200,6 +228,7 @@ enum write_data_type {
 	HEADER = 1,
 	PACKMARK,
 	PAYLOAD,
+	PACKETS, /* complete packets, routing header and pacmark included */
 };
 
 struct rpcrouter_xprt {
@@ -216,7 +245,7 @@ struct rpcrouter_xprt {
 /* shared between smd_rpcrouter*.c */
 void msm_rpcrouter_xprt_notify(struct rpcrouter_xprt *xprt, unsigned event);
 int __msm_rpc_read(struct msm_rpc_endpoint *ept,
-		   struct rr_fragment **frag,
+		   void **buffer,
 		   unsigned len, long timeout);
 
 int msm_rpcrouter_close(void);
@@ -155,28 +155,21 @@ static ssize_t rpcrouter_read(struct file *filp, char __user *buf,
 {
 	struct rpcrouter_file_info *file_info = filp->private_data;
 	struct msm_rpc_endpoint *ept;
-	struct rr_fragment *frag, *next;
+	void *data;
 	int rc;
 
 	ept = (struct msm_rpc_endpoint *) file_info->ept;
 
-	rc = __msm_rpc_read(ept, &frag, count, -1);
-	if (rc < 0)
+	rc = __msm_rpc_read(ept, &data, count, -1);
+	if (rc <= 0)
 		return rc;
 
-	count = rc;
-
-	while (frag != NULL) {		
-		if (copy_to_user(buf, frag->data, frag->length)) {
-			printk(KERN_ERR
-			       "rpcrouter: could not copy all read data to user!\n");
-			rc = -EFAULT;
-		}
-		buf += frag->length;
-		next = frag->next;
-		kfree(frag);
-		frag = next;
+	if (copy_to_user(buf, data, rc)) {
+		printk(KERN_ERR
+		       "rpcrouter: could not copy all read data to user!\n");
+		rc = -EFAULT;
 	}
+	kfree(data);
 
 	return rc;
 }
@@ -53,8 +53,8 @@ static void buf_req_retry(unsigned long param)
 
 static void smd_tty_read(unsigned long param)
 {
-	unsigned char *ptr;
-	int avail;
+	struct kvec iov[2];
+	int avail, n;
 	struct smd_tty_info *info = (struct smd_tty_info *)param;
 	struct tty_struct *tty = info->tty;
 
@@ -63,12 +63,17 @@ static void smd_tty_read(unsigned long param)
 
 	for (;;) {
 		if (test_bit(TTY_THROTTLED, &tty->flags)) break;
-		avail = smd_read_avail(info->ch);
+		avail = smd_read_peek(info->ch, iov);
 		if (avail == 0)
 			break;
 
-		avail = tty_prepare_flip_string(tty, &ptr, avail);
-		if (avail <= 0) {
+		/* copy straight from the fifo into the flip buffer */
+		n = tty_insert_flip_string(tty, iov[0].iov_base,
+					   iov[0].iov_len);
+		if (n == iov[0].iov_len && iov[1].iov_len)
+			n += tty_insert_flip_string(tty, iov[1].iov_base,
+						    iov[1].iov_len);
+		if (n <= 0) {
 			if (!timer_pending(&info->buf_req_timer)) {
 				init_timer(&info->buf_req_timer);
 				info->buf_req_timer.expires = jiffies +
@@ -80,7 +85,7 @@ static void smd_tty_read(unsigned long param)
 			return;
 		}
 
-		if (smd_read(info->ch, ptr, avail) != avail) {
+		if (smd_read_consume(info->ch, n, 0) != n) {
 			/* shouldn't be possible since we're in interrupt
 			** context here and nobody else could 'steal' our
 			** characters.
@@ -182,6 +187,7 @@ static void smd_tty_close(struct tty_struct *tty, struct file *f)
 static int smd_tty_write(struct tty_struct *tty, const unsigned char *buf, int len)
 {
 	struct smd_tty_info *info = tty->driver_data;
+	struct kvec iov[2];
 	int avail;
 
 	/* if we're writing to a packet channel we will
@@ -192,7 +198,15 @@ static int smd_tty_write(struct tty_struct *tty, const unsigned char *buf, int l
 	if (len > avail)
 		len = avail;
 
-	return smd_write(info->ch, buf, len);
+	/* the tty layer serializes writers, as smd_write_reserve() needs */
+	len = smd_write_reserve(info->ch, len, iov);
+	if (len <= 0)
+		return len;
+
+	memcpy(iov[0].iov_base, buf, iov[0].iov_len);
+	memcpy(iov[1].iov_base, buf + iov[0].iov_len, iov[1].iov_len);
+
+	return smd_write_commit(info->ch, len, 0);
 }
 
 static int smd_tty_write_room(struct tty_struct *tty)
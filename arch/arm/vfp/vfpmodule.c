@@ -14,8 +14,10 @@
 #include <linux/signal.h>
 #include <linux/sched.h>
 #include <linux/init.h>
+#include <linux/hardirq.h>
 
 #include <asm/thread_notify.h>
+#include <asm/neon.h>
 #include <asm/vfp.h>
 
 #include "vfpinstr.h"
@@ -420,6 +422,31 @@ void vfp_reinit(void)
 	fmxr(FPEXC, fmrx(FPEXC) & ~FPEXC_EN);
 }
 
+#ifdef CONFIG_NEON
+/*
+ * Kernel mode NEON: the current owner's VFP state is saved so its next
+ * VFP instruction reloads it, and the unit is enabled for the kernel.
+ * Not for interrupt context, and the caller must not sleep before
+ * kernel_neon_end().
+ */
+void kernel_neon_begin(void)
+{
+	BUG_ON(in_interrupt());
+	preempt_disable();
+	vfp_flush_context();
+	fmxr(FPEXC, fmrx(FPEXC) | FPEXC_EN);
+}
+EXPORT_SYMBOL(kernel_neon_begin);
+
+void kernel_neon_end(void)
+{
+	/* disabled again so the next user VFP access traps and reloads */
+	fmxr(FPEXC, fmrx(FPEXC) & ~FPEXC_EN);
+	preempt_enable();
+}
+EXPORT_SYMBOL(kernel_neon_end);
+#endif
+
 #ifdef CONFIG_PM
 #include <linux/sysdev.h>
 
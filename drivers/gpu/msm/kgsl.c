@@ -22,6 +22,7 @@
 #include <linux/vmalloc.h>
 #include <linux/pm_runtime.h>
 #include <linux/genlock.h>
+#include <linux/eventfd.h>
 
 #include <linux/ashmem.h>
 #include <linux/major.h>
@@ -132,6 +133,22 @@ static void kgsl_cancel_events(struct kgsl_device *device,
 	}
 }
 
+/**
+ * kgsl_eventfd_event_cb - Event callback for an eventfd timestamp event
+ * @device - The KGSL device that expired the timestamp
+ * @priv - the eventfd context to signal
+ * @timestamp - the timestamp that triggered the event
+ */
+
+static void kgsl_eventfd_event_cb(struct kgsl_device *device,
+	void *priv, u32 timestamp)
+{
+	struct eventfd_ctx *ctx = priv;
+
+	eventfd_signal(ctx, 1);
+	eventfd_ctx_put(ctx);
+}
+
 static inline struct kgsl_mem_entry *
 kgsl_mem_entry_create(void)
 {
@@ -847,55 +864,49 @@ static bool check_ibdesc(struct kgsl_device_private *dev_priv,
 	return result;
 }
 
-static long kgsl_ioctl_rb_issueibcmds(struct kgsl_device_private *dev_priv,
-				      unsigned int cmd, void *data)
+/**
+ * kgsl_get_ibdesc - Copy the IB descriptors of a submission from userspace
+ * @dev_priv - pointer to the private device structure
+ * @ibdesc_addr - user address of the IB list, or the single IB gpuaddr
+ * @numibs - number of IBs in the list, or the single IB size in dwords;
+ *	     updated to the number of descriptors returned
+ * @flags - submission flags from userspace
+ * @returns the descriptors or an ERR_PTR on failure
+ */
+
+static struct kgsl_ibdesc *kgsl_get_ibdesc(struct kgsl_device_private *dev_priv,
+					   unsigned int ibdesc_addr,
+					   unsigned int *numibs,
+					   unsigned int flags)
 {
-	int result = 0;
-	struct kgsl_ringbuffer_issueibcmds *param = data;
 	struct kgsl_ibdesc *ibdesc;
-	struct kgsl_context *context;
 
-#ifdef CONFIG_MSM_KGSL_DRM
-	kgsl_gpu_mem_flush(DRM_KGSL_GEM_CACHE_OP_TO_DEV);
-#endif
-
-	context = kgsl_find_context(dev_priv, param->drawctxt_id);
-	if (context == NULL) {
-		result = -EINVAL;
-		KGSL_DRV_ERR(dev_priv->device,
-			"invalid drawctxt drawctxt_id %d\n",
-			param->drawctxt_id);
-		goto done;
-	}
-
-	if (param->flags & KGSL_CONTEXT_SUBMIT_IB_LIST) {
+	if (flags & KGSL_CONTEXT_SUBMIT_IB_LIST) {
 		KGSL_DRV_INFO(dev_priv->device,
 			"Using IB list mode for ib submission, numibs: %d\n",
-			param->numibs);
-		if (!param->numibs) {
+			*numibs);
+		if (!*numibs) {
 			KGSL_DRV_ERR(dev_priv->device,
 				"Invalid numibs as parameter: %d\n",
-				 param->numibs);
-			result = -EINVAL;
-			goto done;
+				 *numibs);
+			return ERR_PTR(-EINVAL);
 		}
 
-		ibdesc = kzalloc(sizeof(struct kgsl_ibdesc) * param->numibs,
+		ibdesc = kzalloc(sizeof(struct kgsl_ibdesc) * *numibs,
 					GFP_KERNEL);
 		if (!ibdesc) {
 			KGSL_MEM_ERR(dev_priv->device,
 				"kzalloc(%d) failed\n",
-				sizeof(struct kgsl_ibdesc) * param->numibs);
-			result = -ENOMEM;
-			goto done;
+				sizeof(struct kgsl_ibdesc) * *numibs);
+			return ERR_PTR(-ENOMEM);
 		}
 
-		if (copy_from_user(ibdesc, (void *)param->ibdesc_addr,
-				sizeof(struct kgsl_ibdesc) * param->numibs)) {
-			result = -EFAULT;
+		if (copy_from_user(ibdesc, (void *)ibdesc_addr,
+				sizeof(struct kgsl_ibdesc) * *numibs)) {
 			KGSL_DRV_ERR(dev_priv->device,
 				"copy_from_user failed\n");
-			goto free_ibdesc;
+			kfree(ibdesc);
+			return ERR_PTR(-EFAULT);
 		}
 	} else {
 		KGSL_DRV_INFO(dev_priv->device,
@@ -907,12 +918,58 @@ static long kgsl_ioctl_rb_issueibcmds(struct kgsl_device_private *dev_priv,
 			KGSL_MEM_ERR(dev_priv->device,
 				"kzalloc(%d) failed\n",
 				sizeof(struct kgsl_ibdesc));
-			result = -ENOMEM;
+			return ERR_PTR(-ENOMEM);
+		}
+		ibdesc[0].gpuaddr = ibdesc_addr;
+		ibdesc[0].sizedwords = *numibs;
+		*numibs = 1;
+	}
+
+	return ibdesc;
+}
+
+static long kgsl_ioctl_rb_issueibcmds(struct kgsl_device_private *dev_priv,
+				      unsigned int cmd, void *data)
+{
+	int result = 0;
+	struct kgsl_ringbuffer_issueibcmds *param = data;
+	struct kgsl_ibdesc *ibdesc;
+	struct kgsl_context *context;
+	struct eventfd_ctx *eventfd = NULL;
+	unsigned int flags = param->flags;
+
+#ifdef CONFIG_MSM_KGSL_DRM
+	kgsl_gpu_mem_flush(DRM_KGSL_GEM_CACHE_OP_TO_DEV);
+#endif
+
+	context = kgsl_find_context(dev_priv, param->drawctxt_id);
+	if (context == NULL) {
+		result = -EINVAL;
+		KGSL_DRV_ERR(dev_priv->device,
+			"invalid drawctxt drawctxt_id %d\n",
+			param->drawctxt_id);
+		goto done;
+	}
+
+	if (flags & KGSL_CONTEXT_SUBMIT_EVENTFD) {
+		/* the flag is ours, the device does not see it */
+		flags &= ~KGSL_CONTEXT_SUBMIT_EVENTFD;
+		if (cmd != IOCTL_KGSL_RINGBUFFER_ISSUEIBCMDS) {
+			result = -EINVAL;
 			goto done;
 		}
-		ibdesc[0].gpuaddr = param->ibdesc_addr;
-		ibdesc[0].sizedwords = param->numibs;
-		param->numibs = 1;
+		eventfd = eventfd_ctx_fdget(param->eventfd);
+		if (IS_ERR(eventfd)) {
+			result = PTR_ERR(eventfd);
+			goto done;
+		}
+	}
+
+	ibdesc = kgsl_get_ibdesc(dev_priv, param->ibdesc_addr,
+				 &param->numibs, flags);
+	if (IS_ERR(ibdesc)) {
+		result = PTR_ERR(ibdesc);
+		goto put_eventfd;
 	}
 
 	if (!check_ibdesc(dev_priv, ibdesc, param->numibs, true)) {
@@ -926,7 +983,7 @@ static long kgsl_ioctl_rb_issueibcmds(struct kgsl_device_private *dev_priv,
 					     ibdesc,
 					     param->numibs,
 					     &param->timestamp,
-					     param->flags);
+					     flags);
 
 	if (result != 0)
 		goto free_ibdesc;
@@ -940,8 +997,20 @@ static long kgsl_ioctl_rb_issueibcmds(struct kgsl_device_private *dev_priv,
 		goto free_ibdesc;
 	}
 
+	/* signalled when the timestamp the submission got retires */
+	if (eventfd) {
+		result = kgsl_add_event(dev_priv->device, param->timestamp,
+					kgsl_eventfd_event_cb, eventfd,
+					dev_priv);
+		if (result == 0)
+			eventfd = NULL;
+	}
+
 free_ibdesc:
 	kfree(ibdesc);
+put_eventfd:
+	if (eventfd)
+		eventfd_ctx_put(eventfd);
 done:
 
 #ifdef CONFIG_MSM_KGSL_DRM
@@ -1739,6 +1808,45 @@ static long kgsl_add_genlock_event(struct kgsl_device *device,
 }
 #endif
 
+/**
+ * kgsl_add_eventfd_event - Create a new eventfd event
+ * @device - KGSL device to create the event on
+ * @timestamp - Timestamp to trigger the event
+ * @data - User space buffer containing struct kgsl_timestamp_event_eventfd
+ * @len - length of the userspace buffer
+ * @owner - driver instance that owns this event
+ * @returns 0 on success or error code on error
+ *
+ * Signal the eventfd when the timestamp expires, so that userspace can
+ * poll() for GPU completion instead of blocking in waittimestamp.
+ */
+
+static int kgsl_add_eventfd_event(struct kgsl_device *device,
+	u32 timestamp, void __user *data, int len,
+	struct kgsl_device_private *owner)
+{
+	struct kgsl_timestamp_event_eventfd priv;
+	struct eventfd_ctx *ctx;
+	int ret;
+
+	if (len != sizeof(priv))
+		return -EINVAL;
+
+	if (copy_from_user(&priv, data, sizeof(priv)))
+		return -EFAULT;
+
+	ctx = eventfd_ctx_fdget(priv.fd);
+	if (IS_ERR(ctx))
+		return PTR_ERR(ctx);
+
+	ret = kgsl_add_event(device, timestamp, kgsl_eventfd_event_cb, ctx,
+			     owner);
+	if (ret)
+		eventfd_ctx_put(ctx);
+
+	return ret;
+}
+
 /**
  * kgsl_ioctl_timestamp_event - Register a new timestamp event from userspace
  * @dev_priv - pointer to the private device structure
@@ -1759,6 +1867,11 @@ static long kgsl_ioctl_timestamp_event(struct kgsl_device_private *dev_priv,
 			param->timestamp, param->priv, param->len,
 			dev_priv);
 		break;
+	case KGSL_TIMESTAMP_EVENT_EVENTFD:
+		ret = kgsl_add_eventfd_event(dev_priv->device,
+			param->timestamp, param->priv, param->len,
+			dev_priv);
+		break;
 	default:
 		ret = -EINVAL;
 	}
@@ -1996,6 +2109,14 @@ static int kgsl_mmap(struct file *file, struct vm_area_struct *vma)
 	vma->vm_ops = &kgsl_gpumem_vm_ops;
 	vma->vm_file = file;
 
+	if (entry->memdesc.ops->vmmap) {
+		int ret = entry->memdesc.ops->vmmap(&entry->memdesc, vma);
+
+		/* Not fatal, the pages are still reachable through vmfault */
+		if (ret)
+			KGSL_CORE_ERR("vmmap failed: %d\n", ret);
+	}
+
 	return 0;
 }
 
@@ -2281,11 +2402,16 @@ static void kgsl_core_exit(void)
 	kgsl_cffdump_destroy();
 	kgsl_core_debugfs_close();
 	kgsl_sharedmem_uninit_sysfs();
+	kgsl_page_pool_destroy();
 }
 
 static int __init kgsl_core_init(void)
 {
 	int result = 0;
+
+	/* Set up first, kgsl_core_exit() tears it down on any error */
+	kgsl_page_pool_init();
+
 	/* alloc major and minor device numbers */
 	result = alloc_chrdev_region(&kgsl_driver.major, 0, KGSL_DEVICE_MAX,
 				  KGSL_NAME);
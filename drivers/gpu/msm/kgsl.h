@@ -95,6 +95,9 @@ struct kgsl_driver {
 		unsigned int coherent_max;
 		unsigned int mapped;
 		unsigned int mapped_max;
+		unsigned int page_pool;
+		unsigned int page_pool_hits;
+		unsigned int page_pool_misses;
 		unsigned int histogram[16];
 	} stats;
 };
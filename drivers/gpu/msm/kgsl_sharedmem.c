@@ -13,6 +13,8 @@
  */
 #include <linux/vmalloc.h>
 #include <linux/memory_alloc.h>
+#include <linux/highmem.h>
+#include <linux/workqueue.h>
 #include <asm/cacheflush.h>
 
 #include "kgsl.h"
@@ -208,6 +210,12 @@ static int kgsl_drv_memstat_show(struct device *dev,
 		val = kgsl_driver.stats.mapped;
 	else if (!strncmp(attr->attr.name, "mapped_max", 10))
 		val = kgsl_driver.stats.mapped_max;
+	else if (!strncmp(attr->attr.name, "page_pool_hits", 14))
+		val = kgsl_driver.stats.page_pool_hits;
+	else if (!strncmp(attr->attr.name, "page_pool_misses", 16))
+		val = kgsl_driver.stats.page_pool_misses;
+	else if (!strncmp(attr->attr.name, "page_pool", 9))
+		val = kgsl_driver.stats.page_pool;
 
 	return snprintf(buf, PAGE_SIZE, "%u\n", val);
 }
@@ -233,6 +241,9 @@ DEVICE_ATTR(coherent, 0444, kgsl_drv_memstat_show, NULL);
 DEVICE_ATTR(coherent_max, 0444, kgsl_drv_memstat_show, NULL);
 DEVICE_ATTR(mapped, 0444, kgsl_drv_memstat_show, NULL);
 DEVICE_ATTR(mapped_max, 0444, kgsl_drv_memstat_show, NULL);
+DEVICE_ATTR(page_pool, 0444, kgsl_drv_memstat_show, NULL);
+DEVICE_ATTR(page_pool_hits, 0444, kgsl_drv_memstat_show, NULL);
+DEVICE_ATTR(page_pool_misses, 0444, kgsl_drv_memstat_show, NULL);
 DEVICE_ATTR(histogram, 0444, kgsl_drv_histogram_show, NULL);
 
 static struct device_attribute *drv_attr_list[] = {
@@ -242,6 +253,9 @@ static struct device_attribute *drv_attr_list[] = {
 	&dev_attr_coherent_max,
 	&dev_attr_mapped,
 	&dev_attr_mapped_max,
+	&dev_attr_page_pool,
+	&dev_attr_page_pool_hits,
+	&dev_attr_page_pool_misses,
 	&dev_attr_histogram,
 	NULL
 };
@@ -323,6 +337,234 @@ static void kgsl_vmalloc_free(struct kgsl_memdesc *memdesc)
 	vfree(memdesc->hostptr);
 }
 
+/*
+ * Pages freed by user allocations are kept in a pool instead of going
+ * back to the page allocator. They are zeroed and flushed out of the
+ * caches by a work item, so a later allocation gets pages that are
+ * ready to be handed to the GPU and to userspace without further
+ * cache maintenance. Order-0 pages serve every allocation size, so a
+ * single list is enough. The pool gives its pages back under memory
+ * pressure through a shrinker.
+ */
+
+#define KGSL_PAGE_POOL_MAX	(SZ_8M >> PAGE_SHIFT)
+
+static struct {
+	spinlock_t lock;
+	struct list_head clean;
+	struct list_head dirty;
+	unsigned int nr_clean;
+	unsigned int nr_dirty;
+	struct work_struct zero_ws;
+} kgsl_page_pool;
+
+static void kgsl_page_zero(struct page *page)
+{
+	void *ptr = kmap_atomic(page, KM_USER0);
+	unsigned long paddr = page_to_phys(page);
+
+	memset(ptr, 0, PAGE_SIZE);
+	dmac_flush_range(ptr, ptr + PAGE_SIZE);
+	kunmap_atomic(ptr, KM_USER0);
+
+	outer_flush_range(paddr, paddr + PAGE_SIZE);
+}
+
+static void kgsl_page_pool_zero(struct work_struct *work)
+{
+	struct page *page;
+
+	spin_lock(&kgsl_page_pool.lock);
+	while (!list_empty(&kgsl_page_pool.dirty)) {
+		page = list_first_entry(&kgsl_page_pool.dirty, struct page,
+					lru);
+		list_del(&page->lru);
+		kgsl_page_pool.nr_dirty--;
+		spin_unlock(&kgsl_page_pool.lock);
+
+		kgsl_page_zero(page);
+
+		spin_lock(&kgsl_page_pool.lock);
+		list_add_tail(&page->lru, &kgsl_page_pool.clean);
+		kgsl_page_pool.nr_clean++;
+	}
+	spin_unlock(&kgsl_page_pool.lock);
+}
+
+/* Return a zeroed page whose contents have reached memory */
+static struct page *kgsl_page_pool_get(void)
+{
+	struct page *page = NULL;
+	bool dirty = false;
+
+	spin_lock(&kgsl_page_pool.lock);
+	if (!list_empty(&kgsl_page_pool.clean)) {
+		page = list_first_entry(&kgsl_page_pool.clean, struct page,
+					lru);
+		kgsl_page_pool.nr_clean--;
+	} else if (!list_empty(&kgsl_page_pool.dirty)) {
+		/* The zeroing work hasn't caught up, do it ourselves */
+		page = list_first_entry(&kgsl_page_pool.dirty, struct page,
+					lru);
+		kgsl_page_pool.nr_dirty--;
+		dirty = true;
+	}
+
+	if (page) {
+		list_del(&page->lru);
+		kgsl_driver.stats.page_pool--;
+		kgsl_driver.stats.page_pool_hits++;
+	} else
+		kgsl_driver.stats.page_pool_misses++;
+	spin_unlock(&kgsl_page_pool.lock);
+
+	if (page == NULL) {
+		page = alloc_page(GFP_KERNEL | __GFP_HIGHMEM);
+		if (page == NULL)
+			return NULL;
+		dirty = true;
+	}
+
+	if (dirty)
+		kgsl_page_zero(page);
+
+	return page;
+}
+
+static void kgsl_page_pool_put(struct page *page)
+{
+	spin_lock(&kgsl_page_pool.lock);
+	if (kgsl_driver.stats.page_pool >= KGSL_PAGE_POOL_MAX) {
+		spin_unlock(&kgsl_page_pool.lock);
+		__free_page(page);
+		return;
+	}
+
+	list_add_tail(&page->lru, &kgsl_page_pool.dirty);
+	kgsl_page_pool.nr_dirty++;
+	kgsl_driver.stats.page_pool++;
+	spin_unlock(&kgsl_page_pool.lock);
+
+	schedule_work(&kgsl_page_pool.zero_ws);
+}
+
+static int kgsl_page_pool_shrink(struct shrinker *shrinker, int nr_to_scan,
+				 gfp_t gfp_mask)
+{
+	struct page *page;
+	struct list_head *list;
+
+	spin_lock(&kgsl_page_pool.lock);
+	while (nr_to_scan-- > 0 && kgsl_driver.stats.page_pool) {
+		/* Give back the pages that would need zeroing first */
+		if (kgsl_page_pool.nr_dirty) {
+			list = &kgsl_page_pool.dirty;
+			kgsl_page_pool.nr_dirty--;
+		} else {
+			list = &kgsl_page_pool.clean;
+			kgsl_page_pool.nr_clean--;
+		}
+
+		page = list_first_entry(list, struct page, lru);
+		list_del(&page->lru);
+		kgsl_driver.stats.page_pool--;
+		__free_page(page);
+	}
+	nr_to_scan = kgsl_driver.stats.page_pool;
+	spin_unlock(&kgsl_page_pool.lock);
+
+	return nr_to_scan;
+}
+
+static struct shrinker kgsl_page_pool_shrinker = {
+	.shrink = kgsl_page_pool_shrink,
+	.seeks = DEFAULT_SEEKS,
+};
+
+void kgsl_page_pool_init(void)
+{
+	spin_lock_init(&kgsl_page_pool.lock);
+	INIT_LIST_HEAD(&kgsl_page_pool.clean);
+	INIT_LIST_HEAD(&kgsl_page_pool.dirty);
+	INIT_WORK(&kgsl_page_pool.zero_ws, kgsl_page_pool_zero);
+
+	register_shrinker(&kgsl_page_pool_shrinker);
+}
+
+void kgsl_page_pool_destroy(void)
+{
+	unregister_shrinker(&kgsl_page_pool_shrinker);
+	flush_work(&kgsl_page_pool.zero_ws);
+
+	kgsl_page_pool_shrink(NULL, kgsl_driver.stats.page_pool, GFP_KERNEL);
+}
+
+static int kgsl_page_alloc_vmfault(struct kgsl_memdesc *memdesc,
+				struct vm_area_struct *vma,
+				struct vm_fault *vmf)
+{
+	unsigned long offset;
+	struct page *page;
+
+	offset = ((unsigned long) vmf->virtual_address - vma->vm_start) >>
+		PAGE_SHIFT;
+
+	if (offset >= memdesc->sglen)
+		return VM_FAULT_SIGBUS;
+
+	page = sg_page(&memdesc->sg[offset]);
+	get_page(page);
+
+	vmf->page = page;
+	return 0;
+}
+
+/*
+ * Map every page of the allocation into the new vma up front, instead
+ * of taking one fault per page on first touch.
+ */
+static int kgsl_page_alloc_vmmap(struct kgsl_memdesc *memdesc,
+				struct vm_area_struct *vma)
+{
+	unsigned long addr = vma->vm_start;
+	int i, ret;
+
+	for (i = 0; i < memdesc->sglen && addr < vma->vm_end; i++) {
+		ret = vm_insert_page(vma, addr, sg_page(&memdesc->sg[i]));
+		if (ret)
+			return ret;
+		addr += PAGE_SIZE;
+	}
+
+	return 0;
+}
+
+static void kgsl_page_alloc_free(struct kgsl_memdesc *memdesc)
+{
+	int i;
+
+	kgsl_driver.stats.vmalloc -= memdesc->size;
+
+	if (memdesc->hostptr)
+		vunmap(memdesc->hostptr);
+
+	for (i = 0; i < memdesc->sglen; i++) {
+		struct page *page = sg_page(&memdesc->sg[i]);
+
+		if (page == NULL)
+			continue;
+		/*
+		 * A page still mapped elsewhere, for instance into userspace
+		 * through IOCTL_KGSL_SHAREDMEM_FROM_VMALLOC, must not be
+		 * reused: just drop our reference.
+		 */
+		if (page_count(page) == 1)
+			kgsl_page_pool_put(page);
+		else
+			__free_page(page);
+	}
+}
+
 static int kgsl_contiguous_vmflags(struct kgsl_memdesc *memdesc)
 {
 	return VM_RESERVED | VM_IO | VM_PFNMAP | VM_DONTEXPAND;
@@ -374,6 +616,13 @@ struct kgsl_memdesc_ops kgsl_vmalloc_ops = {
 };
 EXPORT_SYMBOL(kgsl_vmalloc_ops);
 
+static struct kgsl_memdesc_ops kgsl_page_alloc_ops = {
+	.free = kgsl_page_alloc_free,
+	.vmflags = kgsl_vmalloc_vmflags,
+	.vmfault = kgsl_page_alloc_vmfault,
+	.vmmap = kgsl_page_alloc_vmmap,
+};
+
 static struct kgsl_memdesc_ops kgsl_ebimem_ops = {
 	.free = kgsl_ebimem_free,
 	.vmflags = kgsl_contiguous_vmflags,
@@ -486,24 +735,82 @@ kgsl_sharedmem_vmalloc_user(struct kgsl_memdesc *memdesc,
 			    struct kgsl_pagetable *pagetable,
 			    size_t size, int flags)
 {
-	void *ptr;
+	int order, ret = 0;
+	int sglen = PAGE_ALIGN(size) / PAGE_SIZE;
+	struct page **pages = NULL;
 	unsigned int protflags;
+	int i;
 
 	BUG_ON(size == 0);
-	ptr = vmalloc_user(size);
 
-	if (ptr == NULL) {
-		KGSL_CORE_ERR("vmalloc_user(%d) failed: allocated=%d\n",
-			      size, kgsl_driver.stats.vmalloc);
-		return -ENOMEM;
+	memdesc->size = size;
+	memdesc->pagetable = pagetable;
+	memdesc->priv = KGSL_MEMFLAGS_CACHED;
+	memdesc->ops = &kgsl_page_alloc_ops;
+
+	/* kgsl_page_alloc_free takes it off again, on errors too */
+	KGSL_STATS_ADD(size, kgsl_driver.stats.vmalloc,
+		kgsl_driver.stats.vmalloc_max);
+
+	memdesc->sg = vmalloc(sglen * sizeof(struct scatterlist));
+	pages = vmalloc(sglen * sizeof(struct page *));
+	if (memdesc->sg == NULL || pages == NULL) {
+		ret = -ENOMEM;
+		goto done;
+	}
+
+	memdesc->sglen = sglen;
+	sg_init_table(memdesc->sg, sglen);
+
+	for (i = 0; i < sglen; i++) {
+		pages[i] = kgsl_page_pool_get();
+		if (pages[i] == NULL) {
+			KGSL_CORE_ERR("page allocation failed: allocated=%d\n",
+				kgsl_driver.stats.vmalloc);
+			ret = -ENOMEM;
+			goto done;
+		}
+		sg_set_page(&memdesc->sg[i], pages[i], PAGE_SIZE, 0);
+	}
+
+	/*
+	 * VM_USERMAP so that the from_vmalloc ioctl can keep handing the
+	 * buffer to remap_vmalloc_range
+	 */
+	memdesc->hostptr = vmap(pages, sglen, VM_MAP | VM_USERMAP,
+				PAGE_KERNEL);
+	if (memdesc->hostptr == NULL) {
+		KGSL_CORE_ERR("vmap(%d) failed\n", size);
+		ret = -ENOMEM;
+		goto done;
 	}
 
+	/*
+	 * The pages were flushed when they were zeroed, so unlike
+	 * _kgsl_sharedmem_vmalloc no cache maintenance is needed here.
+	 */
+
 	protflags = GSL_PT_PAGE_RV;
 	if (!(flags & KGSL_MEMFLAGS_GPUREADONLY))
 		protflags |= GSL_PT_PAGE_WV;
 
-	return _kgsl_sharedmem_vmalloc(memdesc, pagetable, ptr, size,
-		protflags);
+	ret = kgsl_mmu_map(pagetable, memdesc, protflags);
+
+	if (ret)
+		goto done;
+
+	order = get_order(size);
+
+	if (order < 16)
+		kgsl_driver.stats.histogram[order]++;
+
+done:
+	vfree(pages);
+
+	if (ret)
+		kgsl_sharedmem_free(memdesc);
+
+	return ret;
 }
 EXPORT_SYMBOL(kgsl_sharedmem_vmalloc_user);
 
@@ -39,6 +39,8 @@ struct kgsl_memdesc_ops {
 	int (*vmfault)(struct kgsl_memdesc *, struct vm_area_struct *,
 		       struct vm_fault *);
 	void (*free)(struct kgsl_memdesc *memdesc);
+	/* Optional, populate a new user mapping up front */
+	int (*vmmap)(struct kgsl_memdesc *, struct vm_area_struct *);
 };
 
 extern struct kgsl_memdesc_ops kgsl_vmalloc_ops;
@@ -82,6 +84,9 @@ void kgsl_process_uninit_sysfs(struct kgsl_process_private *private);
 int kgsl_sharedmem_init_sysfs(void);
 void kgsl_sharedmem_uninit_sysfs(void);
 
+void kgsl_page_pool_init(void);
+void kgsl_page_pool_destroy(void);
+
 static inline int
 memdesc_sg_phys(struct kgsl_memdesc *memdesc,
 		unsigned int physaddr, unsigned int size)
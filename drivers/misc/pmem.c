@@ -31,6 +31,7 @@
 #include <asm/io.h>
 #include <asm/uaccess.h>
 #include <asm/cacheflush.h>
+#include <asm/tlbflush.h>
 #include <asm/sizes.h>
 #include <linux/pm_runtime.h>
 
@@ -70,6 +71,10 @@
  */
 #define PMEM_FLAGS_SUBMAP 0x1 << 3
 #define PMEM_FLAGS_UNSUBMAP 0x1 << 4
+/* the physical address of the allocation has left the driver (to user
+ * space, a kernel client or a connected file), so it can never be moved
+ * by compaction */
+#define PMEM_FLAGS_PINNED 0x1 << 5
 
 struct pmem_data {
 	/* in alloc mode: an index into the bitmap
@@ -83,6 +88,10 @@ struct pmem_data {
 	struct rw_semaphore sem;
 	/* info about the mmaping process */
 	struct vm_area_struct *vma;
+	/* for a master mapped lazily: one bit per page of vma written since
+	 * its last clean, as far as write faults and the pte dirty bits
+	 * collected by a clean tell, NULL otherwise */
+	unsigned long *dirty;
 	/* task struct of the mapping process */
 	struct task_struct *task;
 	/* process id of teh mapping process */
@@ -207,6 +216,8 @@ struct pmem_info {
 		struct {
 			unsigned int bitmap_free; /* # of zero bits/quanta */
 			uint32_t *bitmap;
+			/* # of allocations moved by compaction */
+			unsigned long migrated;
 			int32_t bitmap_allocs;
 			struct {
 				short bit;
@@ -292,6 +303,7 @@ static int pmem_release(struct inode *, struct file *);
 static int pmem_mmap(struct file *, struct vm_area_struct *);
 static int pmem_open(struct inode *, struct file *);
 static long pmem_ioctl(struct file *, unsigned int, unsigned long);
+static int pmem_compact(int id, int wait, struct mm_struct *locked_mm);
 
 struct file_operations pmem_fops = {
 	.release = pmem_release,
@@ -533,6 +545,57 @@ static ssize_t show_pmem_bits_allocated(int id, char *buf)
 }
 RO_PMEM_ATTR(bits_allocated);
 
+/*
+ * Fragmentation index of the free space in percent: 0 when all free
+ * quanta are contiguous, approaching 100 as they are split up into
+ * smaller runs.
+ */
+static unsigned int pmem_bitmap_frag_index(int id)
+{
+	/* caller should hold the lock on arena_mutex! */
+	uint32_t *bitp = pmem[id].allocator.bitmap.bitmap;
+	unsigned int free = pmem[id].allocator.bitmap.bitmap_free;
+	unsigned long i, run = 0, largest = 0;
+
+	if (!free)
+		return 0;
+
+	for (i = 0; i < pmem[id].num_entries; i++) {
+		if (bitp[i >> PMEM_32BIT_WORD_ORDER] &
+				(1U << (i & PMEM_BITS_PER_WORD_MASK)))
+			run = 0;
+		else if (++run > largest)
+			largest = run;
+	}
+
+	return 100 - largest * 100 / free;
+}
+
+static ssize_t show_pmem_fragmentation(int id, char *buf)
+{
+	ssize_t ret;
+
+	mutex_lock(&pmem[id].arena_mutex);
+	ret = scnprintf(buf, PAGE_SIZE, "%u\n", pmem_bitmap_frag_index(id));
+	mutex_unlock(&pmem[id].arena_mutex);
+	return ret;
+}
+RO_PMEM_ATTR(fragmentation);
+
+static ssize_t show_pmem_compact(int id, char *buf)
+{
+	return scnprintf(buf, PAGE_SIZE, "%lu\n",
+		pmem[id].allocator.bitmap.migrated);
+}
+
+static ssize_t store_pmem_compact(int id, const char *buf,
+		const size_t count)
+{
+	pmem_compact(id, 1, NULL);
+	return count;
+}
+RW_PMEM_ATTR(compact);
+
 static struct attribute *pmem_bitmap_attrs[] = {
 	PMEM_COMMON_SYSFS_ATTRS,
 
@@ -540,6 +603,8 @@ static struct attribute *pmem_bitmap_attrs[] = {
 
 	&pmem_attr_free_quanta.attr,
 	&pmem_attr_bits_allocated.attr,
+	&pmem_attr_fragmentation.attr,
+	&pmem_attr_compact.attr,
 
 	NULL
 };
@@ -899,6 +964,7 @@ static int pmem_release(struct inode *inode, struct file *file)
 	BUG_ON(!list_empty(&data->region_list));
 
 	up_write(&data->sem);
+	kfree(data->dirty);
 	kfree(data);
 	if (pmem[id].release)
 		ret = pmem[id].release(inode, file);
@@ -930,6 +996,7 @@ static int pmem_open(struct inode *inode, struct file *file)
 	data->index = -1;
 	data->task = NULL;
 	data->vma = NULL;
+	data->dirty = NULL;
 	data->pid = 0;
 	data->master_file = NULL;
 #if PMEM_DEBUG
@@ -1487,6 +1554,228 @@ static int pmem_remap_pfn_range(int id, struct vm_area_struct *vma,
 	return pmem_map_pfn_range(id, vma, data, offset, len);
 }
 
+static void pmem_compact_flush(int id, void *vaddr, unsigned long len)
+{
+#ifdef CONFIG_OUTER_CACHE
+	unsigned long phy_start;
+#endif
+	if (!pmem[id].cached)
+		return;
+
+	dmac_flush_range(vaddr, vaddr + len);
+#ifdef CONFIG_OUTER_CACHE
+	phy_start = (unsigned long)vaddr -
+			(unsigned long)pmem[id].vbase + pmem[id].base;
+	outer_flush_range(phy_start, phy_start + len);
+#endif
+}
+
+static int pmem_can_migrate(struct pmem_data *data,
+			    struct mm_struct *locked_mm)
+{
+	/* caller should hold data->sem */
+	if (data->index == -1)
+		return 0;
+	if (data->flags & (PMEM_FLAGS_CONNECTED | PMEM_FLAGS_PINNED))
+		return 0;
+	/* the caller already holds this mm's mmap_sem */
+	if (data->vma && data->vma->vm_mm == locked_mm)
+		return 0;
+	return 1;
+}
+
+/*
+ * Reserve the lowest free range below the allocation that can hold it,
+ * keeping the alignment the allocation has now (up to 1M). Returns the
+ * first bit of the range or -1 if the allocation can't move down.
+ */
+static int pmem_reserve_lower(int id, struct pmem_data *data,
+			      unsigned int *quanta)
+{
+	int i, new_bit, spacing, max_spacing;
+	const int old_bit = data->index;
+
+	mutex_lock(&pmem[id].arena_mutex);
+	for (i = 0; i < pmem[id].allocator.bitmap.bitmap_allocs; i++)
+		if (pmem[id].allocator.bitmap.bitm_alloc[i].bit == old_bit)
+			break;
+	if (i >= pmem[id].allocator.bitmap.bitmap_allocs) {
+		mutex_unlock(&pmem[id].arena_mutex);
+		return -1;
+	}
+	*quanta = pmem[id].allocator.bitmap.bitm_alloc[i].quanta;
+
+	max_spacing = SZ_1M / pmem[id].quantum;
+	max_spacing = max_spacing > 1 ? max_spacing : 1;
+	spacing = old_bit ? min(1 << __ffs(old_bit), max_spacing) :
+			max_spacing;
+
+	new_bit = bitmap_allocate_contiguous(pmem[id].allocator.bitmap.bitmap,
+		*quanta,
+		(pmem[id].size + pmem[id].quantum - 1) / pmem[id].quantum,
+		spacing);
+	if (new_bit >= old_bit) {
+		bitmap_bits_clear_all(pmem[id].allocator.bitmap.bitmap,
+			new_bit, new_bit + *quanta);
+		new_bit = -1;
+	}
+	mutex_unlock(&pmem[id].arena_mutex);
+
+	return new_bit;
+}
+
+/*
+ * Move an allocation to the range reserved by pmem_reserve_lower(). The
+ * caller should hold data->sem and, if the allocation is mapped, the
+ * mmap_sem of the mapping mm, both for writing.
+ */
+static void pmem_migrate_bitmap(int id, struct pmem_data *data,
+				int new_bit, unsigned int quanta)
+{
+	int i;
+	const int old_bit = data->index;
+	const unsigned long len = quanta * pmem[id].quantum;
+	struct vm_area_struct *vma = data->vma;
+	void *old_vaddr = pmem[id].vbase + old_bit * pmem[id].quantum;
+	void *new_vaddr = pmem[id].vbase + new_bit * pmem[id].quantum;
+
+	/* user space faults on the range now wait for the mmap_sem */
+	if (vma)
+		zap_page_range(vma, vma->vm_start,
+			vma->vm_end - vma->vm_start, NULL);
+
+	pmem_compact_flush(id, old_vaddr, len);
+	memcpy(new_vaddr, old_vaddr, len);
+	pmem_compact_flush(id, new_vaddr, len);
+
+	mutex_lock(&pmem[id].arena_mutex);
+	bitmap_bits_clear_all(pmem[id].allocator.bitmap.bitmap,
+		old_bit, old_bit + quanta);
+	for (i = 0; i < pmem[id].allocator.bitmap.bitmap_allocs; i++)
+		if (pmem[id].allocator.bitmap.bitm_alloc[i].bit == old_bit) {
+			pmem[id].allocator.bitmap.bitm_alloc[i].bit = new_bit;
+			break;
+		}
+	pmem[id].allocator.bitmap.migrated++;
+	mutex_unlock(&pmem[id].arena_mutex);
+
+	data->index = new_bit;
+
+	if (vma && data->dirty) {
+		/* faults repopulate it, nothing is cached after the flush */
+		vma->vm_pgoff = pmem[id].start_addr(id, data) >> PAGE_SHIFT;
+		bitmap_zero(data->dirty,
+			(vma->vm_end - vma->vm_start) >> PAGE_SHIFT);
+	} else if (vma && pmem_map_pfn_range(id, vma, data, 0,
+				      vma->vm_end - vma->vm_start))
+		pr_err("pmem: %s: unable to remap moved allocation\n",
+			__func__);
+
+	DLOG("moved bitnum %d to %d, %u quanta\n", old_bit, new_bit, quanta);
+}
+
+/*
+ * Compact a bitmap region by sliding unpinned allocations down into the
+ * lowest free range that fits them, remapping the owning vma. Only
+ * allocations whose physical address never left the driver are moved.
+ *
+ * With wait == 0 no lock is slept on; this is used from the allocation
+ * paths, which already hold their own pmem_data->sem (and, for mmap, the
+ * locked_mm mmap_sem). Returns the number of allocations moved.
+ */
+static int pmem_compact(int id, int wait, struct mm_struct *locked_mm)
+{
+	int moved = 0;
+
+	if (pmem[id].allocator_type != PMEM_ALLOCATORTYPE_BITMAP ||
+	    !pmem[id].vbase)
+		return 0;
+
+	for (;;) {
+		struct pmem_data *data, *victim = NULL;
+		struct mm_struct *mm = NULL;
+		unsigned int quanta = 0;
+		int new_bit = -1, ok = 1;
+
+		if (wait)
+			mutex_lock(&pmem[id].data_list_mutex);
+		else if (!mutex_trylock(&pmem[id].data_list_mutex))
+			break;
+
+		list_for_each_entry(data, &pmem[id].data_list, list) {
+			if (!down_write_trylock(&data->sem))
+				continue;
+			if (pmem_can_migrate(data, locked_mm)) {
+				new_bit = pmem_reserve_lower(id, data, &quanta);
+				if (new_bit != -1) {
+					victim = data;
+					break;
+				}
+			}
+			up_write(&data->sem);
+		}
+		/* holding victim->sem keeps pmem_release from freeing it */
+		mutex_unlock(&pmem[id].data_list_mutex);
+
+		if (!victim)
+			break;
+
+		/* mmap_sem ranks above data->sem, so only try for it */
+		if (victim->vma) {
+			mm = victim->vma->vm_mm;
+			if (!atomic_inc_not_zero(&mm->mm_users)) {
+				mm = NULL;
+				ok = 0;
+			} else if (!down_write_trylock(&mm->mmap_sem)) {
+				ok = 0;
+			}
+		}
+
+		if (ok) {
+			pmem_migrate_bitmap(id, victim, new_bit, quanta);
+			if (mm)
+				up_write(&mm->mmap_sem);
+			moved++;
+		} else {
+			mutex_lock(&pmem[id].arena_mutex);
+			bitmap_bits_clear_all(pmem[id].allocator.bitmap.bitmap,
+				new_bit, new_bit + quanta);
+			mutex_unlock(&pmem[id].arena_mutex);
+		}
+		up_write(&victim->sem);
+		if (mm)
+			mmput(mm);
+
+		if (!ok)
+			break;
+	}
+
+	return moved;
+}
+
+/*
+ * Allocate from the region; if a bitmap region is too fragmented to
+ * satisfy the request, compact it and try once more.
+ */
+static int pmem_allocate_or_compact(int id, unsigned long len,
+				    unsigned int align,
+				    struct mm_struct *locked_mm)
+{
+	int index;
+
+	mutex_lock(&pmem[id].arena_mutex);
+	index = pmem[id].allocate(id, len, align);
+	mutex_unlock(&pmem[id].arena_mutex);
+
+	if (index == -1 && pmem_compact(id, 0, locked_mm)) {
+		mutex_lock(&pmem[id].arena_mutex);
+		index = pmem[id].allocate(id, len, align);
+		mutex_unlock(&pmem[id].arena_mutex);
+	}
+
+	return index;
+}
+
 static void pmem_vma_open(struct vm_area_struct *vma)
 {
 	struct file *file = vma->vm_file;
@@ -1502,11 +1791,16 @@ static void pmem_vma_open(struct vm_area_struct *vma)
 		current->parent->pid, file, file_count(file));
 	/* this should never be called as we don't support copying pmem
 	 * ranges via fork */
-	down_read(&data->sem);
+	down_write(&data->sem);
 	BUG_ON(!has_allocation(file));
+	/* data->vma no longer describes every mapping, so never move it */
+	data->flags |= PMEM_FLAGS_PINNED;
+	/* nor does the dirty map, maintain the whole range from now on */
+	kfree(data->dirty);
+	data->dirty = NULL;
 	/* remap the garbage pages, forkers don't get access to the data */
 	pmem_unmap_pfn_range(id, vma, data, 0, vma->vm_start - vma->vm_end);
-	up_read(&data->sem);
+	up_write(&data->sem);
 }
 
 static void pmem_vma_close(struct vm_area_struct *vma)
@@ -1539,6 +1833,8 @@ static void pmem_vma_close(struct vm_area_struct *vma)
 	}
 	if (data->vma == vma) {
 		data->vma = NULL;
+		kfree(data->dirty);
+		data->dirty = NULL;
 		if ((data->flags & PMEM_FLAGS_CONNECTED) &&
 		    (data->flags & PMEM_FLAGS_SUBMAP))
 			data->flags |= PMEM_FLAGS_UNSUBMAP;
@@ -1547,11 +1843,67 @@ static void pmem_vma_close(struct vm_area_struct *vma)
 	up_write(&data->sem);
 }
 
+/* populates lazily mapped masters a page at a time */
+static int pmem_vma_fault(struct vm_area_struct *vma, struct vm_fault *vmf)
+{
+	struct file *file = vma->vm_file;
+	struct pmem_data *data = file->private_data;
+	int id = get_id(file);
+	int ret = VM_FAULT_SIGBUS, err;
+
+	down_read(&data->sem);
+	if (unlikely(!has_allocation(file)))
+		goto out;
+
+	/* vm_pgoff is the pfn of the start of the vma */
+	err = vm_insert_pfn(vma,
+		(unsigned long)vmf->virtual_address & PAGE_MASK, vmf->pgoff);
+	/* -EBUSY: another thread mapped the page first */
+	if (err && err != -EBUSY)
+		goto out;
+
+	/* later writes to a page faulted in for reading only show in its
+	 * pte dirty bit, pmem_clean_dirty picks those up */
+	if ((vmf->flags & FAULT_FLAG_WRITE) && data->dirty &&
+	    data->vma == vma)
+		set_bit(vmf->pgoff -
+			(pmem[id].start_addr(id, data) >> PAGE_SHIFT),
+			data->dirty);
+	ret = VM_FAULT_NOPAGE;
+out:
+	up_read(&data->sem);
+	return ret;
+}
+
 static struct vm_operations_struct vm_ops = {
 	.open = pmem_vma_open,
 	.close = pmem_vma_close,
 };
 
+/* for masters populated by pmem_vma_fault, see pmem_map_lazily */
+static struct vm_operations_struct lazy_vm_ops = {
+	.open = pmem_vma_open,
+	.close = pmem_vma_close,
+	.fault = pmem_vma_fault,
+};
+
+/*
+ * Cached shared master mappings are populated on demand so that cache
+ * cleans can skip the pages they never touched.
+ */
+static int pmem_map_lazily(struct file *file, struct vm_area_struct *vma)
+{
+	int id = get_id(file);
+
+	if (!pmem[id].cached || (file->f_flags & O_SYNC))
+		return 0;
+	if (!(vma->vm_flags & VM_SHARED))
+		return 0;
+	/* maintenance goes through the kernel mapping */
+	return pmem[id].allocator_type == PMEM_ALLOCATORTYPE_SYSTEM ||
+		pmem[id].vbase;
+}
+
 static int pmem_mmap(struct file *file, struct vm_area_struct *vma)
 {
 	struct pmem_data *data = file->private_data;
@@ -1588,11 +1940,9 @@ static int pmem_mmap(struct file *file, struct vm_area_struct *vma)
 	}
 	/* if file->private_data == unalloced, alloc*/
 	if (data && data->index == -1) {
-		mutex_lock(&pmem[id].arena_mutex);
-		index = pmem[id].allocate(id,
+		index = pmem_allocate_or_compact(id,
 				vma->vm_end - vma->vm_start,
-				SZ_4K);
-		mutex_unlock(&pmem[id].arena_mutex);
+				SZ_4K, vma->vm_mm);
 		data->index = index;
 		if (data->index == -1) {
 			pr_err("pmem: mmap unable to allocate memory"
@@ -1652,15 +2002,26 @@ static int pmem_mmap(struct file *file, struct vm_area_struct *vma)
 		DLOG("submmapped file %p vma %p pid %u\n", file, vma,
 		     current->pid);
 	} else {
-		if (pmem_map_pfn_range(id, vma, data, 0, vma_size)) {
+		unsigned long *dirty = NULL;
+
+		if (pmem_map_lazily(file, vma))
+			dirty = kzalloc(BITS_TO_LONGS(vma_size >> PAGE_SHIFT) *
+					sizeof(unsigned long), GFP_KERNEL);
+		if (dirty) {
+			/* pmem_vma_fault fills in the pages */
+			vma->vm_flags |= VM_IO | VM_RESERVED | VM_PFNMAP;
+		} else if (pmem_map_pfn_range(id, vma, data, 0, vma_size)) {
 			pr_err("pmem: mmap failed in kernel!\n");
 			ret = -EAGAIN;
 			goto error;
 		}
 		data->flags |= PMEM_FLAGS_MASTERMAP;
+		/* remembered so compaction can remap the allocation */
+		data->vma = vma;
+		data->dirty = dirty;
 		data->pid = current->pid;
 	}
-	vma->vm_ops = &vm_ops;
+	vma->vm_ops = data->dirty ? &lazy_vm_ops : &vm_ops;
 error:
 	up_write(&data->sem);
 	return ret;
@@ -1678,7 +2039,9 @@ int get_pmem_user_addr(struct file *file, unsigned long *start,
 
 		down_read(&data->sem);
 		if (has_allocation(file)) {
-			if (data->vma) {
+			/* masters keep their vma for compaction only */
+			if (data->vma &&
+			    !(data->flags & PMEM_FLAGS_MASTERMAP)) {
 				*start = data->vma->vm_start;
 				*len = data->vma->vm_end - data->vma->vm_start;
 			} else {
@@ -1718,11 +2081,13 @@ int get_pmem_addr(struct file *file, unsigned long *start,
 			*vstart = (unsigned long)
 				pmem_start_vaddr(id, data);
 			up_read(&data->sem);
-#if PMEM_DEBUG
 			down_write(&data->sem);
+			/* the kernel client now knows the physical address */
+			data->flags |= PMEM_FLAGS_PINNED;
+#if PMEM_DEBUG
 			data->ref++;
-			up_write(&data->sem);
 #endif
+			up_write(&data->sem);
 			DLOG("returning start %#lx len %lu "
 				"vstart %#lx\n",
 				*start, *len, *vstart);
@@ -1822,6 +2187,107 @@ void flush_pmem_fd(int fd, unsigned long offset, unsigned long len)
 	}
 }
 
+static void pmem_cache_op(unsigned int cmd, unsigned long vaddr,
+			  unsigned long length, unsigned long paddr)
+{
+	if (cmd == PMEM_CLEAN_INV_CACHES)
+		clean_and_invalidate_caches(vaddr, length, paddr);
+	else if (cmd == PMEM_CLEAN_CACHES)
+		clean_caches(vaddr, length, paddr);
+	else if (cmd == PMEM_INV_CACHES)
+		invalidate_caches(vaddr, length, paddr);
+}
+
+/*
+ * Move the pte dirty bit of page i of a lazily mapped master into
+ * data->dirty. The pte is left clean, so the next write through it
+ * dirties it again.
+ */
+static void pmem_collect_dirty(struct pmem_data *data, unsigned long i)
+{
+	struct vm_area_struct *vma = data->vma;
+	struct mm_struct *mm = vma->vm_mm;
+	unsigned long addr = vma->vm_start + (i << PAGE_SHIFT);
+	pgd_t *pgd;
+	pud_t *pud;
+	pmd_t *pmd;
+	pte_t *pte, entry;
+	spinlock_t *ptl;
+
+	pgd = pgd_offset(mm, addr);
+	if (pgd_none(*pgd) || pgd_bad(*pgd))
+		return;
+	pud = pud_offset(pgd, addr);
+	if (pud_none(*pud) || pud_bad(*pud))
+		return;
+	pmd = pmd_offset(pud, addr);
+	if (pmd_none(*pmd) || pmd_bad(*pmd))
+		return;
+
+	pte = pte_offset_map_lock(mm, pmd, addr, &ptl);
+	if (pte_present(*pte) && pte_dirty(*pte)) {
+		flush_cache_page(vma, addr, pte_pfn(*pte));
+		entry = ptep_clear_flush(vma, addr, pte);
+		set_pte_at(mm, addr, pte, pte_mkclean(entry));
+		set_bit(i, data->dirty);
+	}
+	pte_unmap_unlock(pte, ptl);
+}
+
+/*
+ * A lazily mapped master only gets written through its vma, so a clean
+ * of [offset, offset + len) only has to visit pages marked in
+ * data->dirty, once the pte dirty bits have been collected into it.
+ * Pages the range covers completely are unmarked again afterwards.
+ * Invalidates can't be narrowed like that, the kernel mapping can
+ * prefetch lines of pages the vma never touched.
+ *
+ * Call with the vma's mmap_sem and data->sem held, reading is enough.
+ */
+static void pmem_clean_dirty(int id, struct pmem_data *data,
+			     unsigned long offset, unsigned long len)
+{
+	unsigned long vaddr = (unsigned long)pmem_start_vaddr(id, data);
+	unsigned long paddr = pmem[id].start_addr(id, data);
+	unsigned long nr_pages =
+		(data->vma->vm_end - data->vma->vm_start) >> PAGE_SHIFT;
+	unsigned long end = offset + len;
+	unsigned long first, last, full_first, full_last, bit, run_end, i;
+
+	first = offset >> PAGE_SHIFT;
+	last = min(PAGE_ALIGN(end) >> PAGE_SHIFT, nr_pages);
+	full_first = PAGE_ALIGN(offset) >> PAGE_SHIFT;
+	full_last = min(end >> PAGE_SHIFT, nr_pages);
+
+	for (i = first; i < last; i++)
+		pmem_collect_dirty(data, i);
+
+	for (bit = find_next_bit(data->dirty, last, first); bit < last;
+	     bit = find_next_bit(data->dirty, last, run_end)) {
+		unsigned long start, stop;
+
+		run_end = find_next_zero_bit(data->dirty, last, bit);
+		start = max(bit << PAGE_SHIFT, offset);
+		stop = min(run_end << PAGE_SHIFT, end);
+		clean_caches(vaddr + start, stop - start, paddr + start);
+
+		/* partially cleaned pages at either end stay marked */
+		for (i = max(bit, full_first); i < min(run_end, full_last);
+		     i++)
+			clear_bit(i, data->dirty);
+	}
+}
+
+/* caller should hold data->sem, returns the lazy vma's mm, referenced */
+static struct mm_struct *pmem_get_dirty_mm(struct pmem_data *data)
+{
+	if (!data->dirty || !data->vma)
+		return NULL;
+	if (!atomic_inc_not_zero(&data->vma->vm_mm->mm_users))
+		return NULL;
+	return data->vma->vm_mm;
+}
+
 void flush_pmem_file(struct file *file, unsigned long offset, unsigned long len)
 {
 	struct pmem_data *data;
@@ -1901,13 +2367,14 @@ end:
 	up_read(&data->sem);
 }
 
-int pmem_cache_maint(struct file *file, unsigned int cmd,
-		struct pmem_addr *pmem_addr)
+int pmem_cache_maint_batch(struct file *file, unsigned int cmd,
+		struct pmem_addr *addrs, unsigned int count)
 {
 	struct pmem_data *data;
-	int id;
+	int id, i, ret = 0;
 	unsigned long vaddr, paddr, length, offset,
 		      pmem_len, pmem_start_addr;
+	struct mm_struct *mm = NULL;
 
 	/* Called from kernel-space so file may be NULL */
 	if (!file)
@@ -1919,36 +2386,68 @@ int pmem_cache_maint(struct file *file, unsigned int cmd,
 	if (!pmem[id].cached)
 		return 0;
 
-	offset = pmem_addr->offset;
-	length = pmem_addr->length;
+	/* cleaning a lazily mapped master walks its page tables, and
+	 * mmap_sem ranks above data->sem */
+	if (cmd == PMEM_CLEAN_CACHES) {
+		down_read(&data->sem);
+		mm = pmem_get_dirty_mm(data);
+		up_read(&data->sem);
+		if (mm)
+			down_read(&mm->mmap_sem);
+	}
 
 	down_read(&data->sem);
 	if (!has_allocation(file)) {
 		up_read(&data->sem);
-		return -EINVAL;
+		ret = -EINVAL;
+		goto out_mm;
 	}
 	pmem_len = pmem[id].len(id, data);
 	pmem_start_addr = pmem[id].start_addr(id, data);
+
+	for (i = 0; i < count; i++)
+		if (addrs[i].offset + addrs[i].length > pmem_len ||
+		    addrs[i].offset + addrs[i].length < addrs[i].offset) {
+			up_read(&data->sem);
+			ret = -EINVAL;
+			goto out_mm;
+		}
+
+	/* a lazily mapped master only needs its dirty pages cleaned */
+	if (mm && data->dirty && data->vma && data->vma->vm_mm == mm) {
+		for (i = 0; i < count; i++)
+			pmem_clean_dirty(id, data, addrs[i].offset,
+					 addrs[i].length);
+		up_read(&data->sem);
+		goto out_mm;
+	}
 	up_read(&data->sem);
 
-	if (offset + length > pmem_len)
-		return -EINVAL;
+	for (i = 0; i < count; i++) {
+		offset = addrs[i].offset;
+		length = addrs[i].length;
+		vaddr = addrs[i].vaddr;
+		paddr = pmem_start_addr + offset;
 
-	vaddr = pmem_addr->vaddr;
-	paddr = pmem_start_addr + offset;
+		DLOG("pmem cache maint on dev %s(id: %d)"
+			"(vaddr %lx paddr %lx len %lu bytes)\n",
+			get_name(file), id, vaddr, paddr, length);
+		pmem_cache_op(cmd, vaddr, length, paddr);
+	}
 
-	DLOG("pmem cache maint on dev %s(id: %d)"
-		"(vaddr %lx paddr %lx len %lu bytes)\n",
-		get_name(file), id, vaddr, paddr, length);
-	if (cmd == PMEM_CLEAN_INV_CACHES)
-		clean_and_invalidate_caches(vaddr,
-				length, paddr);
-	else if (cmd == PMEM_CLEAN_CACHES)
-		clean_caches(vaddr, length, paddr);
-	else if (cmd == PMEM_INV_CACHES)
-		invalidate_caches(vaddr, length, paddr);
+out_mm:
+	if (mm) {
+		up_read(&mm->mmap_sem);
+		mmput(mm);
+	}
+	return ret;
+}
+EXPORT_SYMBOL(pmem_cache_maint_batch);
 
-	return 0;
+int pmem_cache_maint(struct file *file, unsigned int cmd,
+		struct pmem_addr *pmem_addr)
+{
+	return pmem_cache_maint_batch(file, cmd, pmem_addr, 1);
 }
 EXPORT_SYMBOL(pmem_cache_maint);
 
@@ -2132,10 +2631,10 @@ static int pmem_connect(unsigned long connect, struct file *file)
 			goto put_src_file;
 		}
 
-		down_read(&src_data->sem);
+		down_write(&src_data->sem);
 
 		if (unlikely(!has_allocation(src_file))) {
-			up_read(&src_data->sem);
+			up_write(&src_data->sem);
 			pr_err("pmem: %s: src file has no allocation!\n",
 				__func__);
 			ret = -EINVAL;
@@ -2143,7 +2642,9 @@ static int pmem_connect(unsigned long connect, struct file *file)
 			struct pmem_data *data;
 			int src_index = src_data->index;
 
-			up_read(&src_data->sem);
+			/* connected files use src_index, so it can't move */
+			src_data->flags |= PMEM_FLAGS_PINNED;
+			up_write(&src_data->sem);
 
 			data = file->private_data;
 			if (!data) {
@@ -2400,15 +2901,16 @@ static void pmem_get_size(struct pmem_region *region, struct file *file)
 	struct pmem_data *data = file->private_data;
 	int id = get_id(file);
 
-	down_read(&data->sem);
+	down_write(&data->sem);
 	if (!has_allocation(file)) {
 		region->offset = 0;
 		region->len = 0;
 	} else {
 		region->offset = pmem[id].start_addr(id, data);
 		region->len = pmem[id].len(id, data);
+		data->flags |= PMEM_FLAGS_PINNED;
 	}
-	up_read(&data->sem);
+	up_write(&data->sem);
 	DLOG("offset 0x%lx len 0x%lx\n", region->offset, region->len);
 }
 
@@ -2435,15 +2937,16 @@ static long pmem_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 			struct pmem_region region;
 
 			DLOG("get_phys\n");
-			down_read(&data->sem);
+			down_write(&data->sem);
 			if (!has_allocation(file)) {
 				region.offset = 0;
 				region.len = 0;
 			} else {
 				region.offset = pmem[id].start_addr(id, data);
 				region.len = pmem[id].len(id, data);
+				data->flags |= PMEM_FLAGS_PINNED;
 			}
-			up_read(&data->sem);
+			up_write(&data->sem);
 
 			if (copy_to_user((void __user *)arg, &region,
 						sizeof(struct pmem_region)))
@@ -2529,11 +3032,8 @@ static long pmem_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 				return -EINVAL;
 			}
 
-			mutex_lock(&pmem[id].arena_mutex);
-			data->index = pmem[id].allocate(id,
-					arg,
-					SZ_4K);
-			mutex_unlock(&pmem[id].arena_mutex);
+			data->index = pmem_allocate_or_compact(id, arg, SZ_4K,
+					NULL);
 			ret = data->index == -1 ? -ENOMEM :
 				data->index;
 			up_write(&data->sem);
@@ -2576,11 +3076,8 @@ static long pmem_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 				return -EINVAL;
 			}
 
-			mutex_lock(&pmem[id].arena_mutex);
-			data->index = pmem[id].allocate(id,
-					alloc.size,
-					alloc.align);
-			mutex_unlock(&pmem[id].arena_mutex);
+			data->index = pmem_allocate_or_compact(id, alloc.size,
+					alloc.align, NULL);
 			ret = data->index == -1 ? -ENOMEM :
 				data->index;
 			up_write(&data->sem);
@@ -2601,6 +3098,27 @@ static long pmem_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 
 			return pmem_cache_maint(file, cmd, &pmem_addr);
 		}
+	case PMEM_CACHE_MAINT_BATCH:
+		{
+			struct pmem_cache_batch batch;
+			struct pmem_addr addrs[PMEM_CACHE_BATCH_MAX];
+
+			if (copy_from_user(&batch, (void __user *)arg,
+						sizeof(struct pmem_cache_batch)))
+				return -EFAULT;
+			if (batch.count > PMEM_CACHE_BATCH_MAX)
+				return -EINVAL;
+			if (batch.cmd != PMEM_CLEAN_INV_CACHES &&
+			    batch.cmd != PMEM_CLEAN_CACHES &&
+			    batch.cmd != PMEM_INV_CACHES)
+				return -EINVAL;
+			if (copy_from_user(addrs, (void __user *)batch.addrs,
+					batch.count * sizeof(struct pmem_addr)))
+				return -EFAULT;
+
+			return pmem_cache_maint_batch(file, batch.cmd, addrs,
+					batch.count);
+		}
 	default:
 		if (pmem[id].ioctl)
 			return pmem[id].ioctl(file, cmd, arg);
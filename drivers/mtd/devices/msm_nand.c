@@ -21,6 +21,8 @@
 #include <linux/mtd/partitions.h>
 #include <linux/platform_device.h>
 #include <linux/sched.h>
+#include <linux/completion.h>
+#include <linux/mutex.h>
 #include <linux/dma-mapping.h>
 #include <linux/io.h>
 #include <linux/crc16.h>
@@ -67,6 +69,13 @@ unsigned crci_mask;
 
 #define VERBOSE 0
 
+/* pages read back to back from one data mover command list */
+#define MSM_NAND_READ_CHAIN 4
+
+static int readahead = 1;
+module_param(readahead, bool, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(readahead, "Read ahead on small sequential page reads");
+
 struct msm_nand_chip {
 	struct device *dev;
 	wait_queue_head_t wait_queue;
@@ -76,6 +85,13 @@ struct msm_nand_chip {
 	dma_addr_t dma_addr;
 	unsigned CFG0, CFG1;
 	uint32_t ecc_buf_cfg;
+
+	/* read-ahead window, MSM_NAND_READ_CHAIN pages */
+	struct mutex ra_lock;
+	uint8_t *ra_buf;
+	loff_t ra_start;
+	size_t ra_len;
+	loff_t ra_next;
 };
 
 #define CFG1_WIDE_FLASH (1U << 1)
@@ -226,6 +242,52 @@ static void msm_nand_release_dma_buffer(struct msm_nand_chip *chip,
 	wake_up(&chip->wait_queue);
 }
 
+/* a command list queued on the data mover without waiting for it */
+struct msm_nand_dmov_req {
+	struct msm_dmov_cmd dmov_cmd;
+	struct completion complete;
+	unsigned int result;
+};
+
+static void msm_nand_dmov_complete(struct msm_dmov_cmd *cmd,
+				   unsigned int result,
+				   struct msm_dmov_errdata *err)
+{
+	struct msm_nand_dmov_req *req =
+		container_of(cmd, struct msm_nand_dmov_req, dmov_cmd);
+
+	req->result = result;
+	complete(&req->complete);
+}
+
+static void msm_nand_dmov_enqueue(struct msm_nand_chip *chip,
+				  struct msm_nand_dmov_req *req,
+				  unsigned *cmdptr)
+{
+	req->dmov_cmd.cmdptr = DMOV_CMD_PTR_LIST |
+		DMOV_CMD_ADDR(msm_virt_to_dma(chip, cmdptr));
+	req->dmov_cmd.crci_mask = crci_mask;
+	req->dmov_cmd.complete_func = msm_nand_dmov_complete;
+	req->dmov_cmd.exec_func = NULL;
+	init_completion(&req->complete);
+
+	dsb();
+	msm_dmov_enqueue_cmd(chip->dma_channel, &req->dmov_cmd);
+}
+
+static int msm_nand_dmov_wait(struct msm_nand_dmov_req *req)
+{
+	wait_for_completion_io(&req->complete);
+	dsb();
+
+	if (req->result != (DMOV_RSLT_VALID | DMOV_RSLT_DONE)) {
+		pr_err("%s: data mover error, result %x\n",
+		       __func__, req->result);
+		return -EIO;
+	}
+	return 0;
+}
+
 
 unsigned flash_rd_reg(struct msm_nand_chip *chip, unsigned addr)
 {
@@ -734,7 +796,7 @@ static int msm_nand_read_oob(struct mtd_info *mtd, loff_t from,
 	struct msm_nand_chip *chip = mtd->priv;
 
 	struct {
-		dmov_s cmd[8 * 5 + 2];
+		dmov_s cmd[MSM_NAND_READ_CHAIN * (8 * 5 + 2)];
 		unsigned cmdptr;
 		struct {
 			uint32_t cmd;
@@ -749,7 +811,7 @@ static int msm_nand_read_oob(struct mtd_info *mtd, loff_t from,
 				uint32_t flash_status;
 				uint32_t buffer_status;
 			} result[8];
-		} data;
+		} data[MSM_NAND_READ_CHAIN];
 	} *dma_buffer;
 	dmov_s *cmd;
 	unsigned n;
@@ -762,10 +824,15 @@ static int msm_nand_read_oob(struct mtd_info *mtd, loff_t from,
 	dma_addr_t oob_dma_addr = 0;
 	dma_addr_t data_dma_addr_curr = 0;
 	dma_addr_t oob_dma_addr_curr = 0;
+	dma_addr_t page_dma_addr[MSM_NAND_READ_CHAIN];
+	uint32_t page_oob_len[MSM_NAND_READ_CHAIN];
 	uint32_t oob_col = 0;
 	unsigned page_count;
 	unsigned pages_read = 0;
 	unsigned start_sector = 0;
+	unsigned chain, p;
+	int map_pages = 0;
+	int map_err = 0;
 	uint32_t ecc_errors;
 	uint32_t total_ecc_errors = 0;
 	unsigned cwperpage;
@@ -827,7 +894,16 @@ static int msm_nand_read_oob(struct mtd_info *mtd, loff_t from,
 	else
 		page_count = ops->len / (mtd->writesize + mtd->oobsize);
 
-	if (ops->datbuf) {
+	/* A vmalloc buffer is only contiguous within each page, so map
+	 * it one flash page at a time as long as no flash page straddles
+	 * two memory pages; the data still goes straight to the caller.
+	 */
+	if (ops->datbuf && !virt_addr_valid(ops->datbuf) &&
+	    ops->mode != MTD_OOB_RAW && mtd->writesize <= PAGE_SIZE &&
+	    !((unsigned long)ops->datbuf & (mtd->writesize - 1)))
+		map_pages = 1;
+
+	if (ops->datbuf && !map_pages) {
 		data_dma_addr_curr = data_dma_addr =
 			msm_nand_dma_map(chip->dev, ops->datbuf, ops->len,
 				       DMA_FROM_DEVICE);
@@ -859,135 +935,175 @@ static int msm_nand_read_oob(struct mtd_info *mtd, loff_t from,
 		oob_col >>= 1;
 
 	err = 0;
-	while (page_count-- > 0) {
+	while (page_count > 0) {
+		/* chain up to MSM_NAND_READ_CHAIN page reads into one
+		 * command list, so the data mover runs them back to back
+		 * and we wait once per chain rather than once per page
+		 */
+		chain = min_t(unsigned, page_count, MSM_NAND_READ_CHAIN);
 		cmd = dma_buffer->cmd;
 
-		/* CMD / ADDR0 / ADDR1 / CHIPSEL program values */
-		if (ops->mode != MTD_OOB_RAW) {
-			dma_buffer->data.cmd = MSM_NAND_CMD_PAGE_READ_ECC;
-			dma_buffer->data.cfg0 =
-			(chip->CFG0 & ~(7U << 6))
-				| (((cwperpage-1) - start_sector) << 6);
-			dma_buffer->data.cfg1 = chip->CFG1;
-		} else {
-			dma_buffer->data.cmd = MSM_NAND_CMD_PAGE_READ;
-			dma_buffer->data.cfg0 = (MSM_NAND_CFG0_RAW
-					& ~(7U << 6)) | ((cwperpage-1) << 6);
-			dma_buffer->data.cfg1 = MSM_NAND_CFG1_RAW |
-					(chip->CFG1 & CFG1_WIDE_FLASH);
-		}
+		for (p = 0; p < chain; p++) {
+			typeof(&dma_buffer->data[0]) data =
+				&dma_buffer->data[p];
+
+			if (map_pages) {
+				data_dma_addr_curr = msm_nand_dma_map(chip->dev,
+					ops->datbuf + (pages_read + p) *
+					mtd->writesize, mtd->writesize,
+					DMA_FROM_DEVICE);
+				if (dma_mapping_error(chip->dev,
+						      data_dma_addr_curr)) {
+					pr_err("msm_nand_read_oob: failed to "
+					       "get dma addr for %p\n",
+					       ops->datbuf);
+					/* run what has been built so far */
+					map_err = -EIO;
+					chain = p;
+					break;
+				}
+			}
+			page_dma_addr[p] = data_dma_addr_curr;
+
+			/* CMD / ADDR0 / ADDR1 / CHIPSEL program values */
+			if (ops->mode != MTD_OOB_RAW) {
+				data->cmd = MSM_NAND_CMD_PAGE_READ_ECC;
+				data->cfg0 =
+				(chip->CFG0 & ~(7U << 6))
+					| (((cwperpage-1) - start_sector) << 6);
+				data->cfg1 = chip->CFG1;
+			} else {
+				data->cmd = MSM_NAND_CMD_PAGE_READ;
+				data->cfg0 = (MSM_NAND_CFG0_RAW & ~(7U << 6))
+						| ((cwperpage-1) << 6);
+				data->cfg1 = MSM_NAND_CFG1_RAW |
+						(chip->CFG1 & CFG1_WIDE_FLASH);
+			}
 
-		dma_buffer->data.addr0 = (page << 16) | oob_col;
-		dma_buffer->data.addr1 = (page >> 16) & 0xff;
-		/* chipsel_0 + enable DM interface */
-		dma_buffer->data.chipsel = 0 | 4;
+			data->addr0 = ((page + p) << 16) | oob_col;
+			data->addr1 = ((page + p) >> 16) & 0xff;
+			/* chipsel_0 + enable DM interface */
+			data->chipsel = 0 | 4;
 
 
-		/* GO bit for the EXEC register */
-		dma_buffer->data.exec = 1;
+			/* GO bit for the EXEC register */
+			data->exec = 1;
 
 
-		BUILD_BUG_ON(8 != ARRAY_SIZE(dma_buffer->data.result));
+			BUILD_BUG_ON(8 != ARRAY_SIZE(data->result));
 
-		for (n = start_sector; n < cwperpage; n++) {
-			/* flash + buffer status return words */
-			dma_buffer->data.result[n].flash_status = 0xeeeeeeee;
-			dma_buffer->data.result[n].buffer_status = 0xeeeeeeee;
-
-			/* block on cmd ready, then
-			 * write CMD / ADDR0 / ADDR1 / CHIPSEL
-			 * regs in a burst
-			 */
-			cmd->cmd = DST_CRCI_NAND_CMD;
-			cmd->src = msm_virt_to_dma(chip, &dma_buffer->data.cmd);
-			cmd->dst = MSM_NAND_FLASH_CMD;
-			if (n == start_sector)
-				cmd->len = 16;
-			else
-				cmd->len = 4;
-			cmd++;
+			for (n = start_sector; n < cwperpage; n++) {
+				/* flash + buffer status return words */
+				data->result[n].flash_status = 0xeeeeeeee;
+				data->result[n].buffer_status = 0xeeeeeeee;
 
-			if (n == start_sector) {
-				cmd->cmd = 0;
-				cmd->src = msm_virt_to_dma(chip,
-							&dma_buffer->data.cfg0);
-				cmd->dst = MSM_NAND_DEV0_CFG0;
-				cmd->len = 8;
+				/* block on cmd ready, then
+				 * write CMD / ADDR0 / ADDR1 / CHIPSEL
+				 * regs in a burst
+				 */
+				cmd->cmd = DST_CRCI_NAND_CMD;
+				cmd->src = msm_virt_to_dma(chip, &data->cmd);
+				cmd->dst = MSM_NAND_FLASH_CMD;
+				if (n == start_sector)
+					cmd->len = 16;
+				else
+					cmd->len = 4;
 				cmd++;
 
-				dma_buffer->data.ecccfg = chip->ecc_buf_cfg;
+				if (n == start_sector) {
+					cmd->cmd = 0;
+					cmd->src = msm_virt_to_dma(chip,
+								&data->cfg0);
+					cmd->dst = MSM_NAND_DEV0_CFG0;
+					cmd->len = 8;
+					cmd++;
+
+					data->ecccfg = chip->ecc_buf_cfg;
+					cmd->cmd = 0;
+					cmd->src = msm_virt_to_dma(chip,
+							&data->ecccfg);
+					cmd->dst = MSM_NAND_EBI2_ECC_BUF_CFG;
+					cmd->len = 4;
+					cmd++;
+				}
+
+				/* kick the execute register */
 				cmd->cmd = 0;
-				cmd->src = msm_virt_to_dma(chip,
-						&dma_buffer->data.ecccfg);
-				cmd->dst = MSM_NAND_EBI2_ECC_BUF_CFG;
+				cmd->src = msm_virt_to_dma(chip, &data->exec);
+				cmd->dst = MSM_NAND_EXEC_CMD;
 				cmd->len = 4;
 				cmd++;
-			}
-
-			/* kick the execute register */
-			cmd->cmd = 0;
-			cmd->src =
-				msm_virt_to_dma(chip, &dma_buffer->data.exec);
-			cmd->dst = MSM_NAND_EXEC_CMD;
-			cmd->len = 4;
-			cmd++;
-
-			/* block on data ready, then
-			 * read the status register
-			 */
-			cmd->cmd = SRC_CRCI_NAND_DATA;
-			cmd->src = MSM_NAND_FLASH_STATUS;
-			cmd->dst = msm_virt_to_dma(chip,
-						   &dma_buffer->data.result[n]);
-			/* MSM_NAND_FLASH_STATUS + MSM_NAND_BUFFER_STATUS */
-			cmd->len = 8;
-			cmd++;
 
-			/* read data block
-			 * (only valid if status says success)
-			 */
-			if (ops->datbuf) {
-				if (ops->mode != MTD_OOB_RAW)
-					sectordatasize = (n < (cwperpage - 1))
-					? 516 : (512 - ((cwperpage - 1) << 2));
-				else
-					sectordatasize = 528;
-
-				cmd->cmd = 0;
-				cmd->src = MSM_NAND_FLASH_BUFFER;
-				cmd->dst = data_dma_addr_curr;
-				data_dma_addr_curr += sectordatasize;
-				cmd->len = sectordatasize;
+				/* block on data ready, then
+				 * read the status register
+				 */
+				cmd->cmd = SRC_CRCI_NAND_DATA;
+				cmd->src = MSM_NAND_FLASH_STATUS;
+				cmd->dst = msm_virt_to_dma(chip,
+							   &data->result[n]);
+				/* MSM_NAND_FLASH_STATUS +
+				 * MSM_NAND_BUFFER_STATUS
+				 */
+				cmd->len = 8;
 				cmd++;
-			}
 
-			if (ops->oobbuf && (n == (cwperpage - 1)
-			     || ops->mode != MTD_OOB_AUTO)) {
-				cmd->cmd = 0;
-				if (n == (cwperpage - 1)) {
-					cmd->src = MSM_NAND_FLASH_BUFFER +
+				/* read data block
+				 * (only valid if status says success)
+				 */
+				if (ops->datbuf) {
+					if (ops->mode != MTD_OOB_RAW)
+						sectordatasize =
+						(n < (cwperpage - 1))
+						? 516 :
 						(512 - ((cwperpage - 1) << 2));
-					sectoroobsize = (cwperpage << 2);
-					if (ops->mode != MTD_OOB_AUTO)
-						sectoroobsize += 10;
-				} else {
-					cmd->src = MSM_NAND_FLASH_BUFFER + 516;
-					sectoroobsize = 10;
-				}
+					else
+						sectordatasize = 528;
 
-				cmd->dst = oob_dma_addr_curr;
-				if (sectoroobsize < oob_len)
-					cmd->len = sectoroobsize;
-				else
-					cmd->len = oob_len;
-				oob_dma_addr_curr += cmd->len;
-				oob_len -= cmd->len;
-				if (cmd->len > 0)
+					cmd->cmd = 0;
+					cmd->src = MSM_NAND_FLASH_BUFFER;
+					cmd->dst = data_dma_addr_curr;
+					data_dma_addr_curr += sectordatasize;
+					cmd->len = sectordatasize;
 					cmd++;
+				}
+
+				if (ops->oobbuf && (n == (cwperpage - 1)
+				     || ops->mode != MTD_OOB_AUTO)) {
+					cmd->cmd = 0;
+					if (n == (cwperpage - 1)) {
+						cmd->src =
+						MSM_NAND_FLASH_BUFFER +
+						(512 - ((cwperpage - 1) << 2));
+						sectoroobsize =
+							(cwperpage << 2);
+						if (ops->mode != MTD_OOB_AUTO)
+							sectoroobsize += 10;
+					} else {
+						cmd->src =
+						MSM_NAND_FLASH_BUFFER + 516;
+						sectoroobsize = 10;
+					}
+
+					cmd->dst = oob_dma_addr_curr;
+					if (sectoroobsize < oob_len)
+						cmd->len = sectoroobsize;
+					else
+						cmd->len = oob_len;
+					oob_dma_addr_curr += cmd->len;
+					oob_len -= cmd->len;
+					if (cmd->len > 0)
+						cmd++;
+				}
 			}
+			page_oob_len[p] = oob_len;
+		}
+		if (chain == 0) {
+			err = map_err;
+			break;
 		}
 
-		BUILD_BUG_ON(8 * 5 + 2 != ARRAY_SIZE(dma_buffer->cmd));
+		BUILD_BUG_ON(MSM_NAND_READ_CHAIN * (8 * 5 + 2) !=
+			     ARRAY_SIZE(dma_buffer->cmd));
 		BUG_ON(cmd - dma_buffer->cmd > ARRAY_SIZE(dma_buffer->cmd));
 		dma_buffer->cmd[0].cmd |= CMD_OCB;
 		cmd[-1].cmd |= CMD_OCU | CMD_LC;
@@ -1002,95 +1118,124 @@ static int msm_nand_read_oob(struct mtd_info *mtd, loff_t from,
 			&dma_buffer->cmdptr)));
 		dsb();
 
-		/* if any of the writes failed (0x10), or there
-		 * was a protection violation (0x100), we lose
-		 */
-		pageerr = rawerr = 0;
-		for (n = start_sector; n < cwperpage; n++) {
-			if (dma_buffer->data.result[n].flash_status & 0x110) {
-				rawerr = -EIO;
-				break;
+		for (p = 0; p < chain; p++) {
+			typeof(&dma_buffer->data[0]) data =
+				&dma_buffer->data[p];
+
+			/* if any of the writes failed (0x10), or there
+			 * was a protection violation (0x100), we lose
+			 */
+			pageerr = rawerr = 0;
+			for (n = start_sector; n < cwperpage; n++) {
+				if (data->result[n].flash_status & 0x110) {
+					rawerr = -EIO;
+					break;
+				}
 			}
-		}
-		if (rawerr) {
-			if (ops->datbuf && ops->mode != MTD_OOB_RAW) {
-				uint8_t *datbuf = ops->datbuf +
-					pages_read * mtd->writesize;
+			if (rawerr) {
+				if (ops->datbuf && ops->mode != MTD_OOB_RAW) {
+					uint8_t *datbuf = ops->datbuf +
+						pages_read * mtd->writesize;
+
+					dma_sync_single_for_cpu(chip->dev,
+						page_dma_addr[p],
+						mtd->writesize,
+						DMA_BIDIRECTIONAL);
+
+					for (n = 0; n < mtd->writesize; n++) {
+						/* empty blocks read 0x54 at
+						 * these offsets
+						 */
+						if (n % 516 == 3 &&
+						    datbuf[n] == 0x54)
+							datbuf[n] = 0xff;
+						if (datbuf[n] != 0xff) {
+							pageerr = rawerr;
+							break;
+						}
+					}
 
-				dma_sync_single_for_cpu(chip->dev,
-					data_dma_addr_curr-mtd->writesize,
-					mtd->writesize, DMA_BIDIRECTIONAL);
+					dma_sync_single_for_device(chip->dev,
+						page_dma_addr[p],
+						mtd->writesize,
+						DMA_BIDIRECTIONAL);
 
-				for (n = 0; n < mtd->writesize; n++) {
-					/* empty blocks read 0x54 at
-					 * these offsets
+				}
+				if (ops->oobbuf) {
+					/* oob read for later pages in the
+					 * chain is not looked at yet
 					 */
-					if (n % 516 == 3 && datbuf[n] == 0x54)
-						datbuf[n] = 0xff;
-					if (datbuf[n] != 0xff) {
-						pageerr = rawerr;
-						break;
+					for (n = 0; n < ops->ooblen -
+						     page_oob_len[p]; n++) {
+						if (ops->oobbuf[n] != 0xff) {
+							pageerr = rawerr;
+							break;
+						}
 					}
 				}
-
-				dma_sync_single_for_device(chip->dev,
-					data_dma_addr_curr-mtd->writesize,
-					mtd->writesize, DMA_BIDIRECTIONAL);
-
 			}
-			if (ops->oobbuf) {
-				for (n = 0; n < ops->ooblen; n++) {
-					if (ops->oobbuf[n] != 0xff) {
-						pageerr = rawerr;
+			if (pageerr) {
+				for (n = start_sector; n < cwperpage; n++) {
+					if (data->result[n].buffer_status
+							& 0x8) {
+						/* not thread safe */
+						mtd->ecc_stats.failed++;
+						pageerr = -EBADMSG;
 						break;
 					}
 				}
 			}
-		}
-		if (pageerr) {
-			for (n = start_sector; n < cwperpage; n++) {
-				if (dma_buffer->data.result[n].buffer_status
-						& 0x8) {
-					/* not thread safe */
-					mtd->ecc_stats.failed++;
-					pageerr = -EBADMSG;
-					break;
+			if (!rawerr) { /* check for corretable errors */
+				for (n = start_sector; n < cwperpage; n++) {
+					ecc_errors = data->
+						result[n].buffer_status & 0x7;
+					if (ecc_errors) {
+						total_ecc_errors += ecc_errors;
+						/* not thread safe */
+						mtd->ecc_stats.corrected +=
+							ecc_errors;
+						if (ecc_errors > 1)
+							pageerr = -EUCLEAN;
+					}
 				}
 			}
-		}
-		if (!rawerr) { /* check for corretable errors */
-			for (n = start_sector; n < cwperpage; n++) {
-				ecc_errors = dma_buffer->data.
-					result[n].buffer_status & 0x7;
-				if (ecc_errors) {
-					total_ecc_errors += ecc_errors;
-					/* not thread safe */
-					mtd->ecc_stats.corrected += ecc_errors;
-					if (ecc_errors > 1)
-						pageerr = -EUCLEAN;
-				}
+			if (pageerr && (pageerr != -EUCLEAN || err == 0))
+				err = pageerr;
+
+#if VERBOSE
+			if (rawerr && !pageerr) {
+				pr_err("msm_nand_read_oob %llx %x %x "
+				       "empty page\n",
+				       (loff_t)page * mtd->writesize, ops->len,
+				       ops->ooblen);
+			} else {
+				for (n = start_sector; n < cwperpage; n++)
+					pr_info("flash_status[%d] = %x,\
+					buffr_status[%d] = %x\n",
+					n, data->result[n].flash_status,
+					n, data->result[n].buffer_status);
+			}
+#endif
+			if (err && err != -EUCLEAN && err != -EBADMSG) {
+				/* later pages in the chain don't count */
+				oob_len = page_oob_len[p];
+				break;
 			}
+			pages_read++;
+			page++;
 		}
-		if (pageerr && (pageerr != -EUCLEAN || err == 0))
-			err = pageerr;
 
-#if VERBOSE
-		if (rawerr && !pageerr) {
-			pr_err("msm_nand_read_oob %llx %x %x empty page\n",
-			       (loff_t)page * mtd->writesize, ops->len,
-			       ops->ooblen);
-		} else {
-			for (n = start_sector; n < cwperpage; n++)
-				pr_info("flash_status[%d] = %x,\
-				buffr_status[%d] = %x\n",
-				n, dma_buffer->data.result[n].flash_status,
-				n, dma_buffer->data.result[n].buffer_status);
+		if (map_pages) {
+			for (n = 0; n < chain; n++)
+				dma_unmap_page(chip->dev, page_dma_addr[n],
+					       mtd->writesize, DMA_FROM_DEVICE);
 		}
-#endif
+
+		if (map_err)
+			err = map_err;
 		if (err && err != -EUCLEAN && err != -EBADMSG)
 			break;
-		pages_read++;
-		page++;
+		page_count -= chain;
 	}
 	msm_nand_release_dma_buffer(chip, dma_buffer, sizeof(*dma_buffer));
 
@@ -1099,7 +1244,7 @@ static int msm_nand_read_oob(struct mtd_info *mtd, loff_t from,
 				 ops->ooblen, DMA_FROM_DEVICE);
 	}
 err_dma_map_oobbuf_failed:
-	if (ops->datbuf) {
+	if (ops->datbuf && !map_pages) {
 		dma_unmap_page(chip->dev, data_dma_addr,
 				 ops->len, DMA_BIDIRECTIONAL);
 	}
@@ -1922,6 +2067,66 @@ err_dma_map_oobbuf_failed:
 	return err;
 }
 
+static void msm_nand_ra_invalidate(struct msm_nand_chip *chip)
+{
+	mutex_lock(&chip->ra_lock);
+	chip->ra_len = 0;
+	chip->ra_next = -1;
+	mutex_unlock(&chip->ra_lock);
+}
+
+/*
+ * Serve a small page aligned read from the read-ahead window. When
+ * the read continues where the previous one stopped, refill the
+ * window with one chained read first. Returns -EAGAIN when the
+ * caller should do an uncached read instead.
+ */
+static int msm_nand_read_cached(struct mtd_info *mtd, loff_t from,
+				size_t len, size_t *retlen, u_char *buf)
+{
+	struct msm_nand_chip *chip = mtd->priv;
+	size_t window = MSM_NAND_READ_CHAIN * mtd->writesize;
+	struct mtd_oob_ops ops;
+	int ret = -EAGAIN;
+
+	mutex_lock(&chip->ra_lock);
+	if (chip->ra_len && from >= chip->ra_start &&
+	    from + len <= chip->ra_start + chip->ra_len)
+		goto hit;
+
+	if (from != chip->ra_next || from + window > mtd->size)
+		goto out;
+
+	if (!chip->ra_buf) {
+		chip->ra_buf = kmalloc(window, GFP_KERNEL);
+		if (!chip->ra_buf)
+			goto out;
+	}
+
+	ops.mode = MTD_OOB_PLACE;
+	ops.len = window;
+	ops.retlen = 0;
+	ops.ooblen = 0;
+	ops.datbuf = chip->ra_buf;
+	ops.oobbuf = NULL;
+	chip->ra_len = 0;
+	/* anything but a clean read is left to the uncached path, which
+	 * reports it against the pages actually asked for
+	 */
+	if (msm_nand_read_oob(mtd, from, &ops) || ops.retlen != window)
+		goto out;
+	chip->ra_start = from;
+	chip->ra_len = window;
+hit:
+	memcpy(buf, chip->ra_buf + (from - chip->ra_start), len);
+	*retlen = len;
+	ret = 0;
+out:
+	chip->ra_next = from + len;
+	mutex_unlock(&chip->ra_lock);
+	return ret;
+}
+
 static int
 msm_nand_read(struct mtd_info *mtd, loff_t from, size_t len,
 	      size_t *retlen, u_char *buf)
@@ -1931,6 +2136,15 @@ msm_nand_read(struct mtd_info *mtd, loff_t from, size_t len,
 
 	/* printk("msm_nand_read %llx %x\n", from, len); */
 
+	if (readahead && !dual_nand_ctlr_present && len &&
+	    len < MSM_NAND_READ_CHAIN * mtd->writesize &&
+	    !(from & (mtd->writesize - 1)) &&
+	    !(len & (mtd->writesize - 1))) {
+		ret = msm_nand_read_cached(mtd, from, len, retlen, buf);
+		if (ret != -EAGAIN)
+			return ret;
+	}
+
 	ops.mode = MTD_OOB_PLACE;
 	ops.len = len;
 	ops.retlen = 0;
@@ -2254,6 +2468,7 @@ err_dma_map_oobbuf_failed:
 	if (ops->datbuf)
 		dma_unmap_page(chip->dev, data_dma_addr, ops->len,
 				DMA_TO_DEVICE);
+	msm_nand_ra_invalidate(chip);
 	if (err)
 		pr_err("msm_nand_write_oob %llx %x %x failed %d\n",
 		       to, ops->len, ops->ooblen, err);
@@ -2268,41 +2483,74 @@ err_dma_map_oobbuf_failed:
 	return err;
 }
 
+/* check the per codeword status words of an interleaved page program */
+static int msm_nand_prg_status_dualnandc(uint32_t *flash_status,
+					 unsigned cwperpage)
+{
+	unsigned n;
+
+	/* if any of the writes failed (0x10), or there was a
+	 * protection violation (0x100), or the program success
+	 * bit (0x80) is unset, we lose
+	 */
+	for (n = 0; n < cwperpage; n++) {
+		/* status word never written back by the data mover */
+		if (flash_status[n] == 0xeeeeeeee)
+			return -EIO;
+		if (flash_status[n] & 0x110)
+			return -EIO;
+		if (!(flash_status[n] & 0x80))
+			return -EIO;
+	}
+#if VERBOSE
+	for (n = 0; n < cwperpage; n++)
+		pr_info("%s: write flash_status[%d] = %x\n",
+			(n % 2) ? "NC10" : "NC01", n, flash_status[n]);
+#endif
+	return 0;
+}
+
 static int
 msm_nand_write_oob_dualnandc(struct mtd_info *mtd, loff_t to,
 				struct mtd_oob_ops *ops)
 {
 	struct msm_nand_chip *chip = mtd->priv;
 	struct {
-		dmov_s cmd[16 * 6 + 18];
-		unsigned cmdptr;
 		struct {
-			uint32_t cmd;
-			uint32_t nandc01_addr0;
-			uint32_t nandc10_addr0;
-			uint32_t nandc11_addr1;
-			uint32_t chipsel_cs0;
-			uint32_t chipsel_cs1;
-			uint32_t cfg0;
-			uint32_t cfg1;
-			uint32_t exec;
-			uint32_t ecccfg;
-			uint32_t ebi2_chip_select_cfg0;
-			uint32_t adm_mux_data_ack_req_nc01;
-			uint32_t adm_mux_cmd_ack_req_nc01;
-			uint32_t adm_mux_data_ack_req_nc10;
-			uint32_t adm_mux_cmd_ack_req_nc10;
-			uint32_t adm_default_mux;
-			uint32_t default_ebi2_chip_select_cfg0;
-			uint32_t nc01_flash_dev_cmd_vld;
-			uint32_t nc10_flash_dev_cmd0;
-			uint32_t nc01_flash_dev_cmd_vld_default;
-			uint32_t nc10_flash_dev_cmd0_default;
-			uint32_t flash_status[16];
-			uint32_t clrfstatus;
-			uint32_t clrrstatus;
-		} data;
+			dmov_s cmd[16 * 6 + 18];
+			unsigned cmdptr;
+			struct {
+				uint32_t cmd;
+				uint32_t nandc01_addr0;
+				uint32_t nandc10_addr0;
+				uint32_t nandc11_addr1;
+				uint32_t chipsel_cs0;
+				uint32_t chipsel_cs1;
+				uint32_t cfg0;
+				uint32_t cfg1;
+				uint32_t exec;
+				uint32_t ecccfg;
+				uint32_t ebi2_chip_select_cfg0;
+				uint32_t adm_mux_data_ack_req_nc01;
+				uint32_t adm_mux_cmd_ack_req_nc01;
+				uint32_t adm_mux_data_ack_req_nc10;
+				uint32_t adm_mux_cmd_ack_req_nc10;
+				uint32_t adm_default_mux;
+				uint32_t default_ebi2_chip_select_cfg0;
+				uint32_t nc01_flash_dev_cmd_vld;
+				uint32_t nc10_flash_dev_cmd0;
+				uint32_t nc01_flash_dev_cmd_vld_default;
+				uint32_t nc10_flash_dev_cmd0_default;
+				uint32_t flash_status[16];
+				uint32_t clrfstatus;
+				uint32_t clrrstatus;
+			} data;
+		} page[2];
 	} *dma_buffer;
+	typeof(&dma_buffer->page[0]) b;
+	struct msm_nand_dmov_req req[2];
+	unsigned queued = 0;
+	unsigned slot;
 	dmov_s *cmd;
 	unsigned n;
 	unsigned page = 0;
@@ -2404,70 +2652,80 @@ msm_nand_write_oob_dualnandc(struct mtd_info *mtd, loff_t to,
 	wait_event(chip->wait_queue, (dma_buffer =
 			msm_nand_get_dma_buffer(chip, sizeof(*dma_buffer))));
 
-	dma_buffer->data.ebi2_chip_select_cfg0 = 0x00000805;
-	dma_buffer->data.adm_mux_data_ack_req_nc01 = 0x00000A3C;
-	dma_buffer->data.adm_mux_cmd_ack_req_nc01  = 0x0000053C;
-	dma_buffer->data.adm_mux_data_ack_req_nc10 = 0x00000F28;
-	dma_buffer->data.adm_mux_cmd_ack_req_nc10  = 0x00000F14;
-	dma_buffer->data.adm_default_mux = 0x00000FC0;
-	dma_buffer->data.default_ebi2_chip_select_cfg0 = 0x00000801;
-	dma_buffer->data.nc01_flash_dev_cmd_vld = 0x9;
-	dma_buffer->data.nc10_flash_dev_cmd0 = 0x1085D060;
-	dma_buffer->data.nc01_flash_dev_cmd_vld_default = 0x1D;
-	dma_buffer->data.nc10_flash_dev_cmd0_default = 0x1080D060;
-	dma_buffer->data.clrfstatus = 0x00000020;
-	dma_buffer->data.clrrstatus = 0x000000C0;
+	for (n = 0; n < ARRAY_SIZE(dma_buffer->page); n++) {
+		b = &dma_buffer->page[n];
+		b->data.ebi2_chip_select_cfg0 = 0x00000805;
+		b->data.adm_mux_data_ack_req_nc01 = 0x00000A3C;
+		b->data.adm_mux_cmd_ack_req_nc01  = 0x0000053C;
+		b->data.adm_mux_data_ack_req_nc10 = 0x00000F28;
+		b->data.adm_mux_cmd_ack_req_nc10  = 0x00000F14;
+		b->data.adm_default_mux = 0x00000FC0;
+		b->data.default_ebi2_chip_select_cfg0 = 0x00000801;
+		b->data.nc01_flash_dev_cmd_vld = 0x9;
+		b->data.nc10_flash_dev_cmd0 = 0x1085D060;
+		b->data.nc01_flash_dev_cmd_vld_default = 0x1D;
+		b->data.nc10_flash_dev_cmd0_default = 0x1080D060;
+		b->data.clrfstatus = 0x00000020;
+		b->data.clrrstatus = 0x000000C0;
+	}
 
+	/* Keep the next page's command list queued on the data mover
+	 * behind the one being programmed, so both controllers go
+	 * straight on to the next page instead of idling while we wake
+	 * up and build it.
+	 */
+	err = 0;
 	while (page_count-- > 0) {
-		cmd = dma_buffer->cmd;
+		slot = (pages_written + queued) & 1;
+		b = &dma_buffer->page[slot];
+		cmd = b->cmd;
 
 		if (ops->mode != MTD_OOB_RAW) {
-			dma_buffer->data.cfg0 = ((chip->CFG0 & ~(7U << 6))
+			b->data.cfg0 = ((chip->CFG0 & ~(7U << 6))
 				| (1 << 4)) | ((((cwperpage >> 1)-1)) << 6);
-			dma_buffer->data.cfg1 = chip->CFG1;
+			b->data.cfg1 = chip->CFG1;
 		} else {
-			dma_buffer->data.cfg0 = ((MSM_NAND_CFG0_RAW &
+			b->data.cfg0 = ((MSM_NAND_CFG0_RAW &
 			~(7U << 6)) | (1<<4)) | (((cwperpage >> 1)-1) << 6);
-			dma_buffer->data.cfg1 = MSM_NAND_CFG1_RAW |
+			b->data.cfg1 = MSM_NAND_CFG1_RAW |
 					(chip->CFG1 & CFG1_WIDE_FLASH);
 		}
 
-		dma_buffer->data.cmd = MSM_NAND_CMD_PRG_PAGE;
-		dma_buffer->data.chipsel_cs0 = (1<<4) | 4;
-		dma_buffer->data.chipsel_cs1 = (1<<4) | 5;
+		b->data.cmd = MSM_NAND_CMD_PRG_PAGE;
+		b->data.chipsel_cs0 = (1<<4) | 4;
+		b->data.chipsel_cs1 = (1<<4) | 5;
 
 		/* GO bit for the EXEC register */
-		dma_buffer->data.exec = 1;
+		b->data.exec = 1;
 
 		if (!interleave_enable) {
-			dma_buffer->data.nandc01_addr0 = (page << 16) | 0x0;
-			dma_buffer->data.nandc10_addr0 = (page << 16) | 0x108;
+			b->data.nandc01_addr0 = (page << 16) | 0x0;
+			b->data.nandc10_addr0 = (page << 16) | 0x108;
 		} else {
-			dma_buffer->data.nandc01_addr0 =
-			dma_buffer->data.nandc10_addr0 = (page << 16) | 0x0;
+			b->data.nandc01_addr0 =
+			b->data.nandc10_addr0 = (page << 16) | 0x0;
 		}
 		/* ADDR1 */
-		dma_buffer->data.nandc11_addr1 = (page >> 16) & 0xff;
+		b->data.nandc11_addr1 = (page >> 16) & 0xff;
 
-		BUILD_BUG_ON(16 != ARRAY_SIZE(dma_buffer->data.flash_status));
+		BUILD_BUG_ON(16 != ARRAY_SIZE(b->data.flash_status));
 
 		for (n = 0; n < cwperpage; n++) {
 			/* status return words */
-			dma_buffer->data.flash_status[n] = 0xeeeeeeee;
+			b->data.flash_status[n] = 0xeeeeeeee;
 
 			if (n == 0) {
 				if (!interleave_enable) {
 					cmd->cmd = 0;
 					cmd->src = msm_virt_to_dma(chip,
-					&dma_buffer->
-					data.nc01_flash_dev_cmd_vld);
+					&b->data.nc01_flash_dev_cmd_vld);
 					cmd->dst = NC01(MSM_NAND_DEV_CMD_VLD);
 					cmd->len = 4;
 					cmd++;
 
 					cmd->cmd = 0;
 					cmd->src = msm_virt_to_dma(chip,
-					&dma_buffer->data.nc10_flash_dev_cmd0);
+					&b->data.nc10_flash_dev_cmd0);
 					cmd->dst = NC10(MSM_NAND_DEV_CMD0);
 					cmd->len = 4;
 					cmd++;
@@ -2477,14 +2735,14 @@ msm_nand_write_oob_dualnandc(struct mtd_info *mtd, loff_t to,
 					 */
 					cmd->cmd = 0;
 					cmd->src = msm_virt_to_dma(chip,
-					&dma_buffer->data.nandc11_addr1);
+					&b->data.nandc11_addr1);
 					cmd->dst = NC11(MSM_NAND_ADDR1);
 					cmd->len = 8;
 					cmd++;
 
 					cmd->cmd = 0;
 					cmd->src = msm_virt_to_dma(chip,
-						&dma_buffer->data.cfg0);
+						&b->data.cfg0);
 					cmd->dst = NC11(MSM_NAND_DEV0_CFG0);
 					cmd->len = 8;
 					cmd++;
@@ -2492,8 +2750,7 @@ msm_nand_write_oob_dualnandc(struct mtd_info *mtd, loff_t to,
 					/* enable CS1 */
 					cmd->cmd = 0;
 					cmd->src = msm_virt_to_dma(chip,
-					&dma_buffer->
-					data.ebi2_chip_select_cfg0);
+					&b->data.ebi2_chip_select_cfg0);
 					cmd->dst = EBI2_CHIP_SELECT_CFG0;
 					cmd->len = 4;
 					cmd++;
@@ -2501,7 +2758,7 @@ msm_nand_write_oob_dualnandc(struct mtd_info *mtd, loff_t to,
 					/* NC11 --> ADDR1 */
 					cmd->cmd = 0;
 					cmd->src = msm_virt_to_dma(chip,
-					&dma_buffer->data.nandc11_addr1);
+					&b->data.nandc11_addr1);
 					cmd->dst = NC11(MSM_NAND_ADDR1);
 					cmd->len = 4;
 					cmd++;
@@ -2509,7 +2766,7 @@ msm_nand_write_oob_dualnandc(struct mtd_info *mtd, loff_t to,
 					/* Enable CS0 for NC01 */
 					cmd->cmd = 0;
 					cmd->src = msm_virt_to_dma(chip,
-					&dma_buffer->data.chipsel_cs0);
+					&b->data.chipsel_cs0);
 					cmd->dst =
 					NC01(MSM_NAND_FLASH_CHIP_SELECT);
 					cmd->len = 4;
@@ -2518,7 +2775,7 @@ msm_nand_write_oob_dualnandc(struct mtd_info *mtd, loff_t to,
 					/* Enable CS1 for NC10 */
 					cmd->cmd = 0;
 					cmd->src = msm_virt_to_dma(chip,
-					&dma_buffer->data.chipsel_cs1);
+					&b->data.chipsel_cs1);
 					cmd->dst =
 					NC10(MSM_NAND_FLASH_CHIP_SELECT);
 					cmd->len = 4;
@@ -2527,7 +2784,7 @@ msm_nand_write_oob_dualnandc(struct mtd_info *mtd, loff_t to,
 					/* config DEV0_CFG0 & CFG1 for CS0 */
 					cmd->cmd = 0;
 					cmd->src = msm_virt_to_dma(chip,
-						&dma_buffer->data.cfg0);
+						&b->data.cfg0);
 					cmd->dst = NC01(MSM_NAND_DEV0_CFG0);
 					cmd->len = 8;
 					cmd++;
@@ -2535,16 +2792,16 @@ msm_nand_write_oob_dualnandc(struct mtd_info *mtd, loff_t to,
 					/* config DEV1_CFG0 & CFG1 for CS1 */
 					cmd->cmd = 0;
 					cmd->src = msm_virt_to_dma(chip,
-					&dma_buffer->data.cfg0);
+					&b->data.cfg0);
 					cmd->dst = NC10(MSM_NAND_DEV1_CFG0);
 					cmd->len = 8;
 					cmd++;
 				}
 
-				dma_buffer->data.ecccfg = chip->ecc_buf_cfg;
+				b->data.ecccfg = chip->ecc_buf_cfg;
 				cmd->cmd = 0;
 				cmd->src = msm_virt_to_dma(chip,
-						&dma_buffer->data.ecccfg);
+						&b->data.ecccfg);
 				cmd->dst = NC11(MSM_NAND_EBI2_ECC_BUF_CFG);
 				cmd->len = 4;
 				cmd++;
@@ -2552,7 +2809,7 @@ msm_nand_write_oob_dualnandc(struct mtd_info *mtd, loff_t to,
 				/* NC01 --> ADDR0 */
 				cmd->cmd = 0;
 				cmd->src = msm_virt_to_dma(chip,
-					&dma_buffer->data.nandc01_addr0);
+					&b->data.nandc01_addr0);
 				cmd->dst = NC01(MSM_NAND_ADDR0);
 				cmd->len = 4;
 				cmd++;
@@ -2560,7 +2817,7 @@ msm_nand_write_oob_dualnandc(struct mtd_info *mtd, loff_t to,
 				/* NC10 --> ADDR0 */
 				cmd->cmd = 0;
 				cmd->src = msm_virt_to_dma(chip,
-				&dma_buffer->data.nandc10_addr0);
+				&b->data.nandc10_addr0);
 				cmd->dst = NC10(MSM_NAND_ADDR0);
 				cmd->len = 4;
 				cmd++;
@@ -2570,7 +2827,7 @@ msm_nand_write_oob_dualnandc(struct mtd_info *mtd, loff_t to,
 				/* MASK CMD ACK/REQ --> NC10 (0xF14)*/
 				cmd->cmd = 0;
 				cmd->src = msm_virt_to_dma(chip,
-				&dma_buffer->data.adm_mux_cmd_ack_req_nc10);
+				&b->data.adm_mux_cmd_ack_req_nc10);
 				cmd->dst = EBI2_NAND_ADM_MUX;
 				cmd->len = 4;
 				cmd++;
@@ -2578,7 +2835,7 @@ msm_nand_write_oob_dualnandc(struct mtd_info *mtd, loff_t to,
 				/* CMD */
 				cmd->cmd = DST_CRCI_NAND_CMD;
 				cmd->src = msm_virt_to_dma(chip,
-						&dma_buffer->data.cmd);
+						&b->data.cmd);
 				cmd->dst = NC01(MSM_NAND_FLASH_CMD);
 				cmd->len = 4;
 				cmd++;
@@ -2586,7 +2843,7 @@ msm_nand_write_oob_dualnandc(struct mtd_info *mtd, loff_t to,
 				/* MASK CMD ACK/REQ --> NC01 (0x53C)*/
 				cmd->cmd = 0;
 				cmd->src = msm_virt_to_dma(chip,
-				&dma_buffer->data.adm_mux_cmd_ack_req_nc01);
+				&b->data.adm_mux_cmd_ack_req_nc01);
 				cmd->dst = EBI2_NAND_ADM_MUX;
 				cmd->len = 4;
 				cmd++;
@@ -2594,7 +2851,7 @@ msm_nand_write_oob_dualnandc(struct mtd_info *mtd, loff_t to,
 				/* CMD */
 				cmd->cmd = DST_CRCI_NAND_CMD;
 				cmd->src = msm_virt_to_dma(chip,
-						&dma_buffer->data.cmd);
+						&b->data.cmd);
 				cmd->dst = NC10(MSM_NAND_FLASH_CMD);
 				cmd->len = 4;
 				cmd++;
@@ -2648,7 +2905,7 @@ msm_nand_write_oob_dualnandc(struct mtd_info *mtd, loff_t to,
 				/* kick the NC01 execute register */
 				cmd->cmd = 0;
 				cmd->src = msm_virt_to_dma(chip,
-						&dma_buffer->data.exec);
+						&b->data.exec);
 				cmd->dst = NC01(MSM_NAND_EXEC_CMD);
 				cmd->len = 4;
 				cmd++;
@@ -2656,8 +2913,7 @@ msm_nand_write_oob_dualnandc(struct mtd_info *mtd, loff_t to,
 					/* MASK DATA ACK/REQ --> NC01 (0xA3C)*/
 					cmd->cmd = 0;
 					cmd->src = msm_virt_to_dma(chip,
-					&dma_buffer->
-					data.adm_mux_data_ack_req_nc01);
+					&b->data.adm_mux_data_ack_req_nc01);
 					cmd->dst = EBI2_NAND_ADM_MUX;
 					cmd->len = 4;
 					cmd++;
@@ -2668,7 +2924,7 @@ msm_nand_write_oob_dualnandc(struct mtd_info *mtd, loff_t to,
 					cmd->cmd = SRC_CRCI_NAND_DATA;
 					cmd->src = NC10(MSM_NAND_FLASH_STATUS);
 					cmd->dst = msm_virt_to_dma(chip,
-					&dma_buffer->data.flash_status[n-1]);
+					&b->data.flash_status[n-1]);
 					cmd->len = 4;
 					cmd++;
 				}
@@ -2676,7 +2932,7 @@ msm_nand_write_oob_dualnandc(struct mtd_info *mtd, loff_t to,
 				/* kick the execute register */
 				cmd->cmd = 0;
 				cmd->src =
-				msm_virt_to_dma(chip, &dma_buffer->data.exec);
+				msm_virt_to_dma(chip, &b->data.exec);
 				cmd->dst = NC10(MSM_NAND_EXEC_CMD);
 				cmd->len = 4;
 				cmd++;
@@ -2684,7 +2940,7 @@ msm_nand_write_oob_dualnandc(struct mtd_info *mtd, loff_t to,
 				/* MASK DATA ACK/REQ --> NC10 (0xF28)*/
 				cmd->cmd = 0;
 				cmd->src = msm_virt_to_dma(chip,
-				&dma_buffer->data.adm_mux_data_ack_req_nc10);
+				&b->data.adm_mux_data_ack_req_nc10);
 				cmd->dst = EBI2_NAND_ADM_MUX;
 				cmd->len = 4;
 				cmd++;
@@ -2695,7 +2951,7 @@ msm_nand_write_oob_dualnandc(struct mtd_info *mtd, loff_t to,
 				cmd->cmd = SRC_CRCI_NAND_DATA;
 				cmd->src = NC01(MSM_NAND_FLASH_STATUS);
 				cmd->dst = msm_virt_to_dma(chip,
-				&dma_buffer->data.flash_status[n-1]);
+				&b->data.flash_status[n-1]);
 				cmd->len = 4;
 				cmd++;
 			}
@@ -2704,7 +2960,7 @@ msm_nand_write_oob_dualnandc(struct mtd_info *mtd, loff_t to,
 		/* MASK DATA ACK/REQ --> NC01 (0xA3C)*/
 		cmd->cmd = 0;
 		cmd->src = msm_virt_to_dma(chip,
-				&dma_buffer->data.adm_mux_data_ack_req_nc01);
+				&b->data.adm_mux_data_ack_req_nc01);
 		cmd->dst = EBI2_NAND_ADM_MUX;
 		cmd->len = 4;
 		cmd++;
@@ -2716,18 +2972,18 @@ msm_nand_write_oob_dualnandc(struct mtd_info *mtd, loff_t to,
 		cmd->cmd = SRC_CRCI_NAND_DATA;
 		cmd->src = NC10(MSM_NAND_FLASH_STATUS);
 		cmd->dst = msm_virt_to_dma(chip,
-			     &dma_buffer->data.flash_status[n-1]);
+			     &b->data.flash_status[n-1]);
 		cmd->len = 4;
 		cmd++;
 
 		cmd->cmd = 0;
-		cmd->src = msm_virt_to_dma(chip, &dma_buffer->data.clrfstatus);
+		cmd->src = msm_virt_to_dma(chip, &b->data.clrfstatus);
 		cmd->dst = NC11(MSM_NAND_FLASH_STATUS);
 		cmd->len = 4;
 		cmd++;
 
 		cmd->cmd = 0;
-		cmd->src = msm_virt_to_dma(chip, &dma_buffer->data.clrrstatus);
+		cmd->src = msm_virt_to_dma(chip, &b->data.clrrstatus);
 		cmd->dst = NC11(MSM_NAND_READ_STATUS);
 		cmd->len = 4;
 		cmd++;
@@ -2735,7 +2991,7 @@ msm_nand_write_oob_dualnandc(struct mtd_info *mtd, loff_t to,
 		/* MASK DATA ACK/REQ --> NC01 (0xFC0)*/
 		cmd->cmd = 0;
 		cmd->src = msm_virt_to_dma(chip,
-				&dma_buffer->data.adm_default_mux);
+				&b->data.adm_default_mux);
 		cmd->dst = EBI2_NAND_ADM_MUX;
 		cmd->len = 4;
 		cmd++;
@@ -2744,14 +3000,14 @@ msm_nand_write_oob_dualnandc(struct mtd_info *mtd, loff_t to,
 			/* setting to defalut values back */
 			cmd->cmd = 0;
 			cmd->src = msm_virt_to_dma(chip,
-			&dma_buffer->data.nc01_flash_dev_cmd_vld_default);
+			&b->data.nc01_flash_dev_cmd_vld_default);
 			cmd->dst = NC01(MSM_NAND_DEV_CMD_VLD);
 			cmd->len = 4;
 			cmd++;
 
 			cmd->cmd = 0;
 			cmd->src = msm_virt_to_dma(chip,
-			&dma_buffer->data.nc10_flash_dev_cmd0_default);
+			&b->data.nc10_flash_dev_cmd0_default);
 			cmd->dst = NC10(MSM_NAND_DEV_CMD0);
 			cmd->len = 4;
 			cmd++;
@@ -2759,55 +3015,52 @@ msm_nand_write_oob_dualnandc(struct mtd_info *mtd, loff_t to,
 			/* disable CS1 */
 			cmd->cmd = 0;
 			cmd->src = msm_virt_to_dma(chip,
-			&dma_buffer->data.default_ebi2_chip_select_cfg0);
+			&b->data.default_ebi2_chip_select_cfg0);
 			cmd->dst = EBI2_CHIP_SELECT_CFG0;
 			cmd->len = 4;
 			cmd++;
 		}
 
-		dma_buffer->cmd[0].cmd |= CMD_OCB;
+		b->cmd[0].cmd |= CMD_OCB;
 		cmd[-1].cmd |= CMD_OCU | CMD_LC;
-		BUILD_BUG_ON(16 * 6 + 18 != ARRAY_SIZE(dma_buffer->cmd));
-		BUG_ON(cmd - dma_buffer->cmd > ARRAY_SIZE(dma_buffer->cmd));
-		dma_buffer->cmdptr =
-		((msm_virt_to_dma(chip, dma_buffer->cmd) >> 3) | CMD_PTR_LP);
+		BUILD_BUG_ON(16 * 6 + 18 != ARRAY_SIZE(b->cmd));
+		BUG_ON(cmd - b->cmd > ARRAY_SIZE(b->cmd));
+		b->cmdptr =
+		((msm_virt_to_dma(chip, b->cmd) >> 3) | CMD_PTR_LP);
 
-		dsb();
-		msm_dmov_exec_cmd(chip->dma_channel, crci_mask,
-			DMOV_CMD_PTR_LIST | DMOV_CMD_ADDR(
-				msm_virt_to_dma(chip, &dma_buffer->cmdptr)));
-		dsb();
+		msm_nand_dmov_enqueue(chip, &req[slot], &b->cmdptr);
+		queued++;
+		page++;
 
-		/* if any of the writes failed (0x10), or there was a
-		 * protection violation (0x100), or the program success
-		 * bit (0x80) is unset, we lose
-		 */
-		err = 0;
-		for (n = 0; n < cwperpage; n++) {
-			if (dma_buffer->data.flash_status[n] & 0x110) {
-				err = -EIO;
-				break;
-			}
-			if (!(dma_buffer->data.flash_status[n] & 0x80)) {
-				err = -EIO;
-				break;
-			}
-		}
-#if VERBOSE
-	for (n = 0; n < cwperpage; n++) {
-		if (n%2) {
-			pr_info("NC10: write pg %d: flash_status[%d] = %x\n",
-				page, n, dma_buffer->data.flash_status[n]);
-		} else {
-			pr_info("NC01: write pg %d: flash_status[%d] = %x\n",
-				page, n, dma_buffer->data.flash_status[n]);
-		}
-	}
-#endif
+		if (page_count > 0 && queued < ARRAY_SIZE(req))
+			continue;
+
+		/* wait for the oldest page still queued */
+		slot = pages_written & 1;
+		err = msm_nand_dmov_wait(&req[slot]);
+		queued--;
+		if (!err)
+			err = msm_nand_prg_status_dualnandc(
+				dma_buffer->page[slot].data.flash_status,
+				cwperpage);
 		if (err)
 			break;
 		pages_written++;
-		page++;
+	}
+	if (queued) {
+		/* the last page, or the one queued behind a failed page */
+		slot = (err ? pages_written + 1 : pages_written) & 1;
+		if (err)
+			msm_nand_dmov_wait(&req[slot]);
+		else
+			err = msm_nand_dmov_wait(&req[slot]);
+		if (!err) {
+			err = msm_nand_prg_status_dualnandc(
+				dma_buffer->page[slot].data.flash_status,
+				cwperpage);
+			if (!err)
+				pages_written++;
+		}
 	}
 	if (ops->mode != MTD_OOB_RAW)
 		ops->retlen = mtd->writesize * pages_written;
@@ -2975,6 +3228,7 @@ msm_nand_erase(struct mtd_info *mtd, struct erase_info *instr)
 		err = 0;
 
 	msm_nand_release_dma_buffer(chip, dma_buffer, sizeof(*dma_buffer));
+	msm_nand_ra_invalidate(chip);
 	if (err) {
 		pr_err("%s: erase failed, 0x%llx\n", __func__, instr->addr);
 		instr->fail_addr = instr->addr;
@@ -3077,6 +3331,10 @@ msm_nand_erase_dualnandc(struct mtd_info *mtd, struct erase_info *instr)
 	cmd->len = 4;
 	cmd++;
 
+	/* the CS0 status is read before the CS1 erase is started; this
+	 * is the only mux/CRCI order validated for dual controller erase
+	 */
+
 	/* erase CS0 block now !!! */
 	/* 0xF14 */
 	cmd->cmd = 0;
@@ -3143,6 +3401,7 @@ msm_nand_erase_dualnandc(struct mtd_info *mtd, struct erase_info *instr)
 	cmd->src = msm_virt_to_dma(chip, &dma_buffer->data.cfg0);
 	cmd->dst = NC10(MSM_NAND_DEV1_CFG0);
 	cmd->len = 8;
+	cmd++;
 
 	cmd->cmd = 0;
 	cmd->src = msm_virt_to_dma(chip, &dma_buffer->data.exec);
@@ -6878,6 +7137,8 @@ no_dual_nand_ctlr_support:
 	info->msm_nand.dev = &pdev->dev;
 
 	init_waitqueue_head(&info->msm_nand.wait_queue);
+	mutex_init(&info->msm_nand.ra_lock);
+	info->msm_nand.ra_next = -1;
 
 	info->msm_nand.dma_channel = res->start;
 	pr_info("%s: dmac 0x%x\n", __func__, info->msm_nand.dma_channel);
@@ -6925,6 +7186,7 @@ out_free_dma_buffer:
 	dma_free_coherent(NULL, MSM_NAND_DMA_BUFFER_SIZE,
 			info->msm_nand.dma_buffer,
 			info->msm_nand.dma_addr);
+	kfree(info->msm_nand.ra_buf);
 out_free_info:
 	kfree(info);
 
@@ -6949,6 +7211,7 @@ static int __devexit msm_nand_remove(struct platform_device *pdev)
 		dma_free_coherent(NULL, MSM_NAND_DMA_BUFFER_SIZE,
 				  info->msm_nand.dma_buffer,
 				  info->msm_nand.dma_addr);
+		kfree(info->msm_nand.ra_buf);
 		kfree(info);
 	}
 
@@ -32,6 +32,7 @@ enum {
 	BINDER_TYPE_HANDLE	= B_PACK_CHARS('s', 'h', '*', B_TYPE_LARGE),
 	BINDER_TYPE_WEAK_HANDLE	= B_PACK_CHARS('w', 'h', '*', B_TYPE_LARGE),
 	BINDER_TYPE_FD		= B_PACK_CHARS('f', 'd', '*', B_TYPE_LARGE),
+	BINDER_TYPE_PAGES	= B_PACK_CHARS('p', 'g', '*', B_TYPE_LARGE),
 };
 
 enum {
@@ -61,6 +62,22 @@ struct flat_binder_object {
 	void			*cookie;
 };
 
+/*
+ * A page aligned region of the sender's address space handed over
+ * with a TF_PAGES transaction. It takes the place of a
+ * flat_binder_object in the data and has the same size. Whole pages
+ * are placed in the target's buffer: pages of shared mappings (ashmem)
+ * are mapped as they are, so the sender must not modify them until the
+ * target frees the buffer; other pages are copied. The driver rewrites
+ * 'buffer' to the address of the region in the target.
+ */
+struct binder_pages_object {
+	unsigned long		type;	/* BINDER_TYPE_PAGES */
+	unsigned long		flags;
+	void			*buffer;
+	size_t			length;
+};
+
 /*
  * On 64-bit platforms where user code may run in 32-bits the driver must
  * translate the buffer (and local binder) addresses apropriately.
@@ -112,6 +129,7 @@ enum transaction_flags {
 	TF_ROOT_OBJECT	= 0x04,	/* contents are the component's root object */
 	TF_STATUS_CODE	= 0x08,	/* contents are a 32-bit status code */
 	TF_ACCEPT_FDS	= 0x10,	/* allow replies with file descriptors */
+	TF_PAGES	= 0x20,	/* contains BINDER_TYPE_PAGES objects */
 };
 
 struct binder_transaction_data {
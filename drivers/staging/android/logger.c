@@ -24,6 +24,7 @@
 #include <linux/uaccess.h>
 #include <linux/poll.h>
 #include <linux/slab.h>
+#include <linux/spinlock.h>
 #include <linux/time.h>
 #include "logger.h"
 
@@ -34,14 +35,19 @@
  *
  * This structure lives from module insertion until module removal, so it does
  * not need additional reference counting. The structure is protected by the
- * mutex 'mutex'.
+ * spinlock 'lock'.
+ *
+ * Nothing that can fault or sleep is done under 'lock': writers copy their
+ * payload in from user-space before taking it and readers copy their entry
+ * out to user-space after dropping it, so the lock only ever covers a memcpy
+ * of at most LOGGER_ENTRY_MAX_LEN bytes.
  */
 struct logger_log {
 	unsigned char 		*buffer;/* the ring buffer itself */
 	struct miscdevice	misc;	/* misc device representing the log */
 	wait_queue_head_t	wq;	/* wait queue for readers */
 	struct list_head	readers; /* this log's readers */
-	struct mutex		mutex;	/* mutex protecting buffer */
+	spinlock_t		lock;	/* lock protecting buffer */
 	size_t			w_off;	/* current write head offset */
 	size_t			head;	/* new readers start here */
 	size_t			size;	/* size of the log */
@@ -51,14 +57,23 @@ struct logger_log {
  * struct logger_reader - a logging device open for reading
  *
  * This object lives from open to release, so we don't need additional
- * reference counting. The structure is protected by log->mutex.
+ * reference counting. 'r_off' is protected by log->lock; 'mutex' serializes
+ * readers sharing the same file, and with it the use of 'buf'.
  */
 struct logger_reader {
 	struct logger_log	*log;	/* associated log */
 	struct list_head	list;	/* entry in logger_log's list */
 	size_t			r_off;	/* current read head offset */
+	struct mutex		mutex;	/* serializes read() on this reader */
+	unsigned char		*buf;	/* bounce buffer of one entry */
 };
 
+/*
+ * Writes with a payload up to this size are staged on the stack; larger ones
+ * fall back to kmalloc.
+ */
+#define LOGGER_STACK_PAYLOAD	256
+
 /* logger_offset - returns index 'n' into the log via (optimized) modulus */
 #define logger_offset(n)	((n) & (log->size - 1))
 
@@ -89,7 +104,7 @@ static inline struct logger_log *file_get_log(struct file *file)
  * get_entry_len - Grabs the length of the payload of the next entry starting
  * from 'off'.
  *
- * Caller needs to hold log->mutex.
+ * Caller needs to hold log->lock.
  */
 static __u32 get_entry_len(struct logger_log *log, size_t off)
 {
@@ -108,15 +123,14 @@ static __u32 get_entry_len(struct logger_log *log, size_t off)
 }
 
 /*
- * do_read_log_to_user - reads exactly 'count' bytes from 'log' into the
- * user-space buffer 'buf'. Returns 'count' on success.
+ * do_read_log - reads exactly 'count' bytes from 'log' into the reader's
+ * bounce buffer and advances the read head past them.
  *
- * Caller must hold log->mutex.
+ * Caller must hold log->lock.
  */
-static ssize_t do_read_log_to_user(struct logger_log *log,
-				   struct logger_reader *reader,
-				   char __user *buf,
-				   size_t count)
+static void do_read_log(struct logger_log *log,
+			struct logger_reader *reader,
+			size_t count)
 {
 	size_t len;
 
@@ -126,20 +140,16 @@ static ssize_t do_read_log_to_user(struct logger_log *log,
 	 * the log, whichever comes first.
 	 */
 	len = min(count, log->size - reader->r_off);
-	if (copy_to_user(buf, log->buffer + reader->r_off, len))
-		return -EFAULT;
+	memcpy(reader->buf, log->buffer + reader->r_off, len);
 
 	/*
 	 * Second, we read any remaining bytes, starting back at the head of
 	 * the log.
 	 */
 	if (count != len)
-		if (copy_to_user(buf + len, log->buffer, count - len))
-			return -EFAULT;
+		memcpy(reader->buf + len, log->buffer, count - len);
 
 	reader->r_off = logger_offset(reader->r_off + count);
-
-	return count;
 }
 
 /*
@@ -166,9 +176,9 @@ start:
 	while (1) {
 		prepare_to_wait(&log->wq, &wait, TASK_INTERRUPTIBLE);
 
-		mutex_lock(&log->mutex);
+		spin_lock(&log->lock);
 		ret = (log->w_off == reader->r_off);
-		mutex_unlock(&log->mutex);
+		spin_unlock(&log->lock);
 		if (!ret)
 			break;
 
@@ -189,26 +199,34 @@ start:
 	if (ret)
 		return ret;
 
-	mutex_lock(&log->mutex);
+	mutex_lock(&reader->mutex);
+	spin_lock(&log->lock);
 
 	/* is there still something to read or did we race? */
 	if (unlikely(log->w_off == reader->r_off)) {
-		mutex_unlock(&log->mutex);
+		spin_unlock(&log->lock);
+		mutex_unlock(&reader->mutex);
 		goto start;
 	}
 
 	/* get the size of the next entry */
 	ret = get_entry_len(log, reader->r_off);
 	if (count < ret) {
+		spin_unlock(&log->lock);
 		ret = -EINVAL;
 		goto out;
 	}
 
-	/* get exactly one entry from the log */
-	ret = do_read_log_to_user(log, reader, buf, ret);
+	/* snapshot exactly one entry from the log */
+	do_read_log(log, reader, ret);
+	spin_unlock(&log->lock);
+
+	/* the entry is ours now, so writers may lap us while we copy it out */
+	if (copy_to_user(buf, reader->buf, ret))
+		ret = -EFAULT;
 
 out:
-	mutex_unlock(&log->mutex);
+	mutex_unlock(&reader->mutex);
 
 	return ret;
 }
@@ -217,7 +235,7 @@ out:
  * get_next_entry - return the offset of the first valid entry at least 'len'
  * bytes after 'off'.
  *
- * Caller must hold log->mutex.
+ * Caller must hold log->lock.
  */
 static size_t get_next_entry(struct logger_log *log, size_t off, size_t len)
 {
@@ -255,7 +273,7 @@ static inline int clock_interval(size_t a, size_t b, size_t c)
  * We do this by "pulling forward" the readers and start head to the first
  * entry after the new write head.
  *
- * The caller needs to hold log->mutex.
+ * The caller needs to hold log->lock.
  */
 static void fix_up_readers(struct logger_log *log, size_t len)
 {
@@ -274,7 +292,7 @@ static void fix_up_readers(struct logger_log *log, size_t len)
 /*
  * do_write_log - writes 'len' bytes from 'buf' to 'log'
  *
- * The caller needs to hold log->mutex.
+ * The caller needs to hold log->lock.
  */
 static void do_write_log(struct logger_log *log, const void *buf, size_t count)
 {
@@ -291,44 +309,54 @@ static void do_write_log(struct logger_log *log, const void *buf, size_t count)
 }
 
 /*
- * do_write_log_user - writes 'len' bytes from the user-space buffer 'buf' to
- * the log 'log'
+ * copy_payload_from_user - gathers up to 'count' bytes from the user-space
+ * vector 'iov' into the kernel buffer 'buf'.
  *
- * The caller needs to hold log->mutex.
+ * Called without log->lock held, as the copy may fault.
  *
- * Returns 'count' on success, negative error code on failure.
+ * Returns the number of bytes copied on success, negative error code on
+ * failure.
  */
-static ssize_t do_write_log_from_user(struct logger_log *log,
-				      const void __user *buf, size_t count)
+static ssize_t copy_payload_from_user(unsigned char *buf,
+				      const struct iovec *iov,
+				      unsigned long nr_segs, size_t count)
 {
-	size_t len;
+	ssize_t ret = 0;
 
-	len = min(count, log->size - log->w_off);
-	if (len && copy_from_user(log->buffer + log->w_off, buf, len))
-		return -EFAULT;
+	while (nr_segs-- > 0) {
+		size_t len;
 
-	if (count != len)
-		if (copy_from_user(log->buffer, buf + len, count - len))
+		/* figure out how much of this vector we can keep */
+		len = min_t(size_t, iov->iov_len, count - ret);
+
+		/* stage this segment's payload */
+		if (len && copy_from_user(buf + ret, iov->iov_base, len))
 			return -EFAULT;
 
-	log->w_off = logger_offset(log->w_off + count);
+		iov++;
+		ret += len;
+	}
 
-	return count;
+	return ret;
 }
 
 /*
  * logger_aio_write - our write method, implementing support for write(),
  * writev(), and aio_write(). Writes are our fast path, and we try to optimize
  * them above all else.
+ *
+ * The payload is staged in a kernel buffer first, so log->lock is held only
+ * across the copy into the ring and writers never contend on page faults.
  */
 ssize_t logger_aio_write(struct kiocb *iocb, const struct iovec *iov,
 			 unsigned long nr_segs, loff_t ppos)
 {
 	struct logger_log *log = file_get_log(iocb->ki_filp);
-	size_t orig = log->w_off;
+	unsigned char stack_payload[LOGGER_STACK_PAYLOAD];
+	unsigned char *payload = stack_payload;
 	struct logger_entry header;
 	struct timespec now;
-	ssize_t ret = 0;
+	ssize_t ret;
 
 	now = current_kernel_time();
 
@@ -342,42 +370,37 @@ ssize_t logger_aio_write(struct kiocb *iocb, const struct iovec *iov,
 	if (unlikely(!header.len))
 		return 0;
 
-	mutex_lock(&log->mutex);
+	if (header.len > sizeof(stack_payload)) {
+		payload = kmalloc(header.len, GFP_KERNEL);
+		if (unlikely(!payload))
+			return -ENOMEM;
+	}
+
+	ret = copy_payload_from_user(payload, iov, nr_segs, header.len);
+	if (unlikely(ret < 0))
+		goto out;
+	header.len = ret;
+
+	spin_lock(&log->lock);
 
 	/*
 	 * Fix up any readers, pulling them forward to the first readable
-	 * entry after (what will be) the new write offset. We do this now
-	 * because if we partially fail, we can end up with clobbered log
-	 * entries that encroach on readable buffer.
+	 * entry after (what will be) the new write offset.
 	 */
 	fix_up_readers(log, sizeof(struct logger_entry) + header.len);
 
 	do_write_log(log, &header, sizeof(struct logger_entry));
+	do_write_log(log, payload, header.len);
 
-	while (nr_segs-- > 0) {
-		size_t len;
-		ssize_t nr;
-
-		/* figure out how much of this vector we can keep */
-		len = min_t(size_t, iov->iov_len, header.len - ret);
-
-		/* write out this segment's payload */
-		nr = do_write_log_from_user(log, iov->iov_base, len);
-		if (unlikely(nr < 0)) {
-			log->w_off = orig;
-			mutex_unlock(&log->mutex);
-			return nr;
-		}
-
-		iov++;
-		ret += nr;
-	}
-
-	mutex_unlock(&log->mutex);
+	spin_unlock(&log->lock);
 
 	/* wake up any blocked readers */
 	wake_up_interruptible(&log->wq);
 
+out:
+	if (payload != stack_payload)
+		kfree(payload);
+
 	return ret;
 }
 
@@ -408,13 +431,20 @@ static int logger_open(struct inode *inode, struct file *file)
 		if (!reader)
 			return -ENOMEM;
 
+		reader->buf = kmalloc(LOGGER_ENTRY_MAX_LEN, GFP_KERNEL);
+		if (!reader->buf) {
+			kfree(reader);
+			return -ENOMEM;
+		}
+
 		reader->log = log;
+		mutex_init(&reader->mutex);
 		INIT_LIST_HEAD(&reader->list);
 
-		mutex_lock(&log->mutex);
+		spin_lock(&log->lock);
 		reader->r_off = log->head;
 		list_add_tail(&reader->list, &log->readers);
-		mutex_unlock(&log->mutex);
+		spin_unlock(&log->lock);
 
 		file->private_data = reader;
 	} else
@@ -432,7 +462,12 @@ static int logger_release(struct inode *ignored, struct file *file)
 {
 	if (file->f_mode & FMODE_READ) {
 		struct logger_reader *reader = file->private_data;
+		struct logger_log *log = reader->log;
+
+		spin_lock(&log->lock);
 		list_del(&reader->list);
+		spin_unlock(&log->lock);
+		kfree(reader->buf);
 		kfree(reader);
 	}
 
@@ -462,10 +497,10 @@ static unsigned int logger_poll(struct file *file, poll_table *wait)
 
 	poll_wait(file, &log->wq, wait);
 
-	mutex_lock(&log->mutex);
+	spin_lock(&log->lock);
 	if (log->w_off != reader->r_off)
 		ret |= POLLIN | POLLRDNORM;
-	mutex_unlock(&log->mutex);
+	spin_unlock(&log->lock);
 
 	return ret;
 }
@@ -476,7 +511,7 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 	struct logger_reader *reader;
 	long ret = -ENOTTY;
 
-	mutex_lock(&log->mutex);
+	spin_lock(&log->lock);
 
 	switch (cmd) {
 	case LOGGER_GET_LOG_BUF_SIZE:
@@ -516,7 +551,7 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 		break;
 	}
 
-	mutex_unlock(&log->mutex);
+	spin_unlock(&log->lock);
 
 	return ret;
 }
@@ -549,7 +584,7 @@ static struct logger_log VAR = { \
 	}, \
 	.wq = __WAIT_QUEUE_HEAD_INITIALIZER(VAR .wq), \
 	.readers = LIST_HEAD_INIT(VAR .readers), \
-	.mutex = __MUTEX_INITIALIZER(VAR .mutex), \
+	.lock = __SPIN_LOCK_UNLOCKED(VAR .lock), \
 	.w_off = 0, \
 	.head = 0, \
 	.size = SIZE, \
@@ -16,6 +16,14 @@
  * percentage of the cached memory is locked this can be very inaccurate
  * and processes may not get killed until the normal oom killer is triggered.
  *
+ * The same thresholds drive /dev/mem_notify, which lets user-space act before
+ * the shrinker does. A read() returns the oom_adj level (as an int) that the
+ * driver would currently kill at, or OOM_ADJUST_MAX + 1 when free memory is
+ * above every threshold. poll() reports POLLIN whenever that level has
+ * changed since the last read() on the file, and a blocking read() waits for
+ * such a change. The level is re-evaluated each time vmscan calls into the
+ * shrinker and on every read().
+ *
  * Copyright (C) 2007-2008 Google, Inc.
  *
  * This software is licensed under the terms of the GNU General Public
@@ -35,6 +43,15 @@
 #include <linux/oom.h>
 #include <linux/sched.h>
 #include <linux/notifier.h>
+#include <linux/debugfs.h>
+#include <linux/ktime.h>
+#include <linux/miscdevice.h>
+#include <linux/poll.h>
+#include <linux/seq_file.h>
+#include <linux/uaccess.h>
+
+#define CREATE_TRACE_POINTS
+#include "lowmemorykiller_trace.h"
 
 static uint32_t lowmem_debug_level = 2;
 static int lowmem_adj[6] = {
@@ -54,6 +71,65 @@ static int lowmem_minfree_size = 4;
 
 static struct task_struct *lowmem_deathpending;
 
+/*
+ * Thread group leaders by oom_adj, so that lowmem_shrink only looks at
+ * the tasks it may kill. Changed under the tasklist_lock write lock and
+ * read under its read lock, like the task list itself.
+ */
+#define LOWMEM_BUCKETS (OOM_ADJUST_MAX - OOM_DISABLE + 1)
+static struct list_head lowmem_buckets[LOWMEM_BUCKETS];
+static int lowmem_index_ready;
+
+static struct list_head *lowmem_bucket(int oom_adj)
+{
+	oom_adj = clamp(oom_adj, OOM_DISABLE, OOM_ADJUST_MAX);
+	return &lowmem_buckets[oom_adj - OOM_DISABLE];
+}
+
+void lowmem_index_add(struct task_struct *p)
+{
+	if (lowmem_index_ready)
+		list_add_tail(&p->lowmem_node,
+			      lowmem_bucket(p->signal->oom_adj));
+}
+
+void lowmem_index_del(struct task_struct *p)
+{
+	list_del_init(&p->lowmem_node);
+}
+
+/* exec by a thread other than the leader makes it the new leader */
+void lowmem_index_replace(struct task_struct *old, struct task_struct *new)
+{
+	if (!list_empty(&old->lowmem_node))
+		list_replace_init(&old->lowmem_node, &new->lowmem_node);
+}
+
+void lowmem_index_update(struct task_struct *p)
+{
+	write_lock_irq(&tasklist_lock);
+	/* once unhashed, group_leader may already be gone */
+	if (pid_alive(p)) {
+		p = p->group_leader;
+		if (!list_empty(&p->lowmem_node))
+			list_move_tail(&p->lowmem_node,
+				       lowmem_bucket(p->signal->oom_adj));
+	}
+	write_unlock_irq(&tasklist_lock);
+}
+
+/*
+ * Selection statistics, exported through debugfs. Shrinkers may run
+ * concurrently so these are updated without locking and are approximate.
+ */
+static struct {
+	unsigned long scans;
+	unsigned long tasks_scanned;
+	unsigned long kills;
+	u64 scan_ns;
+	u64 max_scan_ns;
+} lowmem_stats;
+
 #define lowmem_print(level, x...)			\
 	do {						\
 		if (lowmem_debug_level >= (level))	\
@@ -86,6 +162,39 @@ task_notify_func(struct notifier_block *self, unsigned long val, void *data)
 	return NOTIFY_OK;
 }
 
+/*
+ * lowmem_min_adj - the lowest oom_adj that is killable with 'other_file'
+ * pages of cache left, or OOM_ADJUST_MAX + 1 if none is.
+ */
+static int lowmem_min_adj(int other_file)
+{
+	int i;
+	int array_size = ARRAY_SIZE(lowmem_adj);
+
+	if (lowmem_adj_size < array_size)
+		array_size = lowmem_adj_size;
+	if (lowmem_minfree_size < array_size)
+		array_size = lowmem_minfree_size;
+	for (i = 0; i < array_size; i++) {
+		if (other_file < lowmem_minfree[i])
+			return lowmem_adj[i];
+	}
+	return OOM_ADJUST_MAX + 1;
+}
+
+static DECLARE_WAIT_QUEUE_HEAD(lowmem_notify_wait);
+static atomic_t lowmem_notify_users = ATOMIC_INIT(0);
+static int lowmem_notify_level = OOM_ADJUST_MAX + 1;
+
+static void lowmem_notify_update(int min_adj)
+{
+	if (min_adj == lowmem_notify_level)
+		return;
+	lowmem_notify_level = min_adj;
+	lowmem_print(3, "lowmem_notify level %d\n", min_adj);
+	wake_up_interruptible(&lowmem_notify_wait);
+}
+
 static int lowmem_shrink(struct shrinker *shrink,
 				int nr_to_scan, gfp_t gfp_mask)
 {
@@ -93,14 +202,21 @@ static int lowmem_shrink(struct shrinker *shrink,
 	struct task_struct *selected = NULL;
 	int rem = 0;
 	int tasksize;
-	int i;
-	int min_adj = OOM_ADJUST_MAX + 1;
+	int min_adj;
 	int selected_tasksize = 0;
 	int selected_oom_adj;
-	int array_size = ARRAY_SIZE(lowmem_adj);
+	int oom_adj;
+	int scanned = 0;
+	ktime_t start;
+	u64 scan_ns;
 	int other_free = global_page_state(NR_FREE_PAGES);
 	int other_file = global_page_state(NR_FILE_PAGES);
 
+	/* mem_notify has no timer of its own, it follows the shrinker */
+	min_adj = lowmem_min_adj(other_file);
+	if (atomic_read(&lowmem_notify_users))
+		lowmem_notify_update(min_adj);
+
 	/*
 	 * If we already have a death outstanding, then
 	 * bail out right away; indicating to vmscan
@@ -111,16 +227,6 @@ static int lowmem_shrink(struct shrinker *shrink,
 	if (lowmem_deathpending)
 		return 0;
 
-	if (lowmem_adj_size < array_size)
-		array_size = lowmem_adj_size;
-	if (lowmem_minfree_size < array_size)
-		array_size = lowmem_minfree_size;
-	for (i = 0; i < array_size; i++) {
-		if (other_file < lowmem_minfree[i]) {
-			min_adj = lowmem_adj[i];
-			break;
-		}
-	}
 	if (nr_to_scan > 0)
 		lowmem_print(3, "lowmem_shrink %d, %x, ofree %d %d, ma %d\n",
 			     nr_to_scan, gfp_mask, other_free, other_file,
@@ -136,40 +242,35 @@ static int lowmem_shrink(struct shrinker *shrink,
 	}
 	selected_oom_adj = min_adj;
 
+	start = ktime_get();
 	read_lock(&tasklist_lock);
-	for_each_process(p) {
-		struct mm_struct *mm;
-		struct signal_struct *sig;
-		int oom_adj;
-
-		task_lock(p);
-		mm = p->mm;
-		sig = p->signal;
-		if (!mm || !sig) {
-			task_unlock(p);
-			continue;
-		}
-		oom_adj = sig->oom_adj;
-		if (oom_adj < min_adj) {
-			task_unlock(p);
-			continue;
-		}
-		tasksize = get_mm_rss(mm);
-		task_unlock(p);
-		if (tasksize <= 0)
-			continue;
-		if (selected) {
-			if (oom_adj < selected_oom_adj)
+	/*
+	 * Highest oom_adj first, so the first bucket with a task that has
+	 * an mm holds the victim: its largest task.
+	 */
+	for (oom_adj = OOM_ADJUST_MAX;
+	     oom_adj >= max(min_adj, OOM_DISABLE) && !selected; oom_adj--) {
+		list_for_each_entry(p, lowmem_bucket(oom_adj), lowmem_node) {
+			struct mm_struct *mm;
+
+			scanned++;
+			task_lock(p);
+			mm = p->mm;
+			if (!mm) {
+				task_unlock(p);
 				continue;
-			if (oom_adj == selected_oom_adj &&
-			    tasksize <= selected_tasksize)
+			}
+			tasksize = get_mm_rss(mm);
+			task_unlock(p);
+			if (tasksize <= selected_tasksize)
 				continue;
+			selected = p;
+			selected_tasksize = tasksize;
+			selected_oom_adj = oom_adj;
+			lowmem_print(2, "select %d (%s), adj %d, size %d, "
+				     "to kill\n", p->pid, p->comm, oom_adj,
+				     tasksize);
 		}
-		selected = p;
-		selected_tasksize = tasksize;
-		selected_oom_adj = oom_adj;
-		lowmem_print(2, "select %d (%s), adj %d, size %d, to kill\n",
-			     p->pid, p->comm, oom_adj, tasksize);
 	}
 	if (selected) {
 		lowmem_print(1, "send sigkill to %d (%s), adj %d, size %d\n",
@@ -179,10 +280,20 @@ static int lowmem_shrink(struct shrinker *shrink,
 		task_free_register(&task_nb);
 		force_sig(SIGKILL, selected);
 		rem -= selected_tasksize;
+		lowmem_stats.kills++;
 	}
+	scan_ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+	trace_lowmem_select(min_adj, scanned, selected, selected_oom_adj,
+			    selected_tasksize, scan_ns);
 	lowmem_print(4, "lowmem_shrink %d, %x, return %d\n",
 		     nr_to_scan, gfp_mask, rem);
 	read_unlock(&tasklist_lock);
+
+	lowmem_stats.scans++;
+	lowmem_stats.tasks_scanned += scanned;
+	lowmem_stats.scan_ns += scan_ns;
+	if (scan_ns > lowmem_stats.max_scan_ns)
+		lowmem_stats.max_scan_ns = scan_ns;
 	return rem;
 }
 
@@ -191,15 +302,140 @@ static struct shrinker lowmem_shrinker = {
 	.seeks = DEFAULT_SEEKS * 16
 };
 
+static int lowmem_stats_show(struct seq_file *m, void *unused)
+{
+	seq_printf(m, "scans: %lu\n", lowmem_stats.scans);
+	seq_printf(m, "tasks scanned: %lu\n", lowmem_stats.tasks_scanned);
+	seq_printf(m, "kills: %lu\n", lowmem_stats.kills);
+	seq_printf(m, "scan time: %llu ns\n",
+		   (unsigned long long)lowmem_stats.scan_ns);
+	seq_printf(m, "max scan time: %llu ns\n",
+		   (unsigned long long)lowmem_stats.max_scan_ns);
+	return 0;
+}
+
+static int lowmem_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, lowmem_stats_show, NULL);
+}
+
+static const struct file_operations lowmem_stats_fops = {
+	.owner = THIS_MODULE,
+	.open = lowmem_stats_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static struct dentry *lowmem_debugfs_entry;
+
+/*
+ * Each open file remembers the last level it read in private_data. A fresh
+ * file starts at INT_MIN so that its first read returns straight away.
+ */
+static inline int lowmem_notify_seen(struct file *file)
+{
+	return (long)file->private_data;
+}
+
+static int lowmem_notify_open(struct inode *inode, struct file *file)
+{
+	int ret;
+
+	ret = nonseekable_open(inode, file);
+	if (ret)
+		return ret;
+
+	file->private_data = (void *)(long)INT_MIN;
+	atomic_inc(&lowmem_notify_users);
+	return 0;
+}
+
+static int lowmem_notify_release(struct inode *inode, struct file *file)
+{
+	atomic_dec(&lowmem_notify_users);
+	return 0;
+}
+
+static ssize_t lowmem_notify_read(struct file *file, char __user *buf,
+				  size_t count, loff_t *pos)
+{
+	int level;
+	int ret;
+
+	if (count < sizeof(level))
+		return -EINVAL;
+
+	lowmem_notify_update(lowmem_min_adj(global_page_state(NR_FILE_PAGES)));
+	if (!(file->f_flags & O_NONBLOCK)) {
+		ret = wait_event_interruptible(lowmem_notify_wait,
+			lowmem_notify_level != lowmem_notify_seen(file));
+		if (ret)
+			return ret;
+	}
+
+	level = lowmem_notify_level;
+	file->private_data = (void *)(long)level;
+	if (copy_to_user(buf, &level, sizeof(level)))
+		return -EFAULT;
+	return sizeof(level);
+}
+
+static unsigned int lowmem_notify_poll(struct file *file, poll_table *wait)
+{
+	poll_wait(file, &lowmem_notify_wait, wait);
+	if (lowmem_notify_level != lowmem_notify_seen(file))
+		return POLLIN | POLLRDNORM;
+	return 0;
+}
+
+static const struct file_operations lowmem_notify_fops = {
+	.owner = THIS_MODULE,
+	.open = lowmem_notify_open,
+	.release = lowmem_notify_release,
+	.read = lowmem_notify_read,
+	.poll = lowmem_notify_poll,
+};
+
+static struct miscdevice lowmem_notify_misc = {
+	.minor = MISC_DYNAMIC_MINOR,
+	.name = "mem_notify",
+	.fops = &lowmem_notify_fops,
+};
+static int lowmem_notify_registered;
+
 static int __init lowmem_init(void)
 {
+	struct task_struct *p;
+	int i;
+	int ret;
+
+	for (i = 0; i < LOWMEM_BUCKETS; i++)
+		INIT_LIST_HEAD(&lowmem_buckets[i]);
+	write_lock_irq(&tasklist_lock);
+	lowmem_index_ready = 1;
+	for_each_process(p)
+		lowmem_index_add(p);
+	write_unlock_irq(&tasklist_lock);
+
 	register_shrinker(&lowmem_shrinker);
+	ret = misc_register(&lowmem_notify_misc);
+	if (ret)
+		printk(KERN_ERR "lowmemorykiller: failed to register "
+		       "mem_notify, %d\n", ret);
+	lowmem_notify_registered = !ret;
+	lowmem_debugfs_entry = debugfs_create_file("lowmemorykiller", S_IRUGO,
+						   NULL, NULL,
+						   &lowmem_stats_fops);
 	return 0;
 }
 
 static void __exit lowmem_exit(void)
 {
+	debugfs_remove(lowmem_debugfs_entry);
 	unregister_shrinker(&lowmem_shrinker);
+	if (lowmem_notify_registered)
+		misc_deregister(&lowmem_notify_misc);
 }
 
 module_param_named(cost, lowmem_shrinker.seeks, int, S_IRUGO | S_IWUSR);
@@ -0,0 +1,62 @@
+/* drivers/staging/android/lowmemorykiller_trace.h
+ *
+ * Copyright (C) 2007-2008 Google, Inc.
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#if !defined(_LOWMEMORYKILLER_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _LOWMEMORYKILLER_TRACE_H
+
+#include <linux/tracepoint.h>
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM lowmemorykiller
+#define TRACE_INCLUDE_FILE lowmemorykiller_trace
+
+TRACE_EVENT(lowmem_select,
+
+	TP_PROTO(int min_adj, int scanned, struct task_struct *selected,
+		 int selected_adj, int selected_size, u64 scan_ns),
+
+	TP_ARGS(min_adj, scanned, selected, selected_adj, selected_size,
+		scan_ns),
+
+	TP_STRUCT__entry(
+		__field(int, min_adj)
+		__field(int, scanned)
+		__field(pid_t, pid)
+		__field(int, adj)
+		__field(int, size)
+		__field(u64, scan_ns)
+	),
+
+	TP_fast_assign(
+		__entry->min_adj = min_adj;
+		__entry->scanned = scanned;
+		__entry->pid = selected ? selected->pid : 0;
+		__entry->adj = selected_adj;
+		__entry->size = selected_size;
+		__entry->scan_ns = scan_ns;
+	),
+
+	TP_printk("min_adj=%d scanned=%d pid=%d adj=%d size=%d scan_ns=%llu",
+		  __entry->min_adj, __entry->scanned, __entry->pid,
+		  __entry->adj, __entry->size,
+		  (unsigned long long)__entry->scan_ns)
+);
+
+#endif /* _LOWMEMORYKILLER_TRACE_H */
+
+/* This part must be outside protection */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#include <trace/define_trace.h>
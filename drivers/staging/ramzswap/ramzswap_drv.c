@@ -22,9 +22,12 @@
 #include <linux/buffer_head.h>
 #include <linux/device.h>
 #include <linux/genhd.h>
+#include <linux/hash.h>
 #include <linux/highmem.h>
+#include <linux/jhash.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
 #include <linux/slab.h>
-#include <linux/lzo.h>
 #include <linux/string.h>
 #include <linux/swap.h>
 #include <linux/swapops.h>
@@ -126,8 +129,8 @@ static void ramzswap_ioctl_get_stats(struct ramzswap *rzs,
 	size_t succ_writes, mem_used;
 	unsigned int good_compress_perc = 0, no_compress_perc = 0;
 
-	mem_used = xv_get_total_size_bytes(rzs->mem_pool)
-			+ (rs->pages_expand << PAGE_SHIFT);
+	mem_used = zs_get_total_size_bytes(rzs->mem_pool) +
+			(rs->pages_expand << PAGE_SHIFT);
 	succ_writes = rzs_stat64_read(rzs, &rs->num_writes) -
 			rzs_stat64_read(rzs, &rs->failed_writes);
 
@@ -158,15 +161,211 @@ static void ramzswap_ioctl_get_stats(struct ramzswap *rzs,
 #endif /* CONFIG_RAMZSWAP_STATS */
 }
 
+static void ramzswap_ioctl_get_ext_stats(struct ramzswap *rzs,
+			struct ramzswap_ioctl_ext_stats *s)
+{
+	strlcpy(s->compressor, rzs->compressor, sizeof(s->compressor));
+
+#if defined(CONFIG_RAMZSWAP_STATS)
+	{
+	struct ramzswap_stats *rs = &rzs->stats;
+	u64 pool_size, pool_used;
+
+	pool_size = zs_get_total_size_bytes(rzs->mem_pool);
+	pool_used = zs_get_used_size_bytes(rzs->mem_pool);
+
+	s->pages_dedup = rs->pages_dedup;
+	s->compr_ops = rzs_stat64_read(rzs, &rs->compr_ops);
+	s->compr_time_ns = rzs_stat64_read(rzs, &rs->compr_time_ns);
+	s->decompr_ops = rzs_stat64_read(rzs, &rs->decompr_ops);
+	s->decompr_time_ns = rzs_stat64_read(rzs, &rs->decompr_time_ns);
+
+	s->pool_frag_bytes = pool_size - pool_used;
+	s->pool_frag_pct = pool_size ?
+		div64_u64(s->pool_frag_bytes * 100, pool_size) : 0;
+	s->pages_compacted = zs_get_pages_compacted(rzs->mem_pool);
+	}
+#endif /* CONFIG_RAMZSWAP_STATS */
+}
+
+static void ramzswap_destroy_streams(struct ramzswap *rzs)
+{
+	struct ramzswap_strm *strm, *next;
+
+	list_for_each_entry_safe(strm, next, &rzs->idle_strm, list) {
+		list_del(&strm->list);
+		if (strm->tfm)
+			crypto_free_comp(strm->tfm);
+		free_pages((unsigned long)strm->buffer, 1);
+		kfree(strm);
+	}
+}
+
+static int ramzswap_create_streams(struct ramzswap *rzs)
+{
+	int i, ret = -ENOMEM;
+	struct ramzswap_strm *strm;
+
+	for (i = 0; i < num_possible_cpus(); i++) {
+		strm = kzalloc(sizeof(*strm), GFP_KERNEL);
+		if (!strm)
+			goto fail;
+
+		/* Add to the list first so that failures are cleaned up */
+		list_add(&strm->list, &rzs->idle_strm);
+
+		strm->tfm = crypto_alloc_comp(rzs->compressor, 0, 0);
+		if (IS_ERR(strm->tfm)) {
+			ret = PTR_ERR(strm->tfm);
+			strm->tfm = NULL;
+			goto fail;
+		}
+
+		/* output can exceed PAGE_SIZE for incompressible data */
+		strm->buffer = (void *)__get_free_pages(__GFP_ZERO, 1);
+		if (!strm->buffer)
+			goto fail;
+	}
+
+	return 0;
+
+fail:
+	ramzswap_destroy_streams(rzs);
+	return ret;
+}
+
+/*
+ * Take an idle compression stream, sleeping until one is released if all
+ * of them are busy.
+ */
+static struct ramzswap_strm *ramzswap_strm_get(struct ramzswap *rzs)
+{
+	struct ramzswap_strm *strm;
+
+	spin_lock(&rzs->strm_lock);
+	while (list_empty(&rzs->idle_strm)) {
+		spin_unlock(&rzs->strm_lock);
+		wait_event(rzs->strm_wait, !list_empty(&rzs->idle_strm));
+		spin_lock(&rzs->strm_lock);
+	}
+	strm = list_first_entry(&rzs->idle_strm, struct ramzswap_strm, list);
+	list_del(&strm->list);
+	spin_unlock(&rzs->strm_lock);
+
+	return strm;
+}
+
+static void ramzswap_strm_put(struct ramzswap *rzs, struct ramzswap_strm *strm)
+{
+	spin_lock(&rzs->strm_lock);
+	list_add(&strm->list, &rzs->idle_strm);
+	spin_unlock(&rzs->strm_lock);
+	wake_up(&rzs->strm_wait);
+}
+
+/*
+ * Look for a stored object whose compressed data equals the given
+ * buffer. On a match, take a reference to it and return its handle.
+ * buf is a bounce buffer for objects that span pages.
+ */
+static unsigned long ramzswap_dedup_get(struct ramzswap *rzs, u32 hash,
+			const void *src, size_t clen, void *buf)
+{
+	void *cmem;
+	unsigned long handle = 0;
+	struct hlist_node *pos;
+	struct ramzswap_dedup *d;
+	struct hlist_head *head;
+
+	head = &rzs->dedup_hash[hash & (RZS_DEDUP_HASH_SIZE - 1)];
+
+	spin_lock(&rzs->dedup_lock);
+	hlist_for_each_entry(d, pos, head, node) {
+		int match;
+
+		if (d->hash != hash || zs_get_object_size(d->handle) != clen)
+			continue;
+
+		cmem = zs_map_object(rzs->mem_pool, d->handle, buf);
+		match = !memcmp(cmem, src, clen);
+		zs_unmap_object(rzs->mem_pool, d->handle, cmem);
+
+		if (match) {
+			d->refcount++;
+			handle = d->handle;
+			break;
+		}
+	}
+	spin_unlock(&rzs->dedup_lock);
+
+	return handle;
+}
+
+/*
+ * Make a newly stored object visible for dedup. Failure to allocate the
+ * hash entry only means the object will not be shared.
+ */
+static void ramzswap_dedup_add(struct ramzswap *rzs, u32 hash,
+			unsigned long handle)
+{
+	struct ramzswap_dedup *d;
+
+	d = kmalloc(sizeof(*d), GFP_NOIO);
+	if (!d)
+		return;
+
+	d->handle = handle;
+	d->hash = hash;
+	d->refcount = 1;
+
+	spin_lock(&rzs->dedup_lock);
+	hlist_add_head(&d->node,
+		&rzs->dedup_hash[hash & (RZS_DEDUP_HASH_SIZE - 1)]);
+	hlist_add_head(&d->hnode,
+		&rzs->dedup_handles[hash_long(handle, RZS_DEDUP_HASH_BITS)]);
+	spin_unlock(&rzs->dedup_lock);
+}
+
+/*
+ * Drop a reference to a compressed object. Returns 1 if the object is
+ * still used by other table entries and must not be freed.
+ */
+static int ramzswap_dedup_put(struct ramzswap *rzs, unsigned long handle)
+{
+	int shared = 0;
+	struct hlist_node *pos;
+	struct ramzswap_dedup *d;
+
+	if (!rzs->dedup_hash)
+		return 0;
+
+	spin_lock(&rzs->dedup_lock);
+	hlist_for_each_entry(d, pos,
+		&rzs->dedup_handles[hash_long(handle, RZS_DEDUP_HASH_BITS)],
+		hnode) {
+		if (d->handle != handle)
+			continue;
+
+		if (--d->refcount) {
+			shared = 1;
+		} else {
+			hlist_del(&d->node);
+			hlist_del(&d->hnode);
+			kfree(d);
+		}
+		break;
+	}
+	spin_unlock(&rzs->dedup_lock);
+
+	return shared;
+}
+
 static void ramzswap_free_page(struct ramzswap *rzs, size_t index)
 {
 	u32 clen;
-	void *obj;
-
-	struct page *page = rzs->table[index].page;
-	u32 offset = rzs->table[index].offset;
+	unsigned long handle = rzs->table[index].handle;
 
-	if (unlikely(!page)) {
+	if (unlikely(!handle)) {
 		/*
 		 * No memory is allocated for zero filled pages.
 		 * Simply clear zero page flag.
@@ -180,26 +379,30 @@ static void ramzswap_free_page(struct ramzswap *rzs, size_t index)
 
 	if (unlikely(rzs_test_flag(rzs, index, RZS_UNCOMPRESSED))) {
 		clen = PAGE_SIZE;
-		__free_page(page);
+		__free_page(rzs->table[index].page);
 		rzs_clear_flag(rzs, index, RZS_UNCOMPRESSED);
 		rzs_stat_dec(&rzs->stats.pages_expand);
 		goto out;
 	}
 
-	obj = kmap_atomic(page, KM_USER0) + offset;
-	clen = xv_get_object_size(obj) - sizeof(struct zobj_header);
-	kunmap_atomic(obj, KM_USER0);
-
-	xv_free(rzs->mem_pool, page, offset);
+	clen = zs_get_object_size(handle);
 	if (clen <= PAGE_SIZE / 2)
 		rzs_stat_dec(&rzs->stats.good_compress);
 
+	if (ramzswap_dedup_put(rzs, handle)) {
+		/* Object still in use by other pages: nothing is freed */
+		rzs_stat_dec(&rzs->stats.pages_dedup);
+		clen = 0;
+		goto out;
+	}
+
+	zs_free(rzs->mem_pool, handle);
+
 out:
 	rzs->stats.compr_size -= clen;
 	rzs_stat_dec(&rzs->stats.pages_stored);
 
-	rzs->table[index].page = NULL;
-	rzs->table[index].offset = 0;
+	rzs->table[index].handle = 0;
 }
 
 static int handle_zero_page(struct bio *bio)
@@ -228,8 +431,7 @@ static int handle_uncompressed_page(struct ramzswap *rzs, struct bio *bio)
 	index = bio->bi_sector >> SECTORS_PER_PAGE_SHIFT;
 
 	user_mem = kmap_atomic(page, KM_USER0);
-	cmem = kmap_atomic(rzs->table[index].page, KM_USER1) +
-			rzs->table[index].offset;
+	cmem = kmap_atomic(rzs->table[index].page, KM_USER1);
 
 	memcpy(user_mem, cmem, PAGE_SIZE);
 	kunmap_atomic(user_mem, KM_USER0);
@@ -265,9 +467,10 @@ static int ramzswap_read(struct ramzswap *rzs, struct bio *bio)
 {
 	int ret;
 	u32 index;
-	size_t clen;
+	unsigned int clen;
+	ktime_t start;
 	struct page *page;
-	struct zobj_header *zheader;
+	struct ramzswap_strm *strm;
 	unsigned char *user_mem, *cmem;
 
 	rzs_stat64_inc(rzs, &rzs->stats.num_reads);
@@ -286,22 +489,30 @@ static int ramzswap_read(struct ramzswap *rzs, struct bio *bio)
 	if (unlikely(rzs_test_flag(rzs, index, RZS_UNCOMPRESSED)))
 		return handle_uncompressed_page(rzs, bio);
 
+	strm = ramzswap_strm_get(rzs);
+	start = ktime_get();
+
 	user_mem = kmap_atomic(page, KM_USER0);
 	clen = PAGE_SIZE;
 
-	cmem = kmap_atomic(rzs->table[index].page, KM_USER1) +
-			rzs->table[index].offset;
+	cmem = zs_map_object(rzs->mem_pool, rzs->table[index].handle,
+				strm->buffer);
 
-	ret = lzo1x_decompress_safe(
-		cmem + sizeof(*zheader),
-		xv_get_object_size(cmem) - sizeof(*zheader),
+	ret = crypto_comp_decompress(strm->tfm, cmem,
+		zs_get_object_size(rzs->table[index].handle),
 		user_mem, &clen);
 
+	zs_unmap_object(rzs->mem_pool, rzs->table[index].handle, cmem);
 	kunmap_atomic(user_mem, KM_USER0);
-	kunmap_atomic(cmem, KM_USER1);
+
+	ramzswap_strm_put(rzs, strm);
+
+	rzs_stat64_inc(rzs, &rzs->stats.decompr_ops);
+	rzs_stat64_add(rzs, &rzs->stats.decompr_time_ns,
+			ktime_to_ns(ktime_sub(ktime_get(), start)));
 
 	/* should NEVER happen */
-	if (unlikely(ret != LZO_E_OK)) {
+	if (unlikely(ret || clen != PAGE_SIZE)) {
 		pr_err("Decompression failed! err=%d, page=%u\n",
 			ret, index);
 		rzs_stat64_inc(rzs, &rzs->stats.failed_reads);
@@ -321,11 +532,13 @@ out:
 
 static int ramzswap_write(struct ramzswap *rzs, struct bio *bio)
 {
-	int ret;
-	u32 offset, index;
-	size_t clen;
-	struct zobj_header *zheader;
+	int ret, dedup = 0;
+	u32 index, hash;
+	unsigned int clen;
+	ktime_t start;
+	unsigned long handle;
 	struct page *page, *page_store;
+	struct ramzswap_strm *strm;
 	unsigned char *user_mem, *cmem, *src;
 
 	rzs_stat64_inc(rzs, &rzs->stats.num_writes);
@@ -333,29 +546,40 @@ static int ramzswap_write(struct ramzswap *rzs, struct bio *bio)
 	page = bio->bi_io_vec[0].bv_page;
 	index = bio->bi_sector >> SECTORS_PER_PAGE_SHIFT;
 
-	src = rzs->compress_buffer;
-
-	mutex_lock(&rzs->lock);
-
 	user_mem = kmap_atomic(page, KM_USER0);
 	if (page_zero_filled(user_mem)) {
 		kunmap_atomic(user_mem, KM_USER0);
-		mutex_unlock(&rzs->lock);
+		mutex_lock(&rzs->lock);
 		rzs_stat_inc(&rzs->stats.pages_zero);
+		mutex_unlock(&rzs->lock);
 		rzs_set_flag(rzs, index, RZS_ZERO);
 
 		set_bit(BIO_UPTODATE, &bio->bi_flags);
 		bio_endio(bio, 0);
 		return 0;
 	}
+	kunmap_atomic(user_mem, KM_USER0);
 
-	ret = lzo1x_1_compress(user_mem, PAGE_SIZE, src, &clen,
-				rzs->compress_workmem);
+	/*
+	 * Only the stream is exclusive to us, so compression and storing of
+	 * the object run in parallel with other writers; rzs->lock is taken
+	 * just for the stats update at the end.
+	 */
+	strm = ramzswap_strm_get(rzs);
+	src = strm->buffer;
+	clen = 2 * PAGE_SIZE;
+	start = ktime_get();
 
+	user_mem = kmap_atomic(page, KM_USER0);
+	ret = crypto_comp_compress(strm->tfm, user_mem, PAGE_SIZE, src, &clen);
 	kunmap_atomic(user_mem, KM_USER0);
 
-	if (unlikely(ret != LZO_E_OK)) {
-		mutex_unlock(&rzs->lock);
+	rzs_stat64_inc(rzs, &rzs->stats.compr_ops);
+	rzs_stat64_add(rzs, &rzs->stats.compr_time_ns,
+			ktime_to_ns(ktime_sub(ktime_get(), start)));
+
+	if (unlikely(ret)) {
+		ramzswap_strm_put(rzs, strm);
 		pr_err("Compression failed! err=%d\n", ret);
 		rzs_stat64_inc(rzs, &rzs->stats.failed_writes);
 		goto out;
@@ -367,61 +591,64 @@ static int ramzswap_write(struct ramzswap *rzs, struct bio *bio)
 	 * errors which has side effect of hanging the system.
 	 */
 	if (unlikely(clen > max_zpage_size)) {
+		ramzswap_strm_put(rzs, strm);
+
 		clen = PAGE_SIZE;
 		page_store = alloc_page(GFP_NOIO | __GFP_HIGHMEM);
 		if (unlikely(!page_store)) {
-			mutex_unlock(&rzs->lock);
 			pr_info("Error allocating memory for incompressible "
 				"page: %u\n", index);
 			rzs_stat64_inc(rzs, &rzs->stats.failed_writes);
 			goto out;
 		}
 
-		offset = 0;
-		rzs_set_flag(rzs, index, RZS_UNCOMPRESSED);
-		rzs_stat_inc(&rzs->stats.pages_expand);
-		rzs->table[index].page = page_store;
 		src = kmap_atomic(page, KM_USER0);
-		goto memstore;
+		cmem = kmap_atomic(page_store, KM_USER1);
+		memcpy(cmem, src, PAGE_SIZE);
+		kunmap_atomic(cmem, KM_USER1);
+		kunmap_atomic(src, KM_USER0);
+
+		rzs->table[index].page = page_store;
+		rzs_set_flag(rzs, index, RZS_UNCOMPRESSED);
+		goto update_stats;
 	}
 
-	if (xv_malloc(rzs->mem_pool, clen + sizeof(*zheader),
-			&rzs->table[index].page, &offset,
-			GFP_NOIO | __GFP_HIGHMEM)) {
-		mutex_unlock(&rzs->lock);
+	/* Share an existing object if some page compressed to the same data */
+	hash = jhash(src, clen, 0);
+	handle = ramzswap_dedup_get(rzs, hash, src, clen, src + PAGE_SIZE);
+	if (handle) {
+		ramzswap_strm_put(rzs, strm);
+		rzs->table[index].handle = handle;
+		dedup = 1;
+		goto update_stats;
+	}
+
+	handle = zs_malloc(rzs->mem_pool, clen, GFP_NOIO | __GFP_HIGHMEM);
+	if (!handle) {
+		ramzswap_strm_put(rzs, strm);
 		pr_info("Error allocating memory for compressed "
-			"page: %u, size=%zu\n", index, clen);
+			"page: %u, size=%u\n", index, clen);
 		rzs_stat64_inc(rzs, &rzs->stats.failed_writes);
 		goto out;
 	}
 
-memstore:
-	rzs->table[index].offset = offset;
-
-	cmem = kmap_atomic(rzs->table[index].page, KM_USER1) +
-			rzs->table[index].offset;
+	zs_write_object(rzs->mem_pool, handle, src);
+	ramzswap_strm_put(rzs, strm);
 
-#if 0
-	/* Back-reference needed for memory defragmentation */
-	if (!rzs_test_flag(rzs, index, RZS_UNCOMPRESSED)) {
-		zheader = (struct zobj_header *)cmem;
-		zheader->table_idx = index;
-		cmem += sizeof(*zheader);
-	}
-#endif
-
-	memcpy(cmem, src, clen);
-
-	kunmap_atomic(cmem, KM_USER1);
-	if (unlikely(rzs_test_flag(rzs, index, RZS_UNCOMPRESSED)))
-		kunmap_atomic(src, KM_USER0);
+	ramzswap_dedup_add(rzs, hash, handle);
+	rzs->table[index].handle = handle;
 
-	/* Update stats */
-	rzs->stats.compr_size += clen;
+update_stats:
+	mutex_lock(&rzs->lock);
+	if (dedup)
+		rzs_stat_inc(&rzs->stats.pages_dedup);
+	else
+		rzs->stats.compr_size += clen;
 	rzs_stat_inc(&rzs->stats.pages_stored);
 	if (clen <= PAGE_SIZE / 2)
 		rzs_stat_inc(&rzs->stats.good_compress);
-
+	if (unlikely(rzs_test_flag(rzs, index, RZS_UNCOMPRESSED)))
+		rzs_stat_inc(&rzs->stats.pages_expand);
 	mutex_unlock(&rzs->lock);
 
 	set_bit(BIO_UPTODATE, &bio->bi_flags);
@@ -492,33 +719,31 @@ static void reset_device(struct ramzswap *rzs)
 	rzs->init_done = 0;
 
 	/* Free various per-device buffers */
-	kfree(rzs->compress_workmem);
-	free_pages((unsigned long)rzs->compress_buffer, 1);
-
-	rzs->compress_workmem = NULL;
-	rzs->compress_buffer = NULL;
+	ramzswap_destroy_streams(rzs);
 
 	/* Free all pages that are still in this ramzswap device */
 	for (index = 0; index < rzs->disksize >> PAGE_SHIFT; index++) {
-		struct page *page;
-		u16 offset;
+		unsigned long handle = rzs->table[index].handle;
 
-		page = rzs->table[index].page;
-		offset = rzs->table[index].offset;
-
-		if (!page)
+		if (!handle)
 			continue;
 
 		if (unlikely(rzs_test_flag(rzs, index, RZS_UNCOMPRESSED)))
-			__free_page(page);
-		else
-			xv_free(rzs->mem_pool, page, offset);
+			__free_page(rzs->table[index].page);
+		else if (!ramzswap_dedup_put(rzs, handle))
+			/* Objects shared by several pages are freed once */
+			zs_free(rzs->mem_pool, handle);
 	}
 
 	vfree(rzs->table);
 	rzs->table = NULL;
 
-	xv_destroy_pool(rzs->mem_pool);
+	vfree(rzs->dedup_hash);
+	rzs->dedup_hash = NULL;
+	rzs->dedup_handles = NULL;
+
+	if (rzs->mem_pool)
+		zs_destroy_pool(rzs->mem_pool);
 	rzs->mem_pool = NULL;
 
 	/* Reset stats */
@@ -541,17 +766,9 @@ static int ramzswap_ioctl_init_device(struct ramzswap *rzs)
 
 	ramzswap_set_disksize(rzs, totalram_pages << PAGE_SHIFT);
 
-	rzs->compress_workmem = kzalloc(LZO1X_MEM_COMPRESS, GFP_KERNEL);
-	if (!rzs->compress_workmem) {
-		pr_err("Error allocating compressor working memory!\n");
-		ret = -ENOMEM;
-		goto fail;
-	}
-
-	rzs->compress_buffer = (void *)__get_free_pages(__GFP_ZERO, 1);
-	if (!rzs->compress_buffer) {
-		pr_err("Error allocating compressor buffer space\n");
-		ret = -ENOMEM;
+	ret = ramzswap_create_streams(rzs);
+	if (ret) {
+		pr_err("Error allocating compression streams!\n");
 		goto fail;
 	}
 
@@ -566,6 +783,18 @@ static int ramzswap_ioctl_init_device(struct ramzswap *rzs)
 	}
 	memset(rzs->table, 0, num_pages * sizeof(*rzs->table));
 
+	/* One allocation for both the content and the handle hash */
+	rzs->dedup_hash = vmalloc(2 * RZS_DEDUP_HASH_SIZE *
+				sizeof(*rzs->dedup_hash));
+	if (!rzs->dedup_hash) {
+		pr_err("Error allocating ramzswap dedup hash\n");
+		ret = -ENOMEM;
+		goto fail;
+	}
+	memset(rzs->dedup_hash, 0, 2 * RZS_DEDUP_HASH_SIZE *
+				sizeof(*rzs->dedup_hash));
+	rzs->dedup_handles = rzs->dedup_hash + RZS_DEDUP_HASH_SIZE;
+
 	page = alloc_page(__GFP_ZERO);
 	if (!page) {
 		pr_err("Error allocating swap header page\n");
@@ -584,7 +813,7 @@ static int ramzswap_ioctl_init_device(struct ramzswap *rzs)
 	/* ramzswap devices sort of resembles non-rotational disks */
 	queue_flag_set_unlocked(QUEUE_FLAG_NONROT, rzs->disk->queue);
 
-	rzs->mem_pool = xv_create_pool();
+	rzs->mem_pool = zs_create_pool();
 	if (!rzs->mem_pool) {
 		pr_err("Error creating memory pool\n");
 		ret = -ENOMEM;
@@ -616,6 +845,7 @@ static int ramzswap_ioctl(struct block_device *bdev, fmode_t mode,
 {
 	int ret = 0;
 	size_t disksize_kb;
+	char compressor[RZS_COMP_NAME_LEN];
 
 	struct ramzswap *rzs = bdev->bd_disk->private_data;
 
@@ -655,10 +885,60 @@ static int ramzswap_ioctl(struct block_device *bdev, fmode_t mode,
 		kfree(stats);
 		break;
 	}
+	case RZSIO_GET_EXT_STATS:
+	{
+		struct ramzswap_ioctl_ext_stats *stats;
+		if (!rzs->init_done) {
+			ret = -ENOTTY;
+			goto out;
+		}
+		stats = kzalloc(sizeof(*stats), GFP_KERNEL);
+		if (!stats) {
+			ret = -ENOMEM;
+			goto out;
+		}
+		ramzswap_ioctl_get_ext_stats(rzs, stats);
+		if (copy_to_user((void *)arg, stats, sizeof(*stats))) {
+			kfree(stats);
+			ret = -EFAULT;
+			goto out;
+		}
+		kfree(stats);
+		break;
+	}
 	case RZSIO_INIT:
 		ret = ramzswap_ioctl_init_device(rzs);
 		break;
 
+	case RZSIO_SET_COMPRESSOR:
+		if (rzs->init_done) {
+			ret = -EBUSY;
+			goto out;
+		}
+		if (copy_from_user(compressor, (void *)arg,
+						sizeof(compressor))) {
+			ret = -EFAULT;
+			goto out;
+		}
+		compressor[sizeof(compressor) - 1] = '\0';
+		if (!crypto_has_comp(compressor, 0, 0)) {
+			pr_info("Compressor %s not available\n", compressor);
+			ret = -EINVAL;
+			goto out;
+		}
+		strlcpy(rzs->compressor, compressor, sizeof(rzs->compressor));
+		pr_info("Compressor set to %s\n", rzs->compressor);
+		break;
+
+	case RZSIO_COMPACT:
+		if (!rzs->init_done) {
+			ret = -ENOTTY;
+			goto out;
+		}
+		pr_debug("Compaction freed %lu pages\n",
+			zs_compact(rzs->mem_pool));
+		break;
+
 	case RZSIO_RESET:
 		/* Do not reset an active device! */
 		if (bdev->bd_holders) {
@@ -705,6 +985,11 @@ static int create_device(struct ramzswap *rzs, int device_id)
 
 	mutex_init(&rzs->lock);
 	spin_lock_init(&rzs->stat64_lock);
+	INIT_LIST_HEAD(&rzs->idle_strm);
+	spin_lock_init(&rzs->strm_lock);
+	init_waitqueue_head(&rzs->strm_wait);
+	spin_lock_init(&rzs->dedup_lock);
+	strlcpy(rzs->compressor, default_compressor, sizeof(rzs->compressor));
 
 	rzs->queue = blk_alloc_queue(GFP_KERNEL);
 	if (!rzs->queue) {
@@ -17,9 +17,11 @@
 
 #include <linux/spinlock.h>
 #include <linux/mutex.h>
+#include <linux/wait.h>
+#include <linux/crypto.h>
 
 #include "ramzswap_ioctl.h"
-#include "xvmalloc.h"
+#include "zsmalloc.h"
 
 /*
  * Some arbitrary value. This is just to catch
@@ -27,23 +29,18 @@
  */
 static const unsigned max_num_devices = 32;
 
-/*
- * Stored at beginning of each compressed object.
- *
- * It stores back-reference to table entry which points to this
- * object. This is required to support memory defragmentation.
- */
-struct zobj_header {
-#if 0
-	u32 table_idx;
-#endif
-};
-
 /*-- Configurable parameters */
 
 /* Default ramzswap disk size: 25% of total RAM */
 static const unsigned default_disksize_perc_ram = 25;
 
+/* Default compressor (any crypto API "compress" algorithm can be used) */
+static const char default_compressor[] = "lzo";
+
+/* Buckets in the per-device hash of stored objects (used for dedup) */
+#define RZS_DEDUP_HASH_BITS	12
+#define RZS_DEDUP_HASH_SIZE	(1 << RZS_DEDUP_HASH_BITS)
+
 /*
  * Pages that compress to size greater than this are stored
  * uncompressed in memory.
@@ -52,8 +49,8 @@ static const unsigned max_zpage_size = PAGE_SIZE / 4 * 3;
 
 /*
  * NOTE: max_zpage_size must be less than or equal to:
- *   XV_MAX_ALLOC_SIZE - sizeof(struct zobj_header)
- * otherwise, xv_malloc() would always return failure.
+ *   ZS_MAX_ALLOC_SIZE - ZS_HDR_SIZE
+ * otherwise, zs_malloc() would always return failure.
  */
 
 /*-- End of configurable params */
@@ -81,9 +78,10 @@ enum rzs_pageflags {
  * These table entries must fit exactly in a page.
  */
 struct table {
-	struct page *page;
-	u16 offset;
-	u8 count;	/* object ref count (not yet used) */
+	union {
+		struct page *page;	/* page stored uncompressed */
+		unsigned long handle;	/* compressed object in mem_pool */
+	};
 	u8 flags;
 } __attribute__((aligned(4)));
 
@@ -103,16 +101,52 @@ struct ramzswap_stats {
 	u32 pages_stored;	/* no. of pages currently stored */
 	u32 good_compress;	/* % of pages with compression ratio<=50% */
 	u32 pages_expand;	/* % of incompressible pages */
+	u32 pages_dedup;	/* no. of pages sharing a stored object */
+	u64 compr_ops;		/* pages compressed */
+	u64 compr_time_ns;	/* time spent compressing */
+	u64 decompr_ops;	/* pages decompressed */
+	u64 decompr_time_ns;	/* time spent decompressing */
 #endif
 };
 
+/*
+ * Compression stream: compressor transform and output buffer for one
+ * (de)compression in flight. Each device has one per possible CPU so that
+ * concurrent swap reads and writes run in parallel.
+ */
+struct ramzswap_strm {
+	struct crypto_comp *tfm;
+	void *buffer;
+	struct list_head list;	/* entry in idle_strm */
+};
+
+/*
+ * Hash entry for a compressed object. Pages that compress to identical
+ * data share a single object; refcount is the number of table entries
+ * pointing to it, and the only reference count an object has. Entries
+ * are hashed both by content (to find a match on write) and by handle
+ * (to drop a reference on free).
+ */
+struct ramzswap_dedup {
+	struct hlist_node node;		/* in dedup_hash */
+	struct hlist_node hnode;	/* in dedup_handles */
+	unsigned long handle;
+	u32 hash;
+	u32 refcount;
+};
+
 struct ramzswap {
-	struct xv_pool *mem_pool;
-	void *compress_workmem;
-	void *compress_buffer;
+	struct zs_pool *mem_pool;
+	char compressor[RZS_COMP_NAME_LEN];
+	struct hlist_head *dedup_hash;
+	struct hlist_head *dedup_handles;
+	spinlock_t dedup_lock;		/* protects dedup hashes and refcounts */
+	struct list_head idle_strm;	/* streams not in use */
+	spinlock_t strm_lock;		/* protects idle_strm */
+	wait_queue_head_t strm_wait;	/* writers waiting for a stream */
 	struct table *table;
 	spinlock_t stat64_lock;	/* protect 64-bit stats */
-	struct mutex lock;
+	struct mutex lock;	/* protects 32-bit stats and compr_size */
 	struct request_queue *queue;
 	struct gendisk *disk;
 	int init_done;
@@ -147,6 +181,13 @@ static void rzs_stat64_inc(struct ramzswap *rzs, u64 *v)
 	spin_unlock(&rzs->stat64_lock);
 }
 
+static void rzs_stat64_add(struct ramzswap *rzs, u64 *v, u64 val)
+{
+	spin_lock(&rzs->stat64_lock);
+	*v = *v + val;
+	spin_unlock(&rzs->stat64_lock);
+}
+
 static u64 rzs_stat64_read(struct ramzswap *rzs, u64 *v)
 {
 	u64 val;
@@ -161,6 +202,7 @@ static u64 rzs_stat64_read(struct ramzswap *rzs, u64 *v)
 #define rzs_stat_inc(v)
 #define rzs_stat_dec(v)
 #define rzs_stat64_inc(r, v)
+#define rzs_stat64_add(r, v, val)
 #define rzs_stat64_read(r, v)
 #endif /* CONFIG_RAMZSWAP_STATS */
 
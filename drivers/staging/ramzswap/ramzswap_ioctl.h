@@ -15,6 +15,8 @@
 #ifndef _RAMZSWAP_IOCTL_H_
 #define _RAMZSWAP_IOCTL_H_
 
+#define RZS_COMP_NAME_LEN	16	/* including terminating NUL */
+
 struct ramzswap_ioctl_stats {
 	u64 disksize;		/* user specified or equal to backing swap
 				 * size (if present) */
@@ -34,9 +36,25 @@ struct ramzswap_ioctl_stats {
 	u64 mem_used_total;
 } __attribute__ ((packed, aligned(4)));
 
+/* Stats beyond RZSIO_GET_STATS, whose layout fixes its ioctl number */
+struct ramzswap_ioctl_ext_stats {
+	u32 pages_dedup;	/* no. of pages sharing another page's object */
+	char compressor[RZS_COMP_NAME_LEN];
+	u64 compr_ops;		/* pages compressed */
+	u64 compr_time_ns;	/* total time spent compressing */
+	u64 decompr_ops;	/* pages decompressed */
+	u64 decompr_time_ns;	/* total time spent decompressing */
+	u64 pool_frag_bytes;	/* pool memory not holding object data */
+	u32 pool_frag_pct;	/* pool_frag_bytes as % of pool size */
+	u64 pages_compacted;	/* pool pages freed by RZSIO_COMPACT */
+} __attribute__ ((packed, aligned(4)));
+
 #define RZSIO_SET_DISKSIZE_KB	_IOW('z', 0, size_t)
 #define RZSIO_GET_STATS		_IOR('z', 1, struct ramzswap_ioctl_stats)
 #define RZSIO_INIT		_IO('z', 2)
 #define RZSIO_RESET		_IO('z', 3)
+#define RZSIO_SET_COMPRESSOR	_IOW('z', 4, char [RZS_COMP_NAME_LEN])
+#define RZSIO_COMPACT		_IO('z', 5)
+#define RZSIO_GET_EXT_STATS	_IOR('z', 6, struct ramzswap_ioctl_ext_stats)
 
 #endif
@@ -0,0 +1,519 @@
+/*
+ * zsmalloc memory allocator
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ */
+
+#include <linux/bitops.h>
+#include <linux/errno.h>
+#include <linux/highmem.h>
+#include <linux/mutex.h>
+#include <linux/sched.h>
+#include <linux/string.h>
+#include <linux/slab.h>
+
+#include "zsmalloc.h"
+#include "zsmalloc_int.h"
+
+static u32 get_class_idx(u32 size)
+{
+	size += ZS_HDR_SIZE;
+	if (size < ZS_MIN_ALLOC_SIZE)
+		size = ZS_MIN_ALLOC_SIZE;
+
+	return DIV_ROUND_UP(size - ZS_MIN_ALLOC_SIZE, ZS_SIZE_CLASS_DELTA);
+}
+
+static struct size_class *get_class(struct zs_pool *pool,
+			struct zs_handle *h)
+{
+	return &pool->classes[get_class_idx(h->size)];
+}
+
+/*
+ * Pick the number of pages per zspage that leaves the least unused
+ * space at the end of the zspage for objects of the given size.
+ */
+static u16 get_pages_per_zspage(u32 size)
+{
+	u16 i, best = 1;
+	u32 usedpc, max_usedpc = 0;
+
+	for (i = 1; i <= ZS_MAX_PAGES_PER_ZSPAGE; i++) {
+		u32 zspage_size = i * PAGE_SIZE;
+
+		usedpc = (zspage_size - zspage_size % size) * 100 / zspage_size;
+		if (usedpc > max_usedpc) {
+			max_usedpc = usedpc;
+			best = i;
+		}
+	}
+
+	return best;
+}
+
+/*
+ * Copy len bytes between buf and the zspage, starting at byte offset
+ * off of the zspage. The range may span page boundaries.
+ */
+static void zs_copy(struct zspage *zspage, u32 off, void *buf, u32 len,
+			int to_zspage)
+{
+	while (len) {
+		u32 n, page_off = off & ~PAGE_MASK;
+		unsigned char *base;
+
+		n = min_t(u32, len, PAGE_SIZE - page_off);
+		base = kmap_atomic(zspage->pages[off >> PAGE_SHIFT], KM_USER1);
+		if (to_zspage)
+			memcpy(base + page_off, buf, n);
+		else
+			memcpy(buf, base + page_off, n);
+		kunmap_atomic(base, KM_USER1);
+
+		buf += n;
+		off += n;
+		len -= n;
+	}
+}
+
+static void free_zspage(struct size_class *class, struct zspage *zspage)
+{
+	u16 i;
+
+	for (i = 0; i < class->pages_per_zspage; i++)
+		__free_page(zspage->pages[i]);
+	kfree(zspage);
+}
+
+static struct zspage *alloc_zspage(struct size_class *class, gfp_t flags)
+{
+	u16 i;
+	struct zspage *zspage;
+
+	zspage = kzalloc(sizeof(*zspage), flags & ~__GFP_HIGHMEM);
+	if (!zspage)
+		return NULL;
+
+	for (i = 0; i < class->pages_per_zspage; i++) {
+		zspage->pages[i] = alloc_page(flags);
+		if (!zspage->pages[i]) {
+			while (i--)
+				__free_page(zspage->pages[i]);
+			kfree(zspage);
+			return NULL;
+		}
+	}
+
+	INIT_LIST_HEAD(&zspage->list);
+
+	return zspage;
+}
+
+/*
+ * Take a free object slot in zspage and point it at handle h.
+ * Called with class->lock held exclusive.
+ */
+static void obj_set(struct size_class *class, struct zspage *zspage,
+			struct zs_handle *h)
+{
+	u16 idx;
+	unsigned long hval = (unsigned long)h;
+
+	idx = find_first_zero_bit(zspage->used_map, class->objs_per_zspage);
+	__set_bit(idx, zspage->used_map);
+	zspage->inuse++;
+	if (zspage->inuse == class->objs_per_zspage)
+		list_move(&zspage->list, &class->full);
+
+	h->zspage = zspage;
+	h->obj_idx = idx;
+	zs_copy(zspage, idx * class->size, &hval, sizeof(hval), 1);
+}
+
+/*
+ * All pools share one handle cache, slab cache names must be unique.
+ * It is created with the first pool and destroyed with the last one.
+ */
+static DEFINE_MUTEX(handle_cache_lock);
+static struct kmem_cache *handle_cache;
+static unsigned int handle_cache_users;
+
+static struct kmem_cache *get_handle_cache(void)
+{
+	mutex_lock(&handle_cache_lock);
+	if (!handle_cache)
+		handle_cache = kmem_cache_create("zs_handle",
+				sizeof(struct zs_handle), 0, 0, NULL);
+	if (handle_cache)
+		handle_cache_users++;
+	mutex_unlock(&handle_cache_lock);
+
+	return handle_cache;
+}
+
+static void put_handle_cache(void)
+{
+	mutex_lock(&handle_cache_lock);
+	if (!--handle_cache_users) {
+		kmem_cache_destroy(handle_cache);
+		handle_cache = NULL;
+	}
+	mutex_unlock(&handle_cache_lock);
+}
+
+/*
+ * Create a memory pool. Allocates size classes and other per-pool
+ * metadata.
+ */
+struct zs_pool *zs_create_pool(void)
+{
+	u32 i;
+	struct zs_pool *pool;
+
+	pool = kzalloc(sizeof(*pool), GFP_KERNEL);
+	if (!pool)
+		return NULL;
+
+	pool->handle_cache = get_handle_cache();
+	pool->compact_buf = kmalloc(ZS_MAX_ALLOC_SIZE, GFP_KERNEL);
+	if (!pool->handle_cache || !pool->compact_buf) {
+		zs_destroy_pool(pool);
+		return NULL;
+	}
+
+	for (i = 0; i < ZS_NUM_CLASSES; i++) {
+		struct size_class *class = &pool->classes[i];
+
+		rwlock_init(&class->lock);
+		INIT_LIST_HEAD(&class->partial);
+		INIT_LIST_HEAD(&class->full);
+		class->size = ZS_MIN_ALLOC_SIZE + i * ZS_SIZE_CLASS_DELTA;
+		class->pages_per_zspage = get_pages_per_zspage(class->size);
+		class->objs_per_zspage = class->pages_per_zspage * PAGE_SIZE
+						/ class->size;
+	}
+
+	mutex_init(&pool->compact_lock);
+
+	return pool;
+}
+
+/*
+ * Free pool metadata and any zspages still held. The caller must have
+ * freed (or otherwise stopped using) all handles.
+ */
+void zs_destroy_pool(struct zs_pool *pool)
+{
+	u32 i;
+	struct zspage *zspage, *next;
+
+	for (i = 0; i < ZS_NUM_CLASSES; i++) {
+		struct size_class *class = &pool->classes[i];
+
+		if (!class->size)
+			break;
+
+		list_for_each_entry_safe(zspage, next, &class->partial, list)
+			free_zspage(class, zspage);
+		list_for_each_entry_safe(zspage, next, &class->full, list)
+			free_zspage(class, zspage);
+	}
+
+	if (pool->handle_cache)
+		put_handle_cache();
+	kfree(pool->compact_buf);
+	kfree(pool);
+}
+
+/**
+ * zs_malloc - Allocate object of given size from pool.
+ * @pool: pool to allocate from
+ * @size: size of object to allocate
+ * @flags: allocation flags for backing pages (may include __GFP_HIGHMEM)
+ *
+ * On success, returns a handle to the object which is used with
+ * zs_write_object/zs_map_object. Returns 0 on failure.
+ *
+ * Allocation requests with size > ZS_MAX_ALLOC_SIZE - ZS_HDR_SIZE
+ * will fail.
+ */
+unsigned long zs_malloc(struct zs_pool *pool, u32 size, gfp_t flags)
+{
+	struct zs_handle *h;
+	struct size_class *class;
+	struct zspage *zspage;
+
+	if (unlikely(!size || size > ZS_MAX_ALLOC_SIZE - ZS_HDR_SIZE))
+		return 0;
+
+	h = kmem_cache_alloc(pool->handle_cache, flags & ~__GFP_HIGHMEM);
+	if (unlikely(!h))
+		return 0;
+	h->size = size;
+
+	class = get_class(pool, h);
+
+	write_lock(&class->lock);
+	if (list_empty(&class->partial)) {
+		write_unlock(&class->lock);
+
+		zspage = alloc_zspage(class, flags);
+		if (unlikely(!zspage)) {
+			kmem_cache_free(pool->handle_cache, h);
+			return 0;
+		}
+
+		write_lock(&class->lock);
+		list_add(&zspage->list, &class->partial);
+		class->zspages++;
+	}
+
+	zspage = list_first_entry(&class->partial, struct zspage, list);
+	obj_set(class, zspage, h);
+	class->bytes_used += size;
+	write_unlock(&class->lock);
+
+	return (unsigned long)h;
+}
+
+void zs_free(struct zs_pool *pool, unsigned long handle)
+{
+	int was_full;
+	struct zs_handle *h = (struct zs_handle *)handle;
+	struct size_class *class = get_class(pool, h);
+	struct zspage *zspage;
+
+	write_lock(&class->lock);
+	zspage = h->zspage;
+
+	was_full = zspage->inuse == class->objs_per_zspage;
+	__clear_bit(h->obj_idx, zspage->used_map);
+	zspage->inuse--;
+	class->bytes_used -= h->size;
+
+	if (!zspage->inuse) {
+		list_del(&zspage->list);
+		class->zspages--;
+		write_unlock(&class->lock);
+		free_zspage(class, zspage);
+	} else {
+		if (was_full)
+			list_move(&zspage->list, &class->partial);
+		write_unlock(&class->lock);
+	}
+
+	kmem_cache_free(pool->handle_cache, h);
+}
+
+/*
+ * Fill the object with zs_get_object_size(handle) bytes from src.
+ */
+void zs_write_object(struct zs_pool *pool, unsigned long handle,
+			const void *src)
+{
+	struct zs_handle *h = (struct zs_handle *)handle;
+	struct size_class *class = get_class(pool, h);
+
+	read_lock(&class->lock);
+	zs_copy(h->zspage, h->obj_idx * class->size + ZS_HDR_SIZE,
+		(void *)src, h->size, 1);
+	read_unlock(&class->lock);
+}
+
+/**
+ * zs_map_object - Get a pointer to an object's data for reading.
+ * @pool: pool the object belongs to
+ * @handle: object handle
+ * @buf: bounce buffer of at least zs_get_object_size(handle) bytes
+ *
+ * If the object lies within a single page, it is mapped (KM_USER1)
+ * and a pointer into the mapping is returned. Otherwise, it is copied
+ * to buf and buf is returned. The object cannot be moved until
+ * zs_unmap_object() is called, which must happen without sleeping.
+ */
+void *zs_map_object(struct zs_pool *pool, unsigned long handle, void *buf)
+{
+	u32 off;
+	unsigned char *base;
+	struct zs_handle *h = (struct zs_handle *)handle;
+	struct size_class *class = get_class(pool, h);
+
+	read_lock(&class->lock);
+
+	off = h->obj_idx * class->size + ZS_HDR_SIZE;
+	if ((off & ~PAGE_MASK) + h->size <= PAGE_SIZE) {
+		base = kmap_atomic(h->zspage->pages[off >> PAGE_SHIFT],
+					KM_USER1);
+		return base + (off & ~PAGE_MASK);
+	}
+
+	zs_copy(h->zspage, off, buf, h->size, 0);
+	return buf;
+}
+
+void zs_unmap_object(struct zs_pool *pool, unsigned long handle, void *obj)
+{
+	u32 off;
+	struct zs_handle *h = (struct zs_handle *)handle;
+	struct size_class *class = get_class(pool, h);
+
+	off = h->obj_idx * class->size + ZS_HDR_SIZE;
+	if ((off & ~PAGE_MASK) + h->size <= PAGE_SIZE)
+		kunmap_atomic(obj, KM_USER1);
+
+	read_unlock(&class->lock);
+}
+
+/*
+ * Return the partial zspage with the fewest (least == 1) or the most
+ * (least == 0) objects in use, other than skip.
+ */
+static struct zspage *find_partial(struct size_class *class,
+			struct zspage *skip, int least)
+{
+	struct zspage *zspage, *found = NULL;
+
+	list_for_each_entry(zspage, &class->partial, list) {
+		if (zspage == skip)
+			continue;
+		if (!found || (least ? zspage->inuse < found->inuse :
+					zspage->inuse > found->inuse))
+			found = zspage;
+	}
+
+	return found;
+}
+
+/*
+ * Move all objects out of the emptiest partial zspage into the fullest
+ * ones and free it. Returns 1 if a zspage was freed, 0 if the class
+ * cannot be compacted further.
+ */
+static int compact_one(struct zs_pool *pool, struct size_class *class)
+{
+	u16 idx;
+	u32 free_objs = 0;
+	struct zspage *src, *dst, *zspage;
+
+	src = find_partial(class, NULL, 1);
+	if (!src)
+		return 0;
+
+	/* Give up unless the other partials can absorb all of src */
+	list_for_each_entry(zspage, &class->partial, list)
+		if (zspage != src)
+			free_objs += class->objs_per_zspage - zspage->inuse;
+	if (free_objs < src->inuse)
+		return 0;
+
+	for_each_set_bit(idx, src->used_map, class->objs_per_zspage) {
+		unsigned long hval;
+		struct zs_handle *h;
+
+		dst = find_partial(class, src, 0);
+		BUG_ON(!dst);
+
+		zs_copy(src, idx * class->size, pool->compact_buf,
+			class->size, 0);
+		hval = *(unsigned long *)pool->compact_buf;
+		h = (struct zs_handle *)hval;
+
+		obj_set(class, dst, h);
+		zs_copy(dst, h->obj_idx * class->size + ZS_HDR_SIZE,
+			pool->compact_buf + ZS_HDR_SIZE, h->size, 1);
+	}
+
+	list_del(&src->list);
+	class->zspages--;
+	free_zspage(class, src);
+
+	return 1;
+}
+
+/**
+ * zs_compact - Free zspages by moving objects out of sparse ones.
+ * @pool: pool to compact
+ *
+ * Returns the number of pages freed. May sleep.
+ */
+unsigned long zs_compact(struct zs_pool *pool)
+{
+	u32 i;
+	unsigned long freed = 0;
+
+	mutex_lock(&pool->compact_lock);
+	for (i = 0; i < ZS_NUM_CLASSES; i++) {
+		struct size_class *class = &pool->classes[i];
+
+		for (;;) {
+			int ret;
+
+			write_lock(&class->lock);
+			ret = compact_one(pool, class);
+			write_unlock(&class->lock);
+
+			if (!ret)
+				break;
+			freed += class->pages_per_zspage;
+			cond_resched();
+		}
+	}
+	pool->pages_compacted += freed;
+	mutex_unlock(&pool->compact_lock);
+
+	return freed;
+}
+
+u32 zs_get_object_size(unsigned long handle)
+{
+	return ((struct zs_handle *)handle)->size;
+}
+
+/*
+ * Returns total memory held in zspages
+ */
+u64 zs_get_total_size_bytes(struct zs_pool *pool)
+{
+	u32 i;
+	u64 total = 0;
+
+	for (i = 0; i < ZS_NUM_CLASSES; i++) {
+		struct size_class *class = &pool->classes[i];
+
+		read_lock(&class->lock);
+		total += (u64)class->zspages * class->pages_per_zspage;
+		read_unlock(&class->lock);
+	}
+
+	return total << PAGE_SHIFT;
+}
+
+/*
+ * Returns the sum of the sizes of all allocated objects. The difference
+ * from zs_get_total_size_bytes() is memory lost to fragmentation.
+ */
+u64 zs_get_used_size_bytes(struct zs_pool *pool)
+{
+	u32 i;
+	u64 used = 0;
+
+	for (i = 0; i < ZS_NUM_CLASSES; i++) {
+		struct size_class *class = &pool->classes[i];
+
+		read_lock(&class->lock);
+		used += class->bytes_used;
+		read_unlock(&class->lock);
+	}
+
+	return used;
+}
+
+u64 zs_get_pages_compacted(struct zs_pool *pool)
+{
+	return pool->pages_compacted;
+}
@@ -0,0 +1,36 @@
+/*
+ * zsmalloc memory allocator
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ */
+
+#ifndef _ZS_MALLOC_H_
+#define _ZS_MALLOC_H_
+
+#include <linux/types.h>
+
+struct zs_pool;
+
+struct zs_pool *zs_create_pool(void);
+void zs_destroy_pool(struct zs_pool *pool);
+
+unsigned long zs_malloc(struct zs_pool *pool, u32 size, gfp_t flags);
+void zs_free(struct zs_pool *pool, unsigned long handle);
+
+void zs_write_object(struct zs_pool *pool, unsigned long handle,
+			const void *src);
+void *zs_map_object(struct zs_pool *pool, unsigned long handle, void *buf);
+void zs_unmap_object(struct zs_pool *pool, unsigned long handle, void *obj);
+
+unsigned long zs_compact(struct zs_pool *pool);
+
+u32 zs_get_object_size(unsigned long handle);
+u64 zs_get_total_size_bytes(struct zs_pool *pool);
+u64 zs_get_used_size_bytes(struct zs_pool *pool);
+u64 zs_get_pages_compacted(struct zs_pool *pool);
+
+#endif
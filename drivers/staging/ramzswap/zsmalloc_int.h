@@ -0,0 +1,94 @@
+/*
+ * zsmalloc memory allocator
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ */
+
+#ifndef _ZS_MALLOC_INT_H_
+#define _ZS_MALLOC_INT_H_
+
+#include <linux/kernel.h>
+#include <linux/list.h>
+#include <linux/mutex.h>
+#include <linux/spinlock.h>
+#include <linux/types.h>
+
+/* User configurable params */
+
+/*
+ * Each object starts with a back-reference to its handle so that
+ * compaction can find and update the handle when moving the object.
+ * Must be a multiple of 8 so the header never crosses a page boundary.
+ */
+#define ZS_HDR_SIZE		8
+
+#define ZS_MIN_ALLOC_SIZE	32
+#define ZS_MAX_ALLOC_SIZE	PAGE_SIZE
+
+/* Size classes are separated by ZS_SIZE_CLASS_DELTA bytes */
+#define ZS_SIZE_CLASS_DELTA_SHIFT	4
+#define ZS_SIZE_CLASS_DELTA	(1 << ZS_SIZE_CLASS_DELTA_SHIFT)
+#define ZS_NUM_CLASSES		((ZS_MAX_ALLOC_SIZE - ZS_MIN_ALLOC_SIZE) \
+					/ ZS_SIZE_CLASS_DELTA + 1)
+
+/*
+ * A zspage is a group of up to this many (not necessarily contiguous)
+ * 0-order pages. Objects are packed back to back across the pages of
+ * a zspage, so a class can pick the number of pages that wastes the
+ * least space at the end.
+ */
+#define ZS_MAX_PAGES_PER_ZSPAGE	4
+#define ZS_MAX_OBJS_PER_ZSPAGE	(ZS_MAX_PAGES_PER_ZSPAGE * PAGE_SIZE \
+					/ ZS_MIN_ALLOC_SIZE)
+
+/* End of user params */
+
+struct zspage {
+	struct list_head list;		/* entry in class partial/full list */
+	struct page *pages[ZS_MAX_PAGES_PER_ZSPAGE];
+	u16 inuse;			/* no. of allocated objects */
+	ulong used_map[BITS_TO_LONGS(ZS_MAX_OBJS_PER_ZSPAGE)];
+};
+
+/*
+ * Handles stay valid while the object they refer to is moved, so
+ * callers never see the object's location.
+ */
+struct zs_handle {
+	struct zspage *zspage;
+	u16 obj_idx;
+	u16 size;		/* size requested by the caller */
+};
+
+struct size_class {
+	/*
+	 * Readers (map, write) take this shared; allocation, free and
+	 * compaction take it exclusive.
+	 */
+	rwlock_t lock;
+	struct list_head partial;	/* zspages with free objects */
+	struct list_head full;		/* zspages with no free object */
+
+	u32 size;			/* object size incl. ZS_HDR_SIZE */
+	u16 pages_per_zspage;
+	u16 objs_per_zspage;
+
+	/* stats */
+	u32 zspages;
+	u64 bytes_used;			/* sum of requested sizes */
+};
+
+struct zs_pool {
+	struct size_class classes[ZS_NUM_CLASSES];
+	struct kmem_cache *handle_cache;
+
+	struct mutex compact_lock;	/* serializes zs_compact() */
+	void *compact_buf;		/* bounce buffer for moving objects */
+	u64 pages_compacted;
+};
+
+#endif
@@ -61,6 +61,9 @@
 
 #define PMEM_GET_FREE_SPACE	_IOW(PMEM_IOCTL_MAGIC, 14, unsigned int)
 #define PMEM_ALLOCATE_ALIGNED	_IOW(PMEM_IOCTL_MAGIC, 15, unsigned int)
+/* Performs one cache operation on several ranges of the file in a single
+ * call, pass a struct pmem_cache_batch as the argument */
+#define PMEM_CACHE_MAINT_BATCH	_IOW(PMEM_IOCTL_MAGIC, 16, unsigned int)
 struct pmem_region {
 	unsigned long offset;
 	unsigned long len;
@@ -72,6 +75,16 @@ struct pmem_addr {
 	unsigned long length;
 };
 
+#define PMEM_CACHE_BATCH_MAX 16
+
+struct pmem_cache_batch {
+	/* PMEM_CLEAN_CACHES, PMEM_INV_CACHES or PMEM_CLEAN_INV_CACHES */
+	unsigned int cmd;
+	/* number of entries in addrs, at most PMEM_CACHE_BATCH_MAX */
+	unsigned int count;
+	struct pmem_addr *addrs;
+};
+
 struct pmem_freespace {
 	unsigned long total;
 	unsigned long largest;
@@ -94,6 +107,8 @@ void flush_pmem_fd(int fd, unsigned long start, unsigned long len);
 void flush_pmem_file(struct file *file, unsigned long start, unsigned long len);
 int pmem_cache_maint(struct file *file, unsigned int cmd,
 		struct pmem_addr *pmem_addr);
+int pmem_cache_maint_batch(struct file *file, unsigned int cmd,
+		struct pmem_addr *addrs, unsigned int count);
 
 enum pmem_allocator_type {
 	/* Zero is a default in platform PMEM structures in the board files,
@@ -13,8 +13,16 @@
 
 struct gen_pool;
 
+/* search algorithms, see gen_pool_set_algo() */
+enum {
+	GEN_POOL_FIRST_FIT,
+	GEN_POOL_BEST_FIT,
+};
+
 struct gen_pool *__must_check gen_pool_create(unsigned order, int nid);
 
+void gen_pool_set_algo(struct gen_pool *pool, int algo);
+
 void gen_pool_destroy(struct gen_pool *pool);
 
 unsigned long __must_check
@@ -27,7 +35,7 @@ gen_pool_alloc_aligned(struct gen_pool *pool, size_t size,
  * @size:	Number of bytes to allocate from the pool.
  *
  * Allocate the requested number of bytes from the specified pool.
- * Uses a first-fit algorithm.
+ * Uses the pool's search algorithm, first-fit by default.
  */
 static inline unsigned long __must_check
 gen_pool_alloc(struct gen_pool *pool, size_t size)
@@ -37,6 +45,8 @@ gen_pool_alloc(struct gen_pool *pool, size_t size)
 
 void gen_pool_free(struct gen_pool *pool, unsigned long addr, size_t size);
 
+size_t gen_pool_largest_free(struct gen_pool *pool);
+
 extern phys_addr_t gen_pool_virt_to_phys(struct gen_pool *pool, unsigned long);
 extern int gen_pool_add_virt(struct gen_pool *, unsigned long, phys_addr_t,
 			     size_t, int);
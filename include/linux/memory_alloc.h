@@ -16,18 +16,44 @@
 #include <linux/mutex.h>
 #include <linux/genalloc.h>
 #include <linux/rbtree.h>
+#include <linux/list.h>
+#include <linux/types.h>
+
+/* freed blocks of up to this many pages are cached by size for reuse */
+#define MEMPOOL_NR_BUCKETS	8
+#define MEMPOOL_BUCKET_DEPTH	4
+
+struct mem_pool_stats {
+	unsigned long allocs;
+	unsigned long frees;
+	unsigned long failures;
+	unsigned long bucket_hits;
+	u64 alloc_ns;		/* total time spent allocating */
+	u64 max_alloc_ns;
+};
 
 struct mem_pool {
+	/* protects gpool, free, the buckets and the stats */
 	struct mutex pool_mutex;
 	struct gen_pool *gpool;
 	unsigned long paddr;
 	unsigned long size;
 	unsigned long free;
 	unsigned int id;
+	/* allocations from this pool, keyed by vaddr */
+	struct rb_root alloc_root;
+	struct mutex alloc_mutex;
+	/* buckets[n] caches freed blocks of n + 1 pages */
+	struct list_head buckets[MEMPOOL_NR_BUCKETS];
+	unsigned int bucket_len[MEMPOOL_NR_BUCKETS];
+	unsigned long cached;
+	struct mem_pool_stats stats;
 };
 
 struct alloc {
 	struct rb_node rb_node;
+	/* entry in a mem_pool bucket while the block is cached */
+	struct list_head list;
 	void *vaddr;
 	unsigned long paddr;
 	struct mem_pool *mpool;
@@ -9,6 +9,7 @@
 #define KGSL_CONTEXT_NO_GMEM_ALLOC	2
 #define KGSL_CONTEXT_SUBMIT_IB_LIST	4
 #define KGSL_CONTEXT_CTX_SWITCH	8
+#define KGSL_CONTEXT_SUBMIT_EVENTFD	0x400
 
 /* Memory allocayion flags */
 #define KGSL_MEMFLAGS_GPUREADONLY	0x01000000
@@ -230,8 +231,14 @@ struct kgsl_ringbuffer_issueibcmds {
 	unsigned int numibs;
 	unsigned int timestamp; /*output param */
 	unsigned int flags;
+	int eventfd; /* signalled on timestamp retire, with SUBMIT_EVENTFD */
 };
 
+/* Same command, struct as it was before eventfd was added */
+#define IOCTL_KGSL_RINGBUFFER_ISSUEIBCMDS_OLD \
+	_IOC(_IOC_READ | _IOC_WRITE, KGSL_IOC_TYPE, 0x10, \
+	     offsetof(struct kgsl_ringbuffer_issueibcmds, eventfd))
+
 #define IOCTL_KGSL_RINGBUFFER_ISSUEIBCMDS \
 	_IOWR(KGSL_IOC_TYPE, 0x10, struct kgsl_ringbuffer_issueibcmds)
 
@@ -450,6 +457,14 @@ struct kgsl_timestamp_event_genlock {
 	int handle; /* Handle of the genlock lock to release */
 };
 
+/* An eventfd timestamp event signals an eventfd on timestamp expire */
+
+#define KGSL_TIMESTAMP_EVENT_EVENTFD 2
+
+struct kgsl_timestamp_event_eventfd {
+	int fd; /* File descriptor of the eventfd to signal */
+};
+
 #ifdef __KERNEL__
 #ifdef CONFIG_MSM_KGSL_DRM
 int kgsl_gem_obj_addr(int drm_fd, int handle, unsigned long *start,
@@ -14,6 +14,7 @@
 
 struct zonelist;
 struct notifier_block;
+struct task_struct;
 
 /*
  * Types of limitations to the nodes from which allocations may occur
@@ -43,5 +44,26 @@ static inline void oom_killer_enable(void)
 {
 	oom_killer_disabled = false;
 }
+
+/*
+ * The android lowmemorykiller keeps thread group leaders indexed by
+ * oom_adj. Add, del and replace are called with tasklist_lock held for
+ * writing, update takes it itself.
+ */
+#ifdef CONFIG_ANDROID_LOW_MEMORY_KILLER
+#define lowmem_index_init(p)	INIT_LIST_HEAD(&(p)->lowmem_node)
+extern void lowmem_index_add(struct task_struct *p);
+extern void lowmem_index_del(struct task_struct *p);
+extern void lowmem_index_replace(struct task_struct *old,
+				 struct task_struct *new);
+extern void lowmem_index_update(struct task_struct *p);
+#else
+#define lowmem_index_init(p)	do { } while (0)
+static inline void lowmem_index_add(struct task_struct *p) { }
+static inline void lowmem_index_del(struct task_struct *p) { }
+static inline void lowmem_index_replace(struct task_struct *old,
+					struct task_struct *new) { }
+static inline void lowmem_index_update(struct task_struct *p) { }
+#endif
 #endif /* __KERNEL__*/
 #endif /* _INCLUDE_LINUX_OOM_H */
@@ -1223,6 +1223,9 @@ struct task_struct {
 #endif
 
 	struct list_head tasks;
+#ifdef CONFIG_ANDROID_LOW_MEMORY_KILLER
+	struct list_head lowmem_node;	/* oom_adj index, group leaders only */
+#endif
 	struct plist_node pushable_tasks;
 
 	struct mm_struct *mm, *active_mm;
@@ -21,6 +21,7 @@ struct gen_pool {
 	rwlock_t lock;			/* protects chunks list */
 	struct list_head chunks;	/* list of chunks in this pool */
 	unsigned order;			/* minimum allocation order */
+	int algo;			/* GEN_POOL_FIRST_FIT or _BEST_FIT */
 };
 
 /* General purpose special memory pool chunk descriptor. */
@@ -30,6 +31,8 @@ struct gen_pool_chunk {
 	phys_addr_t phys_addr;		/* physical starting address of memory chunk */
 	unsigned long start;		/* start of memory chunk */
 	unsigned long size;		/* number of bits */
+	unsigned long avail;		/* number of clear bits */
+	unsigned long hint;		/* first clear bit, or size if none */
 	unsigned long bits[0];		/* bitmap for allocating memory chunk */
 };
 
@@ -55,11 +58,28 @@ struct gen_pool *__must_check gen_pool_create(unsigned order, int nid)
 		rwlock_init(&pool->lock);
 		INIT_LIST_HEAD(&pool->chunks);
 		pool->order = order;
+		pool->algo = GEN_POOL_FIRST_FIT;
 	}
 	return pool;
 }
 EXPORT_SYMBOL(gen_pool_create);
 
+/**
+ * gen_pool_set_algo() - select how allocations search the pool
+ * @pool:	Pool to change.
+ * @algo:	GEN_POOL_FIRST_FIT (the default) takes the lowest free
+ *		range that fits; GEN_POOL_BEST_FIT takes a fit in the
+ *		smallest free extent of a chunk, which keeps large extents
+ *		intact on pools that mix small and large allocations.
+ */
+void gen_pool_set_algo(struct gen_pool *pool, int algo)
+{
+	write_lock(&pool->lock);
+	pool->algo = algo;
+	write_unlock(&pool->lock);
+}
+EXPORT_SYMBOL(gen_pool_set_algo);
+
 /**
  * gen_pool_add_virt - add a new chunk of special memory to the pool
  * @pool: pool to add new memory chunk to
@@ -96,6 +116,7 @@ int __must_check gen_pool_add_virt(struct gen_pool *pool, unsigned long virt, ph
 	chunk->phys_addr = phys;
 	chunk->start = virt >> pool->order;
 	chunk->size  = size;
+	chunk->avail = size;
 
 	write_lock(&pool->lock);
 	list_add(&chunk->next_chunk, &pool->chunks);
@@ -122,8 +143,10 @@ phys_addr_t gen_pool_virt_to_phys(struct gen_pool *pool, unsigned long addr)
 		chunk = list_entry(_chunk, struct gen_pool_chunk, next_chunk);
 
 		if (addr >= chunk->start &&
-		    addr < (chunk->start + chunk->size))
+		    addr < (chunk->start + chunk->size)) {
+			read_unlock(&pool->lock);
 			return chunk->phys_addr + addr - chunk->start;
+		}
 	}
 	read_unlock(&pool->lock);
 
@@ -157,6 +180,34 @@ void gen_pool_destroy(struct gen_pool *pool)
 }
 EXPORT_SYMBOL(gen_pool_destroy);
 
+/*
+ * Walk the free extents of a chunk from its hint, a word at a time, and
+ * return the aligned start of @nr bits in the smallest extent that can
+ * hold them, or chunk->size if none can. Called with chunk->lock held.
+ */
+static unsigned long chunk_best_fit(struct gen_pool_chunk *chunk,
+				    unsigned long nr, unsigned long align_mask)
+{
+	unsigned long start, end, index;
+	unsigned long best = chunk->size, best_len = ULONG_MAX;
+
+	for (start = chunk->hint; start < chunk->size;
+	     start = find_next_zero_bit(chunk->bits, chunk->size, end)) {
+		end = find_next_bit(chunk->bits, chunk->size, start);
+		if (end - start >= best_len)
+			continue;
+		index = __ALIGN_MASK(start + chunk->start, align_mask) -
+			chunk->start;
+		if (index + nr > end)
+			continue;
+		best = index;
+		best_len = end - start;
+		if (best_len == nr)
+			break;
+	}
+	return best;
+}
+
 /**
  * gen_pool_alloc_aligned() - allocate special memory from the pool
  * @pool:	Pool to allocate from.
@@ -166,7 +217,7 @@ EXPORT_SYMBOL(gen_pool_destroy);
  *			must be aligned to 1MiB).
  *
  * Allocate the requested number of bytes from the specified pool.
- * Uses a first-fit algorithm.
+ * Uses the algorithm set by gen_pool_set_algo(), first-fit by default.
  */
 unsigned long __must_check
 gen_pool_alloc_aligned(struct gen_pool *pool, size_t size,
@@ -185,19 +236,28 @@ gen_pool_alloc_aligned(struct gen_pool *pool, size_t size,
 
 	read_lock(&pool->lock);
 	list_for_each_entry(chunk, &pool->chunks, next_chunk) {
-		if (chunk->size < size)
+		/* racy, but a chunk this full is worth skipping unlocked */
+		if (chunk->avail < size)
 			continue;
 
 		spin_lock_irqsave(&chunk->lock, flags);
-		start = bitmap_find_next_zero_area_off(chunk->bits, chunk->size,
-						       0, size, align_mask,
-						       chunk->start);
+		/* nothing below the hint is free */
+		if (pool->algo == GEN_POOL_BEST_FIT)
+			start = chunk_best_fit(chunk, size, align_mask);
+		else
+			start = bitmap_find_next_zero_area_off(chunk->bits,
+						chunk->size, chunk->hint, size,
+						align_mask, chunk->start);
 		if (start >= chunk->size) {
 			spin_unlock_irqrestore(&chunk->lock, flags);
 			continue;
 		}
 
 		bitmap_set(chunk->bits, start, size);
+		chunk->avail -= size;
+		if (start == chunk->hint)
+			chunk->hint = find_next_zero_bit(chunk->bits,
+						chunk->size, start + size);
 		spin_unlock_irqrestore(&chunk->lock, flags);
 		addr = (chunk->start + start) << pool->order;
 		goto done;
@@ -237,6 +297,9 @@ void gen_pool_free(struct gen_pool *pool, unsigned long addr, size_t size)
 		    addr + size <= chunk->start + chunk->size) {
 			spin_lock_irqsave(&chunk->lock, flags);
 			bitmap_clear(chunk->bits, addr - chunk->start, size);
+			chunk->avail += size;
+			if (addr - chunk->start < chunk->hint)
+				chunk->hint = addr - chunk->start;
 			spin_unlock_irqrestore(&chunk->lock, flags);
 			goto done;
 		}
@@ -245,3 +308,32 @@ done:
 	read_unlock(&pool->lock);
 }
 EXPORT_SYMBOL(gen_pool_free);
+
+/**
+ * gen_pool_largest_free() - size of the largest free extent in the pool
+ * @pool:	Pool to look at.
+ *
+ * Returns the size in bytes of the largest run of free space in any one
+ * chunk of the pool, mostly useful to gauge fragmentation.
+ */
+size_t gen_pool_largest_free(struct gen_pool *pool)
+{
+	struct gen_pool_chunk *chunk;
+	unsigned long flags, start, end, largest = 0;
+
+	read_lock(&pool->lock);
+	list_for_each_entry(chunk, &pool->chunks, next_chunk) {
+		spin_lock_irqsave(&chunk->lock, flags);
+		for (start = chunk->hint; start < chunk->size;
+		     start = find_next_zero_bit(chunk->bits, chunk->size, end)) {
+			end = find_next_bit(chunk->bits, chunk->size, start);
+			if (end - start > largest)
+				largest = end - start;
+		}
+		spin_unlock_irqrestore(&chunk->lock, flags);
+	}
+	read_unlock(&pool->lock);
+
+	return largest << pool->order;
+}
+EXPORT_SYMBOL(gen_pool_largest_free);
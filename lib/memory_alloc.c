@@ -21,75 +21,85 @@
 #include <linux/log2.h>
 #include <linux/debugfs.h>
 #include <linux/seq_file.h>
+#include <linux/sched.h>
+#include <linux/math64.h>
 
 
 #define MAX_MEMPOOLS 8
 
 struct mem_pool mpools[MAX_MEMPOOLS];
 
-/* The tree contains all allocations over all memory pools */
-static struct rb_root alloc_root;
-static struct mutex alloc_mutex;
+/* Each pool keeps its own tree of allocations under its own alloc_mutex */
 
-static void *s_start(struct seq_file *m, loff_t *pos)
-	__acquires(&alloc_mutex)
+static int mempool_map_show(struct seq_file *m, void *unused)
 {
-	loff_t n = *pos;
+	struct mem_pool *mpool;
 	struct rb_node *r;
 
-	mutex_lock(&alloc_mutex);
-	r = rb_first(&alloc_root);
+	for (mpool = mpools; mpool < mpools + MAX_MEMPOOLS; mpool++) {
+		mutex_lock(&mpool->alloc_mutex);
+		for (r = rb_first(&mpool->alloc_root); r; r = rb_next(r)) {
+			struct alloc *node = rb_entry(r, struct alloc, rb_node);
 
-	while (n > 0 && r) {
-		n--;
-		r = rb_next(r);
+			seq_printf(m, "0x%lx 0x%p %ld %u %pS\n", node->paddr,
+				   node->vaddr, node->len, node->mpool->id,
+				   node->caller);
+		}
+		mutex_unlock(&mpool->alloc_mutex);
 	}
-	if (!n)
-		return r;
-	return NULL;
-}
-
-static void *s_next(struct seq_file *m, void *p, loff_t *pos)
-{
-	struct rb_node *r = p;
-	++*pos;
-	return rb_next(r);
+	return 0;
 }
 
-static void s_stop(struct seq_file *m, void *p)
-	__releases(&alloc_mutex)
+static int mempool_open(struct inode *inode, struct file *file)
 {
-	mutex_unlock(&alloc_mutex);
+	return single_open(file, mempool_map_show, NULL);
 }
 
-static int s_show(struct seq_file *m, void *p)
+static int mempool_stats_show(struct seq_file *m, void *unused)
 {
-	struct rb_node *r = p;
-	struct alloc *node = rb_entry(r, struct alloc, rb_node);
+	struct mem_pool *mpool;
 
-	seq_printf(m, "0x%lx 0x%p %ld %u %pS\n", node->paddr, node->vaddr,
-		   node->len, node->mpool->id, node->caller);
+	seq_printf(m, "pool size free cached largest frag%% allocs frees "
+		   "failures bucket_hits avg_ns max_ns\n");
+	for (mpool = mpools; mpool < mpools + MAX_MEMPOOLS; mpool++) {
+		struct mem_pool_stats st;
+		unsigned long free, cached, largest = 0;
+		unsigned int frag = 0;
+
+		if (!mpool->size)
+			continue;
+
+		mutex_lock(&mpool->pool_mutex);
+		st = mpool->stats;
+		free = mpool->free;
+		cached = mpool->cached;
+		if (mpool->gpool)
+			largest = gen_pool_largest_free(mpool->gpool);
+		mutex_unlock(&mpool->pool_mutex);
+
+		/* cached blocks are free too, but not contiguous with the rest */
+		if (free)
+			frag = 100 - (unsigned int)
+				div_u64((u64)largest * 100, free);
+		if (st.allocs)
+			do_div(st.alloc_ns, st.allocs);
+
+		seq_printf(m, "%u %lu %lu %lu %lu %u %lu %lu %lu %lu %llu "
+			   "%llu\n", mpool->id, mpool->size, free, cached,
+			   largest, frag, st.allocs, st.frees, st.failures,
+			   st.bucket_hits, st.alloc_ns, st.max_alloc_ns);
+	}
 	return 0;
 }
 
-static const struct seq_operations mempool_op = {
-	.start = s_start,
-	.next = s_next,
-	.stop = s_stop,
-	.show = s_show,
-};
-
-static int mempool_open(struct inode *inode, struct file *file)
+static int mempool_stats_open(struct inode *inode, struct file *file)
 {
-	return seq_open(file, &mempool_op);
+	return single_open(file, mempool_stats_show, NULL);
 }
 
-static struct alloc *find_alloc(void *addr)
+static struct alloc *find_alloc_in_pool(struct mem_pool *mpool, void *addr)
 {
-	struct rb_root *root = &alloc_root;
-	struct rb_node *p = root->rb_node;
-
-	mutex_lock(&alloc_mutex);
+	struct rb_node *p = mpool->alloc_root.rb_node;
 
 	while (p) {
 		struct alloc *node;
@@ -99,22 +109,35 @@ static struct alloc *find_alloc(void *addr)
 			p = p->rb_left;
 		else if (addr > node->vaddr)
 			p = p->rb_right;
-		else {
-			mutex_unlock(&alloc_mutex);
+		else
 			return node;
-		}
 	}
-	mutex_unlock(&alloc_mutex);
 	return NULL;
 }
 
+static struct alloc *find_alloc(void *addr)
+{
+	struct mem_pool *mpool;
+	struct alloc *node = NULL;
+
+	for (mpool = mpools; mpool < mpools + MAX_MEMPOOLS && !node;
+	     mpool++) {
+		if (!mpool->size)
+			continue;
+		mutex_lock(&mpool->alloc_mutex);
+		node = find_alloc_in_pool(mpool, addr);
+		mutex_unlock(&mpool->alloc_mutex);
+	}
+	return node;
+}
+
 static int add_alloc(struct alloc *node)
 {
-	struct rb_root *root = &alloc_root;
-	struct rb_node **p = &root->rb_node;
+	struct mem_pool *mpool = node->mpool;
+	struct rb_node **p = &mpool->alloc_root.rb_node;
 	struct rb_node *parent = NULL;
 
-	mutex_lock(&alloc_mutex);
+	mutex_lock(&mpool->alloc_mutex);
 	while (*p) {
 		struct alloc *tmp;
 		parent = *p;
@@ -127,28 +150,155 @@ static int add_alloc(struct alloc *node)
 			p = &(*p)->rb_right;
 		else {
 			WARN(1, "memory at %p already allocated", tmp->vaddr);
-			mutex_unlock(&alloc_mutex);
+			mutex_unlock(&mpool->alloc_mutex);
 			return -EINVAL;
 		}
 	}
 	rb_link_node(&node->rb_node, parent, p);
-	rb_insert_color(&node->rb_node, root);
-	mutex_unlock(&alloc_mutex);
+	rb_insert_color(&node->rb_node, &mpool->alloc_root);
+	mutex_unlock(&mpool->alloc_mutex);
 	return 0;
 }
 
 static int remove_alloc(struct alloc *victim_node)
 {
-	struct rb_root *root = &alloc_root;
+	struct mem_pool *mpool;
+
 	if (!victim_node)
 		return -EINVAL;
 
-	mutex_lock(&alloc_mutex);
-	rb_erase(&victim_node->rb_node, root);
-	mutex_unlock(&alloc_mutex);
+	mpool = victim_node->mpool;
+	mutex_lock(&mpool->alloc_mutex);
+	rb_erase(&victim_node->rb_node, &mpool->alloc_root);
+	mutex_unlock(&mpool->alloc_mutex);
+	return 0;
+}
+
+/*
+ * Small blocks are recycled through per-size buckets instead of going back
+ * to the gen_pool, so the common small allocation is a list pop. Larger
+ * ones, and small ones when their bucket is empty, come from the gen_pool.
+ * Call these with pool_mutex held.
+ */
+static int len_to_bucket(unsigned long len)
+{
+	int bucket = (len >> PAGE_SHIFT) - 1;
+
+	return bucket < MEMPOOL_NR_BUCKETS ? bucket : -1;
+}
+
+static struct alloc *bucket_get(struct mem_pool *mpool, unsigned long len,
+	int log_align)
+{
+	int bucket = len_to_bucket(len);
+	struct alloc *node;
+
+	if (bucket < 0)
+		return NULL;
+
+	/* the buckets are short, so this stays constant time */
+	list_for_each_entry(node, &mpool->buckets[bucket], list)
+		if (IS_ALIGNED(node->paddr, 1UL << log_align)) {
+			list_del(&node->list);
+			mpool->bucket_len[bucket]--;
+			mpool->cached -= len;
+			mpool->stats.bucket_hits++;
+			return node;
+		}
+	return NULL;
+}
+
+static int bucket_put(struct mem_pool *mpool, struct alloc *node)
+{
+	int bucket = len_to_bucket(node->len);
+
+	if (bucket < 0 || mpool->bucket_len[bucket] >= MEMPOOL_BUCKET_DEPTH)
+		return -ENOSPC;
+
+	list_add(&node->list, &mpool->buckets[bucket]);
+	mpool->bucket_len[bucket]++;
+	mpool->cached += node->len;
 	return 0;
 }
 
+/* give every cached block back to the gen_pool so they can coalesce */
+static void bucket_drain(struct mem_pool *mpool)
+{
+	struct alloc *node, *tmp;
+	int i;
+
+	for (i = 0; i < MEMPOOL_NR_BUCKETS; i++) {
+		list_for_each_entry_safe(node, tmp, &mpool->buckets[i], list) {
+			list_del(&node->list);
+			gen_pool_free(mpool->gpool, node->paddr, node->len);
+			kfree(node);
+		}
+		mpool->bucket_len[i] = 0;
+	}
+	mpool->cached = 0;
+}
+
+/*
+ * Reserve aligned_size bytes of the pool and return the node that will
+ * track them, with paddr and len filled in.
+ */
+static struct alloc *pool_alloc(struct mem_pool *mpool,
+	unsigned long aligned_size, int log_align)
+{
+	struct alloc *node;
+	unsigned long paddr;
+	u64 start = sched_clock(), delta;
+
+	mutex_lock(&mpool->pool_mutex);
+	node = bucket_get(mpool, aligned_size, log_align);
+	if (node)
+		goto out;
+
+	paddr = gen_pool_alloc_aligned(mpool->gpool, aligned_size, log_align);
+	if (!paddr && mpool->cached) {
+		bucket_drain(mpool);
+		paddr = gen_pool_alloc_aligned(mpool->gpool, aligned_size,
+			log_align);
+	}
+	if (!paddr)
+		goto out;
+
+	node = kmalloc(sizeof(struct alloc), GFP_KERNEL);
+	if (!node) {
+		gen_pool_free(mpool->gpool, paddr, aligned_size);
+		goto out;
+	}
+	node->paddr = paddr;
+	node->len = aligned_size;
+	node->mpool = mpool;
+out:
+	if (node) {
+		mpool->free -= aligned_size;
+		mpool->stats.allocs++;
+		delta = sched_clock() - start;
+		mpool->stats.alloc_ns += delta;
+		if (delta > mpool->stats.max_alloc_ns)
+			mpool->stats.max_alloc_ns = delta;
+	} else
+		mpool->stats.failures++;
+	mutex_unlock(&mpool->pool_mutex);
+	return node;
+}
+
+static void pool_free(struct alloc *node)
+{
+	struct mem_pool *mpool = node->mpool;
+
+	mutex_lock(&mpool->pool_mutex);
+	mpool->free += node->len;
+	mpool->stats.frees++;
+	if (bucket_put(mpool, node)) {
+		gen_pool_free(mpool->gpool, node->paddr, node->len);
+		kfree(node);
+	}
+	mutex_unlock(&mpool->pool_mutex);
+}
+
 static struct gen_pool *initialize_gpool(unsigned long start,
 	unsigned long size)
 {
@@ -158,6 +308,8 @@ static struct gen_pool *initialize_gpool(unsigned long start,
 
 	if (!gpool)
 		return NULL;
+	/* carveout allocations vary widely in size, keep big extents whole */
+	gen_pool_set_algo(gpool, GEN_POOL_BEST_FIT);
 	if (gen_pool_add(gpool, start, size, -1)) {
 		gen_pool_destroy(gpool);
 		return NULL;
@@ -178,13 +330,10 @@ static void *__alloc(struct mem_pool *mpool, unsigned long size,
 	struct alloc *node;
 
 	aligned_size = PFN_ALIGN(size);
-	paddr = gen_pool_alloc_aligned(mpool->gpool, aligned_size, log_align);
-	if (!paddr)
-		return NULL;
-
-	node = kmalloc(sizeof(struct alloc), GFP_KERNEL);
+	node = pool_alloc(mpool, aligned_size, log_align);
 	if (!node)
-		goto out;
+		return NULL;
+	paddr = node->paddr;
 
 	if (cached)
 		vaddr = ioremap_cached(paddr, aligned_size);
@@ -192,25 +341,18 @@ static void *__alloc(struct mem_pool *mpool, unsigned long size,
 		vaddr = ioremap(paddr, aligned_size);
 
 	if (!vaddr)
-		goto out_kfree;
+		goto out;
 
 	node->vaddr = vaddr;
-	node->paddr = paddr;
-	node->len = aligned_size;
-	node->mpool = mpool;
 	node->caller = caller;
 	if (add_alloc(node))
-		goto out_kfree;
-
-	mpool->free -= aligned_size;
+		goto out_unmap;
 
 	return vaddr;
-out_kfree:
-	if (vaddr)
-		iounmap(vaddr);
-	kfree(node);
+out_unmap:
+	iounmap(vaddr);
 out:
-	gen_pool_free(mpool->gpool, paddr, aligned_size);
+	pool_free(node);
 	return NULL;
 }
 
@@ -224,11 +366,8 @@ static void __free(void *vaddr, bool unmap)
 	if (unmap)
 		iounmap(node->vaddr);
 
-	gen_pool_free(node->mpool->gpool, node->paddr, node->len);
-	node->mpool->free += node->len;
-
 	remove_alloc(node);
-	kfree(node);
+	pool_free(node);
 }
 
 static struct mem_pool *mem_type_to_memory_pool(int mem_type)
@@ -300,15 +439,10 @@ unsigned long _allocate_contiguous_memory_nomap(unsigned long size,
 		return 0;
 
 	aligned_size = PFN_ALIGN(size);
-	paddr = gen_pool_alloc_aligned(mpool->gpool, aligned_size, log_align);
-	if (!paddr)
-		return 0;
-
-	node = kmalloc(sizeof(struct alloc), GFP_KERNEL);
+	node = pool_alloc(mpool, aligned_size, log_align);
 	if (!node)
-		goto out;
-
-	node->paddr = paddr;
+		return 0;
+	paddr = node->paddr;
 
 	/* We search the tree using node->vaddr, so set
 	 * it to something unique even though we don't
@@ -318,19 +452,13 @@ unsigned long _allocate_contiguous_memory_nomap(unsigned long size,
 	 * a duplicate node->vaddr value.
 	 */
 	node->vaddr = (void *)paddr;
-	node->len = aligned_size;
-	node->mpool = mpool;
 	node->caller = caller;
-	if (add_alloc(node))
-		goto out_kfree;
+	if (add_alloc(node)) {
+		pool_free(node);
+		return 0;
+	}
 
-	mpool->free -= aligned_size;
 	return paddr;
-out_kfree:
-	kfree(node);
-out:
-	gen_pool_free(mpool->gpool, paddr, aligned_size);
-	return 0;
 }
 EXPORT_SYMBOL_GPL(_allocate_contiguous_memory_nomap);
 
@@ -387,18 +515,30 @@ static const struct file_operations mempool_operations = {
 	.open           = mempool_open,
 	.read           = seq_read,
 	.llseek         = seq_lseek,
-	.release        = seq_release_private,
+	.release        = single_release,
+};
+
+static const struct file_operations mempool_stats_operations = {
+	.owner		= THIS_MODULE,
+	.open           = mempool_stats_open,
+	.read           = seq_read,
+	.llseek         = seq_lseek,
+	.release        = single_release,
 };
 
 int __init memory_pool_init(void)
 {
 	int i;
 
-	alloc_root = RB_ROOT;
-	mutex_init(&alloc_mutex);
 	for (i = 0; i < ARRAY_SIZE(mpools); i++) {
+		int j;
+
 		mutex_init(&mpools[i].pool_mutex);
 		mpools[i].gpool = NULL;
+		mpools[i].alloc_root = RB_ROOT;
+		mutex_init(&mpools[i].alloc_mutex);
+		for (j = 0; j < MEMPOOL_NR_BUCKETS; j++)
+			INIT_LIST_HEAD(&mpools[i].buckets[j]);
 	}
 
 	return 0;
@@ -416,8 +556,16 @@ static int __init debugfs_mempool_init(void)
 	entry = debugfs_create_file("map", S_IRUSR, dir,
 		NULL, &mempool_operations);
 
-	if (!entry)
+	if (!entry) {
 		pr_err("Cannot create /sys/kernel/debug/mempool/map");
+		return -EINVAL;
+	}
+
+	entry = debugfs_create_file("stats", S_IRUSR, dir,
+		NULL, &mempool_stats_operations);
+
+	if (!entry)
+		pr_err("Cannot create /sys/kernel/debug/mempool/stats");
 
 	return entry ? 0 : -EINVAL;
 }